@@ -26,6 +26,7 @@
 #define IS_PERIPHERAL       // To distinguish from a normal user component
 #include "blackbox.h"
 #include "useravr.h"
+#include "trace.h"
 #include "adc.h"
 
 int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
@@ -100,9 +101,12 @@ DECLARE_VAR
    bool Log;              // True if the "Log" checkbox button is checked
    bool Dirty;            // True if clock/status or voltage labels need update
    bool Sleep;            // True if disabled by SLEEP mode deeper than ADC Noise
+
+   REGISTER_NAMES<_nOfRegisters> Reg_names; // Cached names for reg()
 END_VAR
 
 bool Started;             // True if simulation started and interface functions work
+Tracefile Trace;          // Binary trace file shared by all instances
 
 USE_WINDOW(WINDOW_USER_1); // Window to display registers, etc. See .RC file
 
@@ -123,20 +127,27 @@ void Log(const char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
 // This function also automatically prepends the instance name to the formatted
-// message. The message is only printed if logging is enabled in GUI.
+// message. The message is only printed if logging is enabled in GUI. If a
+// trace file is open then only the format and arguments are added to the
+// trace file, and trcdump.exe formats the message. pFormat must be a string
+// literal.
 {
    if(VAR(Log)) {   
-      char strBuffer[MAXBUF];
       va_list argList;
+      va_start(argList, pFormat);
 
-      snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
-      int len = strlen(strBuffer);
+      // The trace file records the instance so it's not part of the message
+      if(Trace.active()) {
+         TRACE_LOG(Trace, pFormat, argList);
+      } else {
+         char strBuffer[MAXBUF];
+         snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
+         int len = strlen(strBuffer);
+         vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
+         PRINT(strBuffer);
+      }
 
-      va_start(argList, pFormat);
-      vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
       va_end(argList);
-
-      PRINT(strBuffer);
    }
 }
 
@@ -148,20 +159,23 @@ void Log_register_write(int pId, WORD8 pData, unsigned char pMask)
 // unknown bits in the pMask position then issue a warning. In either case
 // Log() a message indicating the register is being written with pData. The
 // pId is used to look up the true register name (as given in the .ini file)
-// for the warning and log messages.
+// for the warning and log messages. If a trace file is open, known writes
+// are recorded in binary form together with the old register value.
 {
    if((pData.x() & pMask) != pMask) {      
       char strBuffer[64];
-      char *strName = reg(pId);      
+      const char *strName = VAR(Reg_names)[pId];      
       
       snprintf(strBuffer, 64, "Unknown bits (X) written into %s register",
          strName);
          
       WARNING(strBuffer, CAT_MEMORY, WARN_MEMORY_WRITE_X_IO);
       Log("Write register %s: $??", strName);      
+   } else if(VAR(Log) && Trace.active()) {
+      TRACE_WRITE(Trace, pId, REG(pId), pData, pMask);
    } else {
-      if(VAR(Log)) { // Don't waste time in reg() if not logging
-         char *strName = reg(pId);
+      if(VAR(Log)) { // Don't waste time if not logging
+         const char *strName = VAR(Reg_names)[pId];
          Log("Write register %s: $%02X", strName, pData.d() & pMask);
       }
    }
@@ -210,17 +224,18 @@ void On_simulation_begin()                //     "        "
 //**********************
 // Called at the beginning of simulation. All initialization happens inside
 // On_reset() which is always called immediately after On_simulation_begin().
-{   
+{
+   TRACE_BEGIN(Trace, VAR(Reg_names));
 }
 
 void On_simulation_end()
 //**********************
 // If the simulation is ending, set all registers and text fieds to unknown.
 {
+   TRACE_END(Trace);
+
    // Set reigster to unknown and ensure that mode/labels update accordingly
-   FOREACH_REGISTER(j){
-      REG(j) = WORD8(0,0);      // All bits unknown (X)
-   }
+   FILL_REGISTERS(WORD8(0,0));      // All bits unknown (X)
    VAR(Dirty) = true;
    
    // Force On_update_tick() to display "? V" for the voltage values
@@ -39,6 +39,8 @@
       static struct Tag_Variables { \
 	     void *operator new[](size_t pBytes); \
          void operator delete[](void *pMemory); \
+         VIEW_ENTRY _view[_nOfRegisters]; \
+         bool _view_built; \
 	     WORD8 _registers[_nOfRegisters];    // Register array placeholder	  
 #else
    #define DECLARE_VAR \
@@ -56,8 +58,12 @@
    } *_Variables = NULL;\
    void _Alloc_var() { \
       _Variables = new struct Tag_Variables [_N_instances]; \
+      _Bind_instance(); \
+   }\
+   void _Free_var() {delete [] _Variables; _Variables = NULL; _Instance = NULL;}\
+   void _Bind_instance() {\
+      _Instance = _Variables ? &_Variables[_Instance_index] : NULL;\
    }\
-   void _Free_var() {delete [] _Variables;}\
    void *Tag_Variables:: operator new[](size_t pBytes) {\
      DWORD dummy;\
      char *memory;\
@@ -83,8 +89,12 @@
          for(int j = 0; j < sizeof(struct Tag_Variables); j++) \
 		    ((char *)&(_Variables[i]))[j] = 0;\
 	  }\
+      _Bind_instance(); \
+   }\
+   void _Free_var() {delete [] _Variables; _Variables = NULL; _Instance = NULL;}\
+   void _Bind_instance() {\
+      _Instance = _Variables ? &_Variables[_Instance_index] : NULL;\
    }\
-   void _Free_var() {delete [] _Variables;}\
    void *Tag_Variables:: operator new[](size_t pBytes) {\
       return ::new char[pBytes];\
    }\
@@ -95,7 +105,9 @@
 
 #endif
 
-#define VAR(a) (PRIVATE::_Variables[PRIVATE::_Instance_index].a)
+// PRIVATE::_Instance always points to _Variables[_Instance_index]; it is
+// rebound by SetInstance() so each access is a single pointer dereference
+#define VAR(a) (PRIVATE::_Instance->a)
 
 // Typedefs & other defines for hardware 
 //
@@ -190,7 +202,10 @@ namespace PRIVATE {\
 }\
 const PIN name = value;
 
-// Helper class for pin declarations
+// Helper class for pin declarations. Each pin macro adds its strings to a
+// list built by static constructors, and GetPins() copies the list into one
+// heap block on its first call. The strings are not joined at compile time
+// because the pin macros expand separately and C++98 cannot concatenate them.
 //
 
 namespace PRIVATE {
@@ -226,12 +241,17 @@ namespace PRIVATE {
 
    void PIN_ENTRY::GetPins(const char **pBegin, const char **pEnd)
    {
-      if(buffer == NULL) buffer = new char[length];
-      if(buffer == NULL) { *pBegin = *pEnd = NULL; return; }
-      char *dst = buffer;
-
-      for(PIN_ENTRY *pin = &_PIN_LISTBEGIN; pin; pin = pin->next, *dst++ = '\0')
-         for(const char *src = pin->text; *src; src++) *dst++ = *src;
+      // The pin list is fixed once all static PIN_ENTRY objects have been
+      // constructed, so the string block is only built on the first call
+      // and later calls reuse it.
+      if(buffer == NULL) {
+         buffer = new char[length];
+         if(buffer == NULL) { *pBegin = *pEnd = NULL; return; }
+         char *dst = buffer;
+
+         for(PIN_ENTRY *pin = &_PIN_LISTBEGIN; pin; pin = pin->next, *dst++ = '\0')
+            for(const char *src = pin->text; *src; src++) *dst++ = *src;
+      }
          
       *pBegin = buffer;
       *pEnd = buffer + length - 2;
@@ -251,29 +271,77 @@ enum {
 #define END_REGISTERS \
 , _nOfRegisters };
 
-#define REG(a) (PRIVATE::_Variables[PRIVATE::_Instance_index]._registers[a])
+#define REG(a) (PRIVATE::_Instance->_registers[a])
+
+
+// The body of a view is ordinary code, so DISPLAY() entries may be selected
+// at run time (see eeprom.cpp) and the table cannot be a static constant. On
+// the first GetRegisterInfo() call for each instance, the view is walked once
+// to fill a table indexed by register ID, and all later calls are answered
+// from that table. As in a chain of tests, the first DISPLAY() executed for a
+// register takes precedence.
+namespace PRIVATE {
+   struct VIEW_ENTRY {
+      int gadget;                // Gadget ID or -1 if register not displayed
+      const char *bits[8];       // Bit names from b7 down to b0
+   };
+
+   static void _Clear_view(VIEW_ENTRY *pView, int pCount)
+   {
+      for(int i = 0; i < pCount; i++) pView[i].gadget = -1;
+   }
 
+   static int _View_info(const VIEW_ENTRY *pView, int pCount, int pIndex,
+      const char **b7, const char **b6, const char **b5, const char **b4,
+      const char **b3, const char **b2, const char **b1, const char **b0)
+   {
+      if(pIndex < 0 || pIndex >= pCount || pView[pIndex].gadget == -1)
+         return -1;
+      const char * const *bits = pView[pIndex].bits;
+      *b7 = bits[0]; *b6 = bits[1]; *b5 = bits[2]; *b4 = bits[3];
+      *b3 = bits[4]; *b2 = bits[5]; *b1 = bits[6]; *b0 = bits[7];
+      return pView[pIndex].gadget;
+   }
+}
 
 #define REGISTERS_VIEW \
-int GetRegisterInfo(int pIndex, WORD8 **pWord8, \
-   const char **b7, const char **b6, const char **b5, const char **b4,\
-   const char **b3, const char **b2, const char **b1, const char **b0) \
+void _Walk_view(PRIVATE::VIEW_ENTRY *pView) \
 {
 
 #define DISPLAY(a, c, d, e, f, g, h, i, j, k)\
-   if(pIndex == a) {\
-      *pWord8 = PRIVATE::_Variables ? &REG(a) : NULL;\
-      *b7=""#d""; *b6=""#e""; *b5=""#f""; *b4=""#g""; *b3=""#h""; *b2=""#i""; *b1=""#j""; *b0=""#k""; \
-      return c; \
+   if(pView[a].gadget == -1) {\
+      const char **bits = pView[a].bits;\
+      pView[a].gadget = c;\
+      bits[0]=""#d""; bits[1]=""#e""; bits[2]=""#f""; bits[3]=""#g""; \
+      bits[4]=""#h""; bits[5]=""#i""; bits[6]=""#j""; bits[7]=""#k""; \
    }
 
 #define HIDDEN(a) DISPLAY(a, 0, *, *, *, *, *, *, *, *)
 
+// Without an instance there is nowhere to keep the table, so it is rebuilt
+// in a static buffer on every call
 #define END_VIEW \
-return -1; \
+} \
+int GetRegisterInfo(int pIndex, WORD8 **pWord8, \
+   const char **b7, const char **b6, const char **b5, const char **b4,\
+   const char **b3, const char **b2, const char **b1, const char **b0) \
+{ \
+   static PRIVATE::VIEW_ENTRY noInstance[_nOfRegisters]; \
+   PRIVATE::Tag_Variables *instance = PRIVATE::_Instance; \
+   PRIVATE::VIEW_ENTRY *view = instance ? instance->_view : noInstance; \
+   if(!instance || !instance->_view_built) { \
+      PRIVATE::_Clear_view(view, _nOfRegisters); \
+      _Walk_view(view); \
+      if(instance) instance->_view_built = true; \
+   } \
+   int gadget = PRIVATE::_View_info(view, _nOfRegisters, pIndex, \
+      b7, b6, b5, b4, b3, b2, b1, b0); \
+   if(gadget != -1) *pWord8 = instance ? &REG(pIndex) : NULL; \
+   return gadget; \
 }
 
 #define FOREACH_REGISTER(a) for(int a = 0; a < _nOfRegisters; a++)
+#define FILL_REGISTERS(v) WORD8_FILL(&REG(0), v, _nOfRegisters)
 
 #define DECLARE_INTERRUPTS enum {
 #define END_INTERRUPTS };
@@ -303,6 +371,8 @@ return -1; \
 // DLL private variables
 //
 namespace PRIVATE {
+   struct Tag_Variables;      // Defined by DECLARE_VAR / END_VAR
+
    static void (*_Print)(const char *) = NULL;
    static void (*_Set_logic)(ELEMENT, PIN, LOGIC, double) = NULL;
    static void (*_Set_voltage)(ELEMENT, PIN, double) = NULL;
@@ -338,6 +408,7 @@ namespace PRIVATE {
 
    static int _Create_calls = 0;
    static int _Instance_index = 0;
+   static struct Tag_Variables *_Instance = NULL; // Used by VAR() and REG()
    static int _N_instances = 0;
    static ELEMENT _Element = NULL;
    static double _Power = 0.0;
@@ -346,8 +417,24 @@ namespace PRIVATE {
    void _Set_pin_bounds();
    void _Alloc_var();
    void _Free_var();
+   void _Bind_instance();
 }
 
+// Select the component instance accessed by VAR() and REG() for the lifetime
+// of this object, and restore the previous one on exit. Only needed in code
+// not called from VMLAB through SetInstance(), like a window procedure.
+class INSTANCE_SCOPE
+{
+public:
+   INSTANCE_SCOPE(int pInstance) : _Saved(PRIVATE::_Instance_index)
+      { Select(pInstance); }
+   ~INSTANCE_SCOPE() { Select(_Saved); }
+private:
+   static void Select(int pInstance)
+      { PRIVATE::_Instance_index = pInstance; PRIVATE::_Bind_instance(); }
+   int _Saved;
+};
+
 // Exported functions
 //
 #define DLL_EXPORT extern "C" __declspec(dllexport)
@@ -623,6 +710,7 @@ void SetInstance(ELEMENT pElement, int pInstance)
 {
 	PRIVATE::_Element = pElement;
 	PRIVATE::_Instance_index = pInstance;
+	PRIVATE::_Bind_instance();
 }
 
 void StartSimulation(double pPower, double pTemp)
@@ -772,6 +860,68 @@ public:
       }
    }
 
+   template<UINT MSB, UINT LSB>
+   int field() const
+   //*****************************************
+   // Same as get_field(MSB, LSB) but with the bit positions as template
+   // arguments, so the mask is a compile time constant.
+   {
+      const TYPE mask = ((1 << (MSB - LSB + 1)) - 1) << LSB;
+
+      if(mask != (x() & mask)) {
+         return -1;
+      }
+      return (d() & mask) >> LSB;
+   }
+
+   template<UINT MSB, UINT LSB>
+   void field(int pValue)
+   //*****************************************
+   // Same as set_field(MSB, LSB, pValue) with a compile time mask
+   {
+      const TYPE mask = ((1 << (MSB - LSB + 1)) - 1) << LSB;
+
+      d(d() & ~mask);
+      if(pValue < 0) {
+         x(x() & ~mask);
+      } else {
+         x(x() | mask);
+         d(d() | ((pValue << LSB) & mask));
+      }
+   }
+
+   template<UINT N>
+   LOGIC bit() const
+   //******************************
+   // Same as get_bit(N) with a compile time mask
+   {
+      const TYPE mask = 1 << N;
+
+      if(x() & mask) {
+         return (d() & mask) ? 1 : 0;
+      } else {
+         return UNKNOWN;
+      }
+   }
+
+   template<UINT N>
+   void bit(LOGIC pValue)
+   //*******************************************
+   // Same as set_bit(N, pValue) with a compile time mask
+   {
+      const TYPE mask = 1 << N;
+
+      if(pValue == 0) {
+         x(x() | mask);
+         d(d() & ~mask);
+      } else if(pValue == 1) {
+         x(x() | mask);
+         d(d() | mask);
+      } else if(pValue == UNKNOWN) {
+         x(x() & ~mask);
+      }
+   }
+
    const WORD32 operator & (const WORD32 &p) const
    //*************************************
    {
@@ -956,6 +1106,9 @@ inline BOOL operator == (UINT pL, const WORD32 &pR) { return pR == pL; }
 inline BOOL operator != (UINT pL, const WORD32 &pR) { return pR != pL; }
 #endif // if not _WORD8_LINKED
 
+// Bulk fill, copy, compare, and pack/unpack of WORD8 arrays
+#include "word8ops.h"
+
 #endif // #ifdef(RC_INVOKED)
 
 // MANDATORY identifier values for Windows controls in the resource file
@@ -26,6 +26,7 @@
 #define IS_PERIPHERAL       // To distinguish from a normal user component
 #include "blackbox.h"
 #include "useravr.h"
+#include "trace.h"
 #include "comp.h"
 
 int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
@@ -35,7 +36,7 @@ int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
 #define VREF_VOLTAGE 1.1
 
 // Comparator mode as a combination of ACISx bits
-// NOTE: WORD8::get_field() returns -1 for unknown bits
+// NOTE: WORD8::field<>() returns -1 for unknown bits
 enum { MODE_UNKNOWN = -1, MODE_TOGGLE, MODE_RESERVED, MODE_FALL, MODE_RISE };
 const char *Mode_text[] = {
    "?", "Toggle", "Reserved", "Falling Edge", "Rising Edge",
@@ -83,9 +84,12 @@ DECLARE_VAR
    bool Log;              // True if the "Log" checkbox button is checked
    bool Dirty;            // True if "Mode" or voltage labels need update
    bool Sleep;            // True if disabled by SLEEP mode deeper than IDLE
+
+   REGISTER_NAMES<_nOfRegisters> Reg_names; // Cached names for reg()
 END_VAR
 
 bool Started;             // True if simulation started and interface functions work
+Tracefile Trace;          // Binary trace file shared by all instances
 
 USE_WINDOW(WINDOW_USER_1); // Window to display registers, etc. See .RC file
 
@@ -102,20 +106,27 @@ void Log(const char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
 // This function also automatically prepends the instance name to the formatted
-// message. The message is only printed if logging is enabled in GUI.
+// message. The message is only printed if logging is enabled in GUI. If a
+// trace file is open then only the format and arguments are added to the
+// trace file, and trcdump.exe formats the message. pFormat must be a string
+// literal.
 {
    if(VAR(Log)) {   
-      char strBuffer[MAXBUF];
       va_list argList;
+      va_start(argList, pFormat);
 
-      snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
-      int len = strlen(strBuffer);
+      // The trace file records the instance so it's not part of the message
+      if(Trace.active()) {
+         TRACE_LOG(Trace, pFormat, argList);
+      } else {
+         char strBuffer[MAXBUF];
+         snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
+         int len = strlen(strBuffer);
+         vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
+         PRINT(strBuffer);
+      }
 
-      va_start(argList, pFormat);
-      vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
       va_end(argList);
-
-      PRINT(strBuffer);
    }
 }
 
@@ -127,20 +138,23 @@ void Log_register_write(int pId, WORD8 pData, unsigned char pMask)
 // unknown bits in the pMask position then issue a warning. In either case
 // Log() a message indicating the register is being written with pData. The
 // pId is used to look up the true register name (as given in the .ini file)
-// for the warning and log messages.
+// for the warning and log messages. If a trace file is open, known writes
+// are recorded in binary form together with the old register value.
 {
    if((pData.x() & pMask) != pMask) {      
       char strBuffer[64];
-      char *strName = reg(pId);      
+      const char *strName = VAR(Reg_names)[pId];      
       
       snprintf(strBuffer, 64, "Unknown bits (X) written into %s register",
          strName);
          
       WARNING(strBuffer, CAT_MEMORY, WARN_MEMORY_WRITE_X_IO);
       Log("Write register %s: $??", strName);      
+   } else if(VAR(Log) && Trace.active()) {
+      TRACE_WRITE(Trace, pId, REG(pId), pData, pMask);
    } else {
-      if(VAR(Log)) { // Don't waste time in reg() if not logging
-         char *strName = reg(pId);
+      if(VAR(Log)) { // Don't waste time if not logging
+         const char *strName = VAR(Reg_names)[pId];
          Log("Write register %s: $%02X", strName, pData.d() & pMask);
       }
    }
@@ -160,7 +174,7 @@ void Interrupt()
    SET_INTERRUPT_ENABLE(ACI, REG(ACSR)[3] == 1);   
    
    SET_INTERRUPT_FLAG(ACI, FLAG_SET);
-   REG(ACSR).set_bit(4, 1);
+   REG(ACSR).bit<4>(1);
 }
 
 void Disable_digital(PORT pPort, bool state)
@@ -220,13 +234,16 @@ void On_simulation_begin()                //     "        "
 //**********************
 // Called at the beginning of simulation. All initialization happens inside
 // On_reset() which is always called immediately after On_simulation_begin().
-{   
+{
+   TRACE_BEGIN(Trace, VAR(Reg_names));
 }
 
 void On_simulation_end()
 //**********************
 // If the simulation is ending, set all registers and text fieds to unknown.
 {
+   TRACE_END(Trace);
+
    // Set reigster to unknown and ensure that mode/labels update accordingly
    REG(ACSR) = WORD8(0, 0);
    REG(DIDR) = WORD8(0, 0);
@@ -248,7 +265,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
 
          // Bits 0,1 - ACISx: Analog Comparator Interrupt Mode Select
          // ----------------------------------------
-         int newMode = pData.get_field(1, 0);
+         int newMode = pData.field<1, 0>();
 
          // ACIS=01 is a reserved mode
          if(newMode == MODE_RESERVED) {
@@ -257,7 +274,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          }
          
          // Log changes to the ACIS field
-         if(newMode != REG(ACSR).get_field(1, 0)) {
+         if(newMode != REG(ACSR).field<1, 0>()) {
             Log("Updating mode: %s", Mode_text[newMode + 1]);
          }
          
@@ -273,15 +290,15 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          // ACSR to pData).
          if(pData[4] == 1) {
             SET_INTERRUPT_FLAG(ACI, FLAG_CLEAR);
-            pData.set_bit(4, 0);
+            pData.bit<4>(0);
          } else {
-            pData.set_bit(4, REG(ACSR)[4]);
+            pData.bit<4>(REG(ACSR)[4]);
          }
          
          // Bit 5 - ACO: Analog Comparator Output
          // ----------------------------------------
          // Copy read only ACO bit from ACSR to pData to preserve value
-         pData.set_bit(5, REG(ACSR)[5]);
+         pData.bit<5>(REG(ACSR)[5]);
  
          // Bit 6 - ACBG: Analog Comparator Bandgap Select
          // ----------------------------------------
@@ -366,7 +383,7 @@ void On_time_step(double pTime)
       Measure();
       newOutput = VAR(Positive) > VAR(Negative);
    }
-   REG(ACSR).set_bit(5, newOutput);
+   REG(ACSR).bit<5>(newOutput);
       
    // Check if the logic output of comparator has changed on this time step.
    // Generate interrupt if ACIE=1. If ACIE=0 then no interrupt is generated
@@ -374,7 +391,7 @@ void On_time_step(double pTime)
    // remain pending. The ACIS mode bits determine the edge condition that
    // causes an interrupt to occur.
    if(newOutput != oldOutput) {
-      switch(REG(ACSR).get_field(1, 0)) {
+      switch(REG(ACSR).field<1, 0>()) {
          case MODE_RISE:
             if(newOutput) {
                Interrupt();
@@ -505,7 +522,7 @@ void On_update_tick(double pTime)
       if(VAR(Sleep) || REG(ACSR)[7] == 1) {
          SetWindowText(GET_HANDLE(GDT_MODE), "Disabled");
       } else {
-         int mode = REG(ACSR).get_field(1, 0);
+         int mode = REG(ACSR).field<1, 0>();
          SetWindowTextf(GET_HANDLE(GDT_MODE), "%s%s", Mode_text[mode + 1],
             REG(ACSR)[2] == 1 ? " / Input Capture" : "");
       }
@@ -518,7 +535,7 @@ void On_interrupt_start(INTERRUPT_ID pId)
 {
    switch(pId) {
       case ACI:
-         REG(ACSR).set_bit(4, 0);
+         REG(ACSR).bit<4>(0);
          break;
    }
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+// Packed read/write coverage bitmaps. See coverage.h for details.
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#include <windows.h>
+#include <stdio.h>
+#include <io.h>
+#include <stdlib.h>
+#include <string.h>
+#pragma hdrstop
+#include "coverage.h"
+
+
+// =============================================================================
+// Private Functions
+// =============================================================================
+
+void Coverage::put_run(FILE *pFile, UINT pLength, int pValue)
+//*************************
+// Write one run of "pLength" locations that all have the same "pValue"
+{
+   UINT code = pLength << 2 | pValue;
+
+   while(code >= 0x80) {
+      putc((code & 0x7F) | 0x80, pFile);
+      code >>= 7;
+   }
+   putc(code, pFile);
+}
+
+bool Coverage::get_run(FILE *pFile, UINT &pLength, int &pValue)
+//*************************
+// Read one run written by put_run(). Returns false on end-of-file or if the
+// run is not valid.
+{
+   UINT code = 0;
+
+   for(int shift = 0; shift < 32; shift += 7) {
+      int c = getc(pFile);
+      if(c == EOF) {
+         return false;
+      }
+      code |= (UINT) (c & 0x7F) << shift;
+      if(!(c & 0x80)) {
+         pLength = code >> 2;
+         pValue = code & 3;
+         return true;
+      }
+   }
+   return false;
+}
+
+// =============================================================================
+// Public Functions
+// =============================================================================
+
+Coverage::Coverage()
+//*************************
+// Initialize class to an empty bitmap
+{
+   Bits = NULL;
+   Size = 0;
+}
+
+Coverage::~Coverage()
+//*************************
+// Free the bitmap if destroy() was not called explicitly
+{
+   destroy();
+}
+
+bool Coverage::create(UINT pSize)
+//*************************
+// Allocate a cleared bitmap for "pSize" memory locations. Returns false if
+// out of memory.
+{
+   destroy();
+
+   Bits = (UINT *) calloc(words(pSize), sizeof(UINT));
+   if(!Bits && pSize) {
+      return false;
+   }
+   Size = pSize;
+   return true;
+}
+
+void Coverage::destroy()
+//*************************
+// Free the bitmap and return to the empty state
+{
+   free(Bits);
+   Bits = NULL;
+   Size = 0;
+}
+
+void Coverage::clear()
+//*************************
+// Mark every memory location as neither read nor written
+{
+   if(Bits) {
+      memset(Bits, 0, words(Size) * sizeof(UINT));
+   }
+}
+
+bool Coverage::merge(const Coverage &pOther)
+//*************************
+// Add all the coverage from "pOther" into this bitmap. Returns false if the
+// two bitmaps have different sizes.
+{
+   if(pOther.Size != Size) {
+      return false;
+   }
+
+   for(UINT i = 0; i < words(Size); i++) {
+      Bits[i] |= pOther.Bits[i];
+   }
+   return true;
+}
+
+void Coverage::count(UINT pCount[4]) const
+//*************************
+// Count the number of memory locations with each of the four possible
+// coverage values (0, CV_READ, CV_WRITE, and CV_READ | CV_WRITE)
+{
+   pCount[0] = pCount[1] = pCount[2] = pCount[3] = 0;
+
+   for(UINT i = 0; i < Size; i++) {
+      pCount[get(i)]++;
+   }
+}
+
+bool Coverage::load(const char *pName)
+//*************************
+// Merge the coverage saved in file "pName" into this bitmap. If the bitmap is
+// empty, it is first created with the size stored in the file. Returns false
+// if the file cannot be read, is not a coverage file, or has a different
+// size; the bitmap may be partially merged if the file is truncated.
+{
+   FILE *file = fopen(pName, "rb");
+   if(!file) {
+      return false;
+   }
+
+   char signature[sizeof(COVERAGE_SIGNATURE)];
+   UINT length = strlen(COVERAGE_SIGNATURE);
+   UINT size;
+
+   bool ok = fread(signature, 1, length, file) == length &&
+      !memcmp(signature, COVERAGE_SIGNATURE, length) &&
+      fread(&size, sizeof(size), 1, file) == 1;
+
+   if(ok && !Bits) {
+      ok = create(size);
+   }
+   if(ok && size != Size) {
+      ok = false;
+   }
+
+   for(UINT addr = 0; ok && addr < Size; addr += length) {
+      int value;
+      ok = get_run(file, length, value) && length <= Size - addr;
+      if(ok && value) {
+         for(UINT i = addr; i < addr + length; i++) {
+            mark(i, value);
+         }
+      }
+   }
+
+   fclose(file);
+   return ok;
+}
+
+bool Coverage::save(const char *pName) const
+//*************************
+// Write the bitmap into the run-length encoded file "pName". The data is
+// first written and flushed to disk in a temporary "<pName>.tmp" file which
+// then replaces "pName", so the coverage accumulated from earlier runs is
+// never lost if VMLAB crashes or is killed during the save. Returns false
+// if the file cannot be written.
+{
+   char tempName[MAX_PATH];
+   snprintf(tempName, MAX_PATH, "%s.tmp", pName);
+
+   FILE *file = fopen(tempName, "wb");
+   if(!file) {
+      return false;
+   }
+
+   fwrite(COVERAGE_SIGNATURE, 1, strlen(COVERAGE_SIGNATURE), file);
+   fwrite(&Size, sizeof(Size), 1, file);
+
+   UINT start = 0;
+   for(UINT i = 1; i <= Size; i++) {
+      if(i == Size || get(i) != get(start)) {
+         put_run(file, i - start, get(start));
+         start = i;
+      }
+   }
+
+   bool ok = fflush(file) == 0 && !ferror(file) &&
+      FlushFileBuffers((HANDLE) _get_osfhandle(fileno(file)));
+   ok = fclose(file) == 0 && ok;
+
+   ok = ok && MoveFileEx(tempName, pName,
+      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+   if(!ok) {
+      DeleteFile(tempName);
+   }
+   return ok;
+}
+
+bool Coverage::accumulate(const char *pName) const
+//*************************
+// Merge this bitmap into the coverage file "pName", which is created if it
+// does not exist yet. Called at the end of every simulation run to collect
+// the coverage from all runs. Returns false if the file cannot be updated.
+{
+   Coverage total;
+
+   if(GetFileAttributes(pName) != (DWORD) -1) {
+      if(!total.load(pName)) {
+         return false;
+      }
+   } else if(!total.create(Size)) {
+      return false;
+   }
+
+   return total.merge(*this) && total.save(pName);
+}
+
+bool Coverage::collect(const char *pName) const
+//*************************
+// Called by every component instance when the simulation ends. If the
+// VMLAB_COVERAGE environment variable is set, accumulate() this bitmap into
+// the "<pName>.cov" file in that directory. Returns false only if the
+// variable is set but the file could not be updated.
+{
+   char dir[MAX_PATH];
+   char path[MAX_PATH];
+
+   DWORD rc = GetEnvironmentVariable(COVERAGE_ENV, dir, MAX_PATH);
+   if(rc == 0 || rc >= MAX_PATH || !Bits) {
+      return true;
+   }
+   snprintf(path, MAX_PATH, "%s\\%s.cov", dir, pName);
+
+   return accumulate(path);
+}
@@ -0,0 +1,87 @@
+// Read/write coverage of a memory, packed as 2 bits per memory location. The
+// coverage can be saved to a compact run-length encoded binary file, and the
+// files from many simulation runs can be merged together either by the
+// peripherals themselves (see collect()) or with the covmerge.exe tool.
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#ifndef _COVERAGE_H
+#define _COVERAGE_H
+
+// Name of the environment variable with the directory where peripherals
+// accumulate their coverage files at the end of every simulation run (see
+// collect()). If the variable is not set, coverage is only displayed in the
+// hex editor.
+#define COVERAGE_ENV "VMLAB_COVERAGE"
+
+// Signature at the start of every coverage file. It is followed by the
+// memory size as a 32-bit little endian UINT, and then by the runs of
+// locations with identical coverage. Each run is stored as the value
+// (length << 2 | coverage) in groups of 7 bits, least significant group
+// first, with bit 7 set in every byte except the last one.
+#define COVERAGE_SIGNATURE "VMLABCOV"
+
+class Coverage
+//*********
+// Coverage bitmap with 2 bits for every memory location: bit 0 is set if the
+// location was read, and bit 1 is set if it was written. Sixteen locations
+// are packed in every 32-bit word, so merging two bitmaps is a single OR per
+// word. Instances can be added directly to the DECLARE_VAR section, since
+// the all zero state is a valid empty bitmap.
+{
+private:
+   UINT *Bits;       // Packed bitmap; location N is in Bits[N / 16]
+   UINT Size;        // Number of memory locations
+
+   static UINT words(UINT pSize) { return (pSize + 15) >> 4; }
+   static void put_run(FILE *pFile, UINT pLength, int pValue);
+   static bool get_run(FILE *pFile, UINT &pLength, int &pValue);
+
+   void mark(UINT pAddr, int pValue)
+      { Bits[pAddr >> 4] |= pValue << ((pAddr & 15) << 1); }
+
+public:
+   enum { CV_READ = 1, CV_WRITE = 2 };
+
+   Coverage();
+   ~Coverage();
+
+   bool create(UINT pSize);
+   void destroy();
+   void clear();
+   bool merge(const Coverage &pOther);
+   void count(UINT pCount[4]) const;
+
+   bool load(const char *pName);
+   bool save(const char *pName) const;
+   bool accumulate(const char *pName) const;
+   bool collect(const char *pName) const;
+
+   UINT size() const { return Size; }
+
+   // Return the CV_READ and CV_WRITE bits of memory location "pAddr"
+   int get(UINT pAddr) const
+      { return (Bits[pAddr >> 4] >> ((pAddr & 15) << 1)) & 3; }
+
+   // Record an access to memory location "pAddr". Called on every simulated
+   // memory access, so each one is only a single OR into the bitmap.
+   void read(UINT pAddr) { mark(pAddr, CV_READ); }
+   void write(UINT pAddr) { mark(pAddr, CV_WRITE); }
+};
+
+#endif // #ifndef _COVERAGE_H
@@ -0,0 +1,99 @@
+// Command line tool to merge the coverage files written by the Coverage class
+// (see coverage.h) from many simulation runs into a single file, and to print
+// a combined coverage report. The merged file can be loaded into the memory
+// viewer of the EEPROM peripherals as a coverage overlay.
+// Usage: covmerge <out.cov> <in.cov> [<in.cov> ...]
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#include <windows.h>
+#include <stdio.h>
+#pragma hdrstop
+#include "coverage.h"
+
+// Report heading for each of the four possible coverage values
+const char *Headings[4] = {
+   "Untouched", "Read only", "Written only", "Read and written"
+};
+
+void Print_ranges(const Coverage &pCover, int pValue)
+//*************************
+// Print all address ranges whose coverage is exactly pValue
+{
+   UINT size = pCover.size();
+
+   for(UINT start = 0; start < size; start++) {
+      if(pCover.get(start) != pValue) {
+         continue;
+      }
+
+      UINT end = start;
+      while(end + 1 < size && pCover.get(end + 1) == pValue) {
+         end++;
+      }
+
+      if(end == start) {
+         printf("   $%04X\n", start);
+      } else {
+         printf("   $%04X-$%04X\n", start, end);
+      }
+      start = end;
+   }
+}
+
+int main(int argc, char *argv[])
+//*************************
+{
+   if(argc < 3) {
+      fprintf(stderr, "Usage: covmerge <out.cov> <in.cov> [<in.cov> ...]\n");
+      return 1;
+   }
+
+   Coverage total;
+   for(int i = 2; i < argc; i++) {
+      if(!total.load(argv[i])) {
+         fprintf(stderr, "Cannot merge %s; not a coverage file or "
+            "memory size differs\n", argv[i]);
+         return 1;
+      }
+   }
+
+   if(!total.save(argv[1])) {
+      fprintf(stderr, "Cannot write %s\n", argv[1]);
+      return 1;
+   }
+
+   UINT count[4];
+   total.count(count);
+
+   UINT size = total.size();
+   printf("Merged %d files; memory size %u bytes\n\n", argc - 2, size);
+   for(int i = 0; i < 4; i++) {
+      printf("%-17s %8u  %5.1f%%\n", Headings[i], count[i],
+         size ? 100.0 * count[i] / size : 0.0);
+   }
+
+   for(int i = 0; i < 4; i++) {
+      if(count[i]) {
+         printf("\n%s:\n", Headings[i]);
+         Print_ranges(total, i);
+      }
+   }
+
+   return 0;
+}
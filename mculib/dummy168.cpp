@@ -57,6 +57,8 @@ END_REGISTERS
 
 DECLARE_VAR
    int Prescaler; // Current prescaler index (in case CLKPS bits have UNKNOWN value)
+   UINT Psr_cycle[2];  // CPU cycle when timer prescaler phase was last 0
+   int Psr_frozen[2];  // Timer prescaler phase while stopped by SLEEP, or -1
 END_VAR
 
 bool Started;          // True if simulation started and interface functions work
@@ -75,6 +77,15 @@ const char *PRR_Names[] = {
    "ADC", "UART", "SPI", "TIMER1", NULL, "TIMER0", "TIMER2", "TWI"
 };
 
+// Timer prescalers owned by this component. All timers sharing a prescaler
+// receive the same NTF_TSM, NTF_PSR and NTF_PHASE notifications at once, and
+// they all read the prescaler phase from Psr_cycle() below, so they never
+// drift apart. Each list of component names ends with NULL.
+const char *Psr_names[][3] = {
+   { "TIMER0", "TIMER1", NULL },   // PSRSYNC
+   { "TIMER2", NULL, NULL }        // PSRASY
+};
+
 USE_WINDOW(WINDOW_USER_1); // Window to display registers, etc. See .RC file
 
 REGISTERS_VIEW
@@ -133,6 +144,35 @@ void Change_clock(int pPrescaler)
    }
 }
 
+void Notify_timers(int pPsr, int pWhat)
+//***********************
+// Send the same notification to every timer using the pPsr prescaler
+{
+   for(int i = 0; Psr_names[pPsr][i]; i++) {
+      NOTIFY(Psr_names[pPsr][i], pWhat);
+   }
+}
+
+DLL_EXPORT UINT Psr_cycle(int pPsr)
+//***********************
+// Exported for the timer components (see PSR_CYCLE_EXPORT in useravr.h).
+// Return the CPU cycle when the phase of the pPsr prescaler was last 0. VMLAB
+// simulates a single micro, so there is only one instance of this component.
+{
+   if(PRIVATE::_Variables == NULL || pPsr < PSR_SYNC || pPsr > PSR_ASY) {
+      return 0;
+   }
+   return PRIVATE::_Variables[0].Psr_cycle[pPsr];
+}
+
+void Prescaler_reset(int pPsr)
+//***********************
+// Reset the phase of the pPsr prescaler to 0 and restart the timers using it
+{
+   VAR(Psr_cycle)[pPsr] = (UINT) GET_MICRO_INFO(INFO_CPU_CYCLES);
+   Notify_timers(pPsr, NTF_PSR);
+}
+
 void On_simulation_begin()
 //***********************
 // Handle fuse clock options. Could override the .CLOCK directive
@@ -199,9 +239,7 @@ void On_simulation_begin()
 void On_simulation_end()
 //**********************
 {
-   FOREACH_REGISTER(j){
-      REG(j) = WORD8(0,0); // Leave all bits unknown (X)
-   }
+   FILL_REGISTERS(WORD8(0,0)); // Leave all bits unknown (X)
 
    Started = false;
 }
@@ -255,7 +293,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
       //-------------------------------------------------
       // R/W bits = PUD, IVSEL,IVCE (mask = 0x13)
 
-         switch (pData.get_field(1, 0)) {     // Get IVSEL, IVCE bits group (1, 0)
+         switch (pData.field<1, 0>()) {     // Get IVSEL, IVCE bits group (1, 0)
             case 2:
                bitIVSEL = 1; // no 'break' here
             case 0:
@@ -277,8 +315,8 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
       //-----------------------------------------------------
       // R/W bits = CLKPCE and CLKPS3..0 (mask = 0x8F)
 
-         int oldPrescaler = REG(CLKPR).get_field(3, 0);
-         int newPrescaler = pData.get_field(3, 0);
+         int oldPrescaler = REG(CLKPR).field<3, 0>();
+         int newPrescaler = pData.field<3, 0>();
          
          // Can only set CLKPCE=1 if all CLKPS fields are zero. CLKPCE will be
          // auto cleared after 4 cycles but only if it wasn't already set.
@@ -317,7 +355,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          }
          
          // Fall thru case: allow only writing CLKPS=X or CLKPS=0
-         REG(CLKPR).set_bit(7, pData[7]);
+         REG(CLKPR).bit<7>(pData[7]);
          pData = REG(CLKPR);
          
       end_register
@@ -369,20 +407,18 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
             // If PSRSYNC/PSRASY set while in TSM mode, the prescaler is halted because
             // its reset signal remains continuously asserted
             if(pData[0] == 1 && REG(GTCCR)[0] == 0) { // PSRSYNC
-               NOTIFY("TIMER0", NTF_TSM);
-               NOTIFY("TIMER1", NTF_TSM);
+               Notify_timers(PSR_SYNC, NTF_TSM);
             }
             if(pData[1] == 1 && REG(GTCCR)[1] == 0) { // PSRASY
-               NOTIFY("TIMER2", NTF_TSM);
+               Notify_timers(PSR_ASY, NTF_TSM);
             }
             
             // If PSRSYNC/PSRASY manually cleared, reset/restart prescalers
             if(pData[0] == 0 && REG(GTCCR)[0] == 1) { // PSRSYNC
-               NOTIFY("TIMER0", NTF_PSR);
-               NOTIFY("TIMER1", NTF_PSR);
+               Prescaler_reset(PSR_SYNC);
             }
             if(pData[1] == 0 && REG(GTCCR)[1] == 1) { // PSRASY
-               NOTIFY("TIMER2", NTF_PSR);
+               Prescaler_reset(PSR_ASY);
             }
                      
          // If bit 7, TSM == 0, PSRSYNC/PSRASY cleared by hardware
@@ -391,11 +427,10 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
             
             // If PSRSYNC/PSRASY bits are written or already set, reset/restart prescalers
             if(pData[0] == 1 || REG(GTCCR)[0] == 1) { // PSRSYNC
-               NOTIFY("TIMER0", NTF_PSR);
-               NOTIFY("TIMER1", NTF_PSR);
+               Prescaler_reset(PSR_SYNC);
             }
             if(pData[1] == 1 || REG(GTCCR)[1] == 1) { // PSRASY
-               NOTIFY("TIMER2", NTF_PSR);
+               Prescaler_reset(PSR_ASY);
             }
          }
       end_register
@@ -410,7 +445,7 @@ void On_remind_me(double pTime, int pAux)
 {
    switch(pAux) {
       case AUTOCLEAR_SELFPRGEN:
-         REG(SPMCSR).set_bit(0, 0);  // Clear bit 0: SELFPRGEN
+         REG(SPMCSR).bit<0>(0);  // Clear bit 0: SELFPRGEN
          break;
          
       case AUTOCLEAR_CLKPCE:
@@ -418,11 +453,11 @@ void On_remind_me(double pTime, int pAux)
             WARNING("CLKPR: CLKPCE cleared by hardware; previously set 4 cycles ago",
                CAT_CPU, WARN_MISC);
          }      
-         REG(CLKPR).set_bit(7, 0);   // Clear bit 7: CLKPCE
+         REG(CLKPR).bit<7>(0);   // Clear bit 7: CLKPCE
          break;
          
       case AUTOCLEAR_IVCE:
-         REG(MCUCR).set_bit(0, 0);   // Clear bit 0: IVCE
+         REG(MCUCR).bit<0>(0);   // Clear bit 0: IVCE
          break;
    }
 }
@@ -448,7 +483,7 @@ int On_instruction(int pCode)
       //--------------
       {
          if(REG(SMCR)[0] == 1) {                        // Check Sleep Enable bit 0, SE
-            int sleepMode = REG(SMCR).get_field(3, 1);  // Extract field 3 - 1: SM2, SM1, SM0
+            int sleepMode = REG(SMCR).field<3, 1>();  // Extract field 3 - 1: SM2, SM1, SM0
             switch(sleepMode) {
                case 0:  retValue = SLEEP_IDLE; break;
                case 1:  retValue = SLEEP_NOISE_REDUCTION; break;
@@ -479,7 +514,7 @@ int On_instruction(int pCode)
             retValue = SPM_DENIED;
             break;
          }
-         int spmMode = REG(SPMCSR).get_field(2, 0);
+         int spmMode = REG(SPMCSR).field<2, 0>();
          switch(spmMode) {
             case 0x01:                       // Write temporary buffer
                retValue = SPM_WRITE_BUFFER;
@@ -526,11 +561,17 @@ void On_reset(int pCause)
    }
    switch(pCause) {
       case RESET_POWERON:  REG(MCUSR) = 1; break; // PORF bit 0, clear the rest
-      case RESET_EXTERNAL: REG(MCUSR).set_bit(1, 1); break; // EXTRF bit 1
-      case RESET_BROWNOUT: REG(MCUSR).set_bit(2, 1); break; // BORF bit 2
-      case RESET_WATCHDOG: REG(MCUSR).set_bit(3, 1); break; // WDRF bit 3
+      case RESET_EXTERNAL: REG(MCUSR).bit<1>(1); break; // EXTRF bit 1
+      case RESET_BROWNOUT: REG(MCUSR).bit<2>(1); break; // BORF bit 2
+      case RESET_WATCHDOG: REG(MCUSR).bit<3>(1); break; // WDRF bit 3
    }
    REG(OSCCAL) = 0x3A;  // Load an arbitrary calibration value. This can be improved !!!
+
+   // Timers start counting prescaler phase from cycle 0 after any reset
+   for(int i = PSR_SYNC; i <= PSR_ASY; i++) {
+      VAR(Psr_cycle)[i] = 0;
+      VAR(Psr_frozen)[i] = -1;
+   }
    
    // If fuse CKDIV8=0 then set initial prescaler factor to 8 (at index 3)
    // and call SET_CLOCK() to adjust the clock speed accordingly
@@ -547,6 +588,42 @@ void On_reset(int pCause)
 }
  
 
+void On_sleep(int pMode)
+//**********************
+// The I/O clock driving the timer prescalers stops in all SLEEP modes except
+// IDLE. The PSRASY prescaler (used by TIMER2 when not in asynchronous mode)
+// also runs in power-save mode. Remember the phase of a prescaler when it
+// stops, and restore it once it runs again. The timers are then told with
+// NTF_PHASE to read the restored phase with Psr_cycle().
+{
+   UINT cycles = (UINT) GET_MICRO_INFO(INFO_CPU_CYCLES);
+
+   for(int i = PSR_SYNC; i <= PSR_ASY; i++) {
+      bool stopped;
+      switch(pMode) {
+         case SLEEP_POWERSAVE:
+            stopped = (i == PSR_SYNC);
+            break;
+         case SLEEP_NOISE_REDUCTION:
+         case SLEEP_STANDBY:
+         case SLEEP_POWERDOWN:
+            stopped = true;
+            break;
+         default:
+            stopped = false;
+            break;
+      }
+
+      if(stopped && VAR(Psr_frozen)[i] < 0) {
+         VAR(Psr_frozen)[i] = (cycles - VAR(Psr_cycle)[i]) % PHASE_MODULO;
+      } else if(!stopped && VAR(Psr_frozen)[i] >= 0) {
+         VAR(Psr_cycle)[i] = cycles - VAR(Psr_frozen)[i];
+         Notify_timers(i, NTF_PHASE);
+         VAR(Psr_frozen)[i] = -1;
+      }
+   }
+}
+
 void On_port_edge(const char *pPortName, int pBit, EDGE pEdge, double pTime)
 //*************************************************************************
 // Handle external interrupts. Parameter pPortName contains the involved port
@@ -574,7 +651,7 @@ void On_port_edge(const char *pPortName, int pBit, EDGE pEdge, double pTime)
       case 'D':                             // Port "PD": PCINT16 to PCINT23 and INT0, INT1
       //-------                             
          if(pBit == 2) {                           //  INT0 handling, shared by PD2
-            switch(REG(EICRA).get_field(1, 0)) {   //  Check edge selection bits 1 - 0 -> ISC01, ISC00
+            switch(REG(EICRA).field<1, 0>()) {   //  Check edge selection bits 1 - 0 -> ISC01, ISC00
                case 0:   // Low level
                   if(pEdge == FALL) {
                      SET_INTERRUPT_FLAG(INT0, FLAG_LOCK);   // Lock interrupt till called again
@@ -599,7 +676,7 @@ void On_port_edge(const char *pPortName, int pBit, EDGE pEdge, double pTime)
             }
 
          } else if(pBit == 3) {                   // INT1 handling, shared by PD3
-            switch(REG(EICRA).get_field(3, 2)) {  // Check edge: bits 3 - 2, ISC11, ISC10 
+            switch(REG(EICRA).field<3, 2>()) {  // Check edge: bits 3 - 2, ISC11, ISC10 
                case 0:  // Low level
                   if(pEdge == FALL) {
                      SET_INTERRUPT_FLAG(INT1, FLAG_LOCK);   // Lock interrupt till called again
@@ -24,6 +24,13 @@
 // and Version 1 is ATtiny22 like (no ERDY interrupt). Version defaults to 0
 // if omitted from INI file; this will cause an error due to missing DISPLAY()
 // for EECR.
+//
+// The number of erase and write operations on every EEPROM byte is counted
+// and shown in the GUI as a histogram against an endurance budget, together
+// with the most worn byte. A warning is issued when any byte exceeds the
+// budget. The counters are saved to "<Name>.wear" in the project directory at
+// the end of every simulation and reloaded at the start of the next one,
+// until the "Reset wear" button is pressed.
 
 #include <windows.h>
 #include <commctrl.h>
@@ -33,8 +40,10 @@
 #define IS_PERIPHERAL       // To distinguish from a normal user component
 #include "blackbox.h"
 #include "useravr.h"
+#include "trace.h"
 #include "eeprom.h"
 #include "hexfile.h"
+#include "coverage.h"
 
 // Saved HINSTANCE argument from DllEntryPoint() function. Needed to register
 // window classes and load resources from the DLL.
@@ -52,7 +61,7 @@ int WINAPI DllEntryPoint(HINSTANCE pInstance, unsigned long, void*)
 // =============================================================================
 
 // EEPROM programming mode in EEPMx bits and EEPE status bit. Note that
-// WORD8::get_field() returns -1 for unknown bits while WORD8::get_bit()
+// WORD8::field<>() returns -1 for unknown bits while WORD8::get_bit()
 // (or the [] operator) returns 2 for unknown bits.
 enum { MODE_UNKNOWN = -1, MODE_ATOMIC, MODE_ERASE, MODE_WRITE, MODE_RESERVED };
 const char *Mode_text[] = {
@@ -68,6 +77,24 @@ double Delay_time[] = { 0, 3.4e-3, 1.8e-3, 1.8e-3, 0 };
 // Action codes used with REMIND_ME() -> On_remind_me()
 enum { RMD_AUTOCLEAR_EEMPE, RMD_AUTOCLEAR_EEPE };
 
+// Number of rows in the wear histogram shown in the GUI: unused bytes, three
+// ranges of wear within the endurance budget (Light is up to 50% of the
+// budget, Heavy up to 90%, and Near limit up to 100%), and worn out bytes.
+enum { WEAR_BUCKETS = 5 };
+
+// Signature at the start of the "<Name>.wear" file which preserves the wear
+// counters across simulation runs. It is followed by the EEPROM size as a
+// UINT and by one WEAR structure for every EEPROM byte.
+#define WEAR_SIGNATURE "VMLABWER"
+
+// Number of times each EEPROM byte was erased and written. An atomic
+// erase/write operation counts as one of each. The number of erase/write
+// cycles used up by a byte is the larger of the two counts.
+struct WEAR {
+   UINT Erase;
+   UINT Write;
+};
+
 // Involved ports. Keep same order as in .INI file "Port_map = ..." who
 // does the actual assignment to micro ports PD0, etc. This allows multiple instances
 // to be mapped into different port sets
@@ -99,6 +126,14 @@ END_INTERRUPTS
 DECLARE_VAR
    int Size;            // Total EEPROM memory size from ini file
    UCHAR *Memory;       // Local copy of EEPROM data
+   Coverage Cover;      // Packed 2-bit per byte R/W coverage bitmap
+   UCHAR *Flags;        // Watchpoint bitflags for each EEPROM byte
+   WEAR *Wear;          // Erase/write counters for each EEPROM byte
+
+   UINT Endurance;      // Erase/write cycle budget from GUI; 0 if none
+   UINT Wear_limit[WEAR_BUCKETS - 2]; // Most cycles in Light/Heavy/Near limit
+   UINT Histogram[WEAR_BUCKETS]; // Number of EEPROM bytes in each row
+   int Hottest;         // Address of byte with the most erase/write cycles
 
    UCHAR EEARH_mask;    // Valid bits in EEARH (Version high byte)
    UCHAR EEARL_mask;    // Valid bits in EEARL (Version 2nd highest byte)
@@ -112,8 +147,11 @@ DECLARE_VAR
    bool Sleep;          // True if ERDY interrupt disabled by SLEEP mode
    
    Hexfile Hex;         // Helper classs for GUI View/Load/Save/Erase
+   REGISTER_NAMES<_nOfRegisters> Reg_names; // Cached names for reg()
 END_VAR
 
+Tracefile Trace;          // Binary trace file shared by all instances
+
 USE_WINDOW(WINDOW_USER_1); // Window to display registers, etc. See .RC file
 
 REGISTERS_VIEW
@@ -140,23 +178,269 @@ void Log(const char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
 // This function also automatically prepends the instance name to the formatted
-// message. The message is only printed if logging is enabled in GUI.
+// message. The message is only printed if logging is enabled in GUI. If a
+// trace file is open then only the format and arguments are added to the
+// trace file, and trcdump.exe formats the message. pFormat must be a string
+// literal.
 {
    if(VAR(Log)) {   
-      char strBuffer[MAXBUF];
       va_list argList;
+      va_start(argList, pFormat);
 
-      snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
-      int len = strlen(strBuffer);
+      // The trace file records the instance so it's not part of the message
+      if(Trace.active()) {
+         TRACE_LOG(Trace, pFormat, argList);
+      } else {
+         char strBuffer[MAXBUF];
+         snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
+         int len = strlen(strBuffer);
+         vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
+         PRINT(strBuffer);
+      }
 
-      va_start(argList, pFormat);
-      vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
       va_end(argList);
+   }
+}
+
+void Watch(int pAddr, UCHAR pData, int pType)
+//*************************
+// Called on an EEPROM access whose flag byte has the "pType" watchpoint bit
+// set. The flag test is done by the caller so EEPROM accesses without any
+// watchpoint stay fast. Breakpoint the simulation if the complete watchpoint
+// condition (e.g. a value match) is satisfied.
+{
+   const char *message = VAR(Hex).watch(pAddr, pData, pType);
+   if(message) {
+      BREAK(message);
+   }
+}
+
+UINT Cycles(const WEAR &pWear)
+//*************************
+// Return the number of erase/write cycles used up by one EEPROM byte
+{
+   return pWear.Erase > pWear.Write ? pWear.Erase : pWear.Write;
+}
+
+int Wear_bucket(UINT pCycles)
+//*************************
+// Return the wear histogram row for an EEPROM byte with "pCycles" erase/write
+// cycles. Only compares against the limits computed by Wear_rebuild().
+{
+   if(pCycles == 0) {
+      return 0;
+   }
+   
+   int bucket = 1;
+   while(bucket < WEAR_BUCKETS - 1 && pCycles > VAR(Wear_limit)[bucket - 1]) {
+      bucket++;
+   }
+   return bucket;
+}
+
+void Wear_rebuild()
+//*************************
+// Recompute the histogram row limits from the endurance budget, and then
+// recompute the entire histogram and the hottest byte from the counters.
+// Only called when the budget or all of the counters change.
+{
+   UINT budget = VAR(Endurance);
+   
+   // Without a budget every used byte is shown in the "Light" row
+   if(budget) {
+      VAR(Wear_limit)[0] = budget / 2;
+      VAR(Wear_limit)[1] = (UINT) (budget * 0.9);
+      VAR(Wear_limit)[2] = budget;
+   } else {
+      VAR(Wear_limit)[0] = VAR(Wear_limit)[1] = VAR(Wear_limit)[2] = ~0U;
+   }
+
+   memset(VAR(Histogram), 0, sizeof(VAR(Histogram)));
+   VAR(Hottest) = 0;
+
+   // Counters are missing if On_create() failed before allocating them, but
+   // VMLAB still calls On_window_init() in that case
+   if(!VAR(Wear)) {
+      return;
+   }
+
+   for(int i = 0; i < VAR(Size); i++) {
+      UINT cycles = Cycles(VAR(Wear)[i]);
+      VAR(Histogram)[Wear_bucket(cycles)]++;
+      if(cycles > Cycles(VAR(Wear)[VAR(Hottest)])) {
+         VAR(Hottest) = i;
+      }
+   }
+   
+   VAR(Dirty) = true;
+}
+
+void Wear_count(int pAddr, bool pErase, bool pWrite)
+//*************************
+// Called from Write_EEPROM() every time the EEPROM byte at "pAddr" is erased
+// and/or written. Updates the counters, histogram, and hottest byte in
+// constant time, and issues a warning when the byte exceeds the budget.
+{
+   if(!VAR(Wear)) {
+      return;
+   }
+
+   WEAR &wear = VAR(Wear)[pAddr];
+   UINT before = Cycles(wear);
+   
+   wear.Erase += pErase;
+   wear.Write += pWrite;
+   
+   UINT cycles = Cycles(wear);
+   if(cycles == before) {
+      return;
+   }
+
+   int from = Wear_bucket(before);
+   int to = Wear_bucket(cycles);
+   if(from != to) {
+      VAR(Histogram)[from]--;
+      VAR(Histogram)[to]++;
+   }
+   
+   if(cycles > Cycles(VAR(Wear)[VAR(Hottest)])) {
+      VAR(Hottest) = pAddr;
+   }
+
+   // Warn only once when the byte first goes over the budget
+   if(VAR(Endurance) && cycles == VAR(Endurance) + 1) {
+      char strBuffer[MAXBUF];
+      snprintf(strBuffer, MAXBUF, "EEPROM[$%04X] exceeded endurance budget "
+         "of %u erase/write cycles", pAddr, VAR(Endurance));
+      WARNING(strBuffer, CAT_EEPROM, WARN_MISC);
+   }
+}
+
+void Wear_endurance()
+//*************************
+// Read the endurance budget from the GUI edit box and rebuild the histogram.
+// A blank or zero budget disables the warnings.
+{
+   char buf[16];
+   GetWindowText(GET_HANDLE(GDT_ENDURANCE), buf, 16);
+   
+   VAR(Endurance) = 0;
+   sscanf(buf, " %u", &VAR(Endurance));
+   Wear_rebuild();
+}
+
+void Wear_load()
+//*************************
+// Load the wear counters from "<Name>.wear" if the file exists and matches
+// the EEPROM size. Otherwise the current counters are kept as they are.
+{
+   if(!VAR(Wear)) {
+      return;
+   }
+
+   char strBuffer[MAXBUF];
+   snprintf(strBuffer, MAXBUF, "%s.wear", GET_INSTANCE());
+   
+   FILE *file = fopen(strBuffer, "rb");
+   if(!file) {
+      return;
+   }
+
+   char signature[sizeof(WEAR_SIGNATURE)];
+   UINT length = strlen(WEAR_SIGNATURE);
+   UINT size;
+   
+   if(fread(signature, 1, length, file) == length &&
+      !memcmp(signature, WEAR_SIGNATURE, length) &&
+      fread(&size, sizeof(size), 1, file) == 1 && size == (UINT) VAR(Size)) {
+      if(fread(VAR(Wear), sizeof(WEAR), size, file) != size) {
+         memset(VAR(Wear), 0, VAR(Size) * sizeof(WEAR));
+      }
+   } else {
+      Log("Ignoring %s; not a wear file or EEPROM size differs", strBuffer);
+   }
+
+   fclose(file);
+   Wear_rebuild();
+}
 
+void Wear_save()
+//*************************
+// Save the wear counters to "<Name>.wear" so they accumulate across runs. The
+// file is replaced through a temporary file, so the counters from earlier runs
+// are not lost if VMLAB crashes or is killed during the save. Replace_file()
+// shows its own error message if the file cannot be written.
+{
+   if(!VAR(Wear)) {
+      return;
+   }
+
+   char strBuffer[MAXBUF];
+   snprintf(strBuffer, MAXBUF, "%s.wear", GET_INSTANCE());
+
+   UINT size = VAR(Size);
+   UINT length = strlen(WEAR_SIGNATURE);
+   UINT total = length + sizeof(size) + size * sizeof(WEAR);
+
+   char *data = (char *) malloc(total);
+   if(!data) {
+      snprintf(strBuffer, MAXBUF, "%s: Could not write %s.wear; not enough "
+         "memory", GET_INSTANCE(), GET_INSTANCE());
       PRINT(strBuffer);
+      return;
+   }
+
+   memcpy(data, WEAR_SIGNATURE, length);
+   memcpy(data + length, &size, sizeof(size));
+   memcpy(data + length + sizeof(size), VAR(Wear), size * sizeof(WEAR));
+
+   Replace_file(strBuffer, data, total);
+   free(data);
+}
+
+void Wear_display()
+//*************************
+// Update the wear histogram and hottest byte in the GUI. Called from
+// On_update_tick() whenever the GUI is refreshed.
+{
+   if(!VAR(Wear)) {
+      return;
+   }
+
+   for(int i = 0; i < WEAR_BUCKETS; i++) {
+      SendMessage(GET_HANDLE(GDT_HISTOGRAM + i), PBM_SETPOS,
+         VAR(Histogram)[i], 0);
+   }
+
+   const WEAR &wear = VAR(Wear)[VAR(Hottest)];
+   if(Cycles(wear)) {
+      char strBuffer[MAXBUF];
+      snprintf(strBuffer, MAXBUF, "$%04X: %u erase, %u write",
+         VAR(Hottest), wear.Erase, wear.Write);
+      SetWindowText(GET_HANDLE(GDT_HOTTEST), strBuffer);
+   } else {
+      SetWindowText(GET_HANDLE(GDT_HOTTEST), "None");
    }
 }
 
+void Wear_reset()
+//*************************
+// Called to handle "Reset wear" button in the GUI. Clears all counters and
+// deletes the "<Name>.wear" file so the next run starts with a new EEPROM.
+{
+   if(!VAR(Wear)) {
+      return;
+   }
+
+   char strBuffer[MAXBUF];
+   snprintf(strBuffer, MAXBUF, "%s.wear", GET_INSTANCE());
+   DeleteFile(strBuffer);
+
+   memset(VAR(Wear), 0, VAR(Size) * sizeof(WEAR));
+   Wear_rebuild();
+   Wear_display();
+}
+
 void Log_register_write(int pId, WORD8 pData, unsigned char pMask)
 //*************************
 // Called from every 'case XXX:' statement when handling On_register_write().
@@ -165,25 +449,43 @@ void Log_register_write(int pId, WORD8 pData, unsigned char pMask)
 // unknown bits in the pMask position then issue a warning. In either case
 // Log() a message indicating the register is being written with pData. The
 // pId is used to look up the true register name (as given in the .ini file)
-// for the warning and log messages.
+// for the warning and log messages. If a trace file is open, known writes
+// are recorded in binary form together with the old register value.
 {
    if((pData.x() & pMask) != pMask) {      
       char strBuffer[64];
-      char *strName = reg(pId);      
+      const char *strName = VAR(Reg_names)[pId];      
       
       snprintf(strBuffer, 64, "Unknown bits (X) written into %s register",
          strName);
          
       WARNING(strBuffer, CAT_MEMORY, WARN_MEMORY_WRITE_X_IO);
       Log("Write register %s: $??", strName);      
+   } else if(VAR(Log) && Trace.active()) {
+      TRACE_WRITE(Trace, pId, REG(pId), pData, pMask);
    } else {
-      if(VAR(Log)) { // Don't waste time in reg() if not logging
-         char *strName = reg(pId);
+      if(VAR(Log)) { // Don't waste time if not logging
+         const char *strName = VAR(Reg_names)[pId];
          Log("Write register %s: $%02X", strName, pData.d() & pMask);
       }
    }
 }
 
+WORD8 *Eeprom_data()
+//******************
+// Return VMLAB's copy of the EEPROM contents if GET_MICRO_DATA() keeps it in a
+// single contiguous array, so it can be handled with the WORD8 bulk operations.
+// Otherwise return NULL and the contents must be accessed one byte at a time.
+{
+   WORD8 *first = GET_MICRO_DATA(DATA_EEPROM, 0);
+   WORD8 *last = GET_MICRO_DATA(DATA_EEPROM, VAR(Size) - 1);
+
+   if(first && last == first + VAR(Size) - 1) {
+      return first;
+   }
+   return NULL;
+}
+
 int Decode_address()
 //*************************
 // Decode and return the EEPROM memory address stored in EEAR registers. If
@@ -220,7 +522,7 @@ void Write_EEPROM()
    if(addr != -1) {
       
       // Perform different action depending on EEPM mode bits
-      switch(REG(EECR).get_field(5,4)) {
+      switch(REG(EECR).field<5, 4>()) {
 
          case MODE_UNKNOWN:
             WARNING("Unknown EEPM value in EECR; EEPROM write ignored",
@@ -235,13 +537,25 @@ void Write_EEPROM()
          case MODE_ATOMIC:
             Log("Write EEPROM[$%04X]=$%02X", addr, data);
             VAR(Memory)[addr] = data;
+            VAR(Cover).write(addr);
+            VAR(Hex).touch(addr);
             VAR(Dirty) = true;
+            Wear_count(addr, true, true);
+            if(VAR(Flags)[addr] & Hexfile::FL_BREAK_WRITE) {
+               Watch(addr, data, Hexfile::FL_BREAK_WRITE);
+            }
             break;
          
          case MODE_ERASE:
             Log("Erase EEPROM[$%04X]", addr);
             VAR(Memory)[addr] = 0xFF;
+            VAR(Cover).write(addr);
+            VAR(Hex).touch(addr);
             VAR(Dirty) = true;
+            Wear_count(addr, true, false);
+            if(VAR(Flags)[addr] & Hexfile::FL_BREAK_WRITE) {
+               Watch(addr, 0xFF, Hexfile::FL_BREAK_WRITE);
+            }
             break;
                   
          case MODE_WRITE:
@@ -257,7 +571,13 @@ void Write_EEPROM()
             data &= VAR(Memory)[addr];
             Log("Write EEPROM[$%04X]=$%02X", addr, data);
             VAR(Memory)[addr] = data;            
+            VAR(Cover).write(addr);
+            VAR(Hex).touch(addr);
             VAR(Dirty) = true;
+            Wear_count(addr, false, true);
+            if(VAR(Flags)[addr] & Hexfile::FL_BREAK_WRITE) {
+               Watch(addr, data, Hexfile::FL_BREAK_WRITE);
+            }
             break;         
       }
       
@@ -266,11 +586,11 @@ void Write_EEPROM()
       // REMIND_ME() to set EEPE=0 when the programming is finished. 
       if(VAR(Simtime)) {
 
-         // The +1 is needed in case get_field() returns -1 becaue unknown (X)
+         // The +1 is needed in case field<>() returns -1 becaue unknown (X)
          // bits are present. Unknown/reserved modes have a zero delay.
-         double delay = Delay_time[REG(EECR).get_field(5,4) + 1];
+         double delay = Delay_time[REG(EECR).field<5, 4>() + 1];
          if(delay > 0) {
-            REG(EECR).set_bit(1, 1);
+            REG(EECR).bit<1>(1);
             REMIND_ME(delay, RMD_AUTOCLEAR_EEPE);
          }
       }
@@ -303,6 +623,24 @@ const char *On_create()
    // simulation is started and actual data from .eep file is loaded.
    memset(VAR(Memory), 0xFF, VAR(Size));
 
+   // Track read/write coverage per each EEPROM memory byte, which starts as
+   // neither read nor written.
+   if(!VAR(Cover).create(VAR(Size))) {
+      return "Could not allocate memory";
+   }
+
+   // Watchpoint bitflags start out with no watchpoints set
+   VAR(Flags) = (UCHAR *) calloc(VAR(Size), 1);
+   if(VAR(Flags) == NULL) {
+      return "Could not allocate memory";
+   }
+
+   // Wear counters start at zero until loaded by On_simulation_begin()
+   VAR(Wear) = (WEAR *) calloc(VAR(Size), sizeof(WEAR));
+   if(VAR(Wear) == NULL) {
+      return "Could not allocate memory";
+   }
+
    // Initialize bitmasks for valid register bits based on EEPROM size. This
    // assumes the EEPROM size is a power of 2.
    UINT mask = VAR(Size) - 1;
@@ -336,6 +674,12 @@ void On_destroy()
       VAR(Hex).destroy();
       free(VAR(Memory));
    }
+   
+   // Deallocate coverage bitmap and bitflags previously allocated in
+   // On_create()
+   VAR(Cover).destroy();
+   free(VAR(Flags));
+   free(VAR(Wear));
 }
 
 void On_window_init(HWND pHandle)
@@ -353,15 +697,33 @@ void On_window_init(HWND pHandle)
    // "E^2" icon used for the main EEPROM window.
    VAR(Hex).init(DLL_instance, pHandle, " EEPROM Memory", 13005);
    VAR(Hex).data(VAR(Memory), VAR(Size));
+
+   // Register the coverage bitmap used for color highlighting in the hex
+   // editor for read/write coverage
+   VAR(Hex).coverage(&VAR(Cover));
+
+   // Register the bitflags buffer used for watchpoints set from the hex
+   // editor's pop-up menu
+   VAR(Hex).flags(VAR(Flags), VAR(Size));
    
    // Hex editor remains read-only until simulation is started
    VAR(Hex).readonly(true);
+
+   // Each row of the wear histogram can hold every EEPROM byte. Reading the
+   // initial endurance budget from the GUI also computes the histogram.
+   for(int i = 0; i < WEAR_BUCKETS; i++) {
+      SendMessage(GET_HANDLE(GDT_HISTOGRAM + i), PBM_SETRANGE32, 0,
+         VAR(Size));
+   }
+   Wear_endurance();
 }
 
 void On_simulation_begin()
 //**********************
 // Called at the beginning of simulation.
 {
+   TRACE_BEGIN(Trace, VAR(Reg_names));
+
    // Ensure that EEPE=0 and no EEPROM erase/write is in progress. On_reset()
    // will initialize other bits and registers, but will preserve EEPE.
    REG(EECR) = 0;
@@ -370,15 +732,24 @@ void On_simulation_begin()
    // of the simulation. Copy this data to the local memory buffer so that it
    // can be used with an external hex editor control that expects an array
    // of bytes rather than an array of WORD8.
-   for(int i = 0; i < VAR(Size); i++) {
-      WORD8 *data = GET_MICRO_DATA(DATA_EEPROM, i);
-      if(data == NULL) {
-         BREAK("Internal error; GET_MICRO_DATA(DATA_EEPROM) returned NULL");
+   WORD8 *eeprom = Eeprom_data();
+   if(eeprom) {
+      WORD8_PACK(VAR(Memory), NULL, eeprom, VAR(Size));
+   } else {
+      for(int i = 0; i < VAR(Size); i++) {
+         WORD8 *data = GET_MICRO_DATA(DATA_EEPROM, i);
+         if(data == NULL) {
+            BREAK("Internal error; GET_MICRO_DATA(DATA_EEPROM) returned NULL");
+         }
+         VAR(Memory)[i] = data->d();
       }
-      VAR(Memory)[i] = data->d();
    }
    
+   // Wear counters from earlier runs are kept alongside the EEPROM image
+   Wear_load();
+
    // Force the GUI to display new EEPROM contents and mode bits
+   VAR(Hex).touch(0, VAR(Size));
    VAR(Dirty) = true;
 
    // The hex editor can now be used to make changes to EEPROM data and the
@@ -393,27 +764,48 @@ void On_simulation_end()
 //**********************
 // If the simulation is ending, set all registers to unknown.
 {
-   FOREACH_REGISTER(i){
-      REG(i) = WORD8(0,0);
-   }
+   TRACE_END(Trace);
+
+   FILL_REGISTERS(WORD8(0,0));
 
    // If "Persistent" is checked, then copy the local memory buffer back to
    // VMLAB so that any modifications can be automatically saved back to the
    // project's .eep file.
    if(VAR(Persistent)) {
-      for(int i = 0; i < VAR(Size); i++) {
-         WORD8 *data = GET_MICRO_DATA(DATA_EEPROM, i);
-         if(data == NULL) {
-            BREAK("Internal error; GET_MICRO_DATA(DATA_EEPROM) returned NULL");
+      WORD8 *eeprom = Eeprom_data();
+      if(eeprom) {
+         WORD8_UNPACK(eeprom, VAR(Memory), NULL, VAR(Size));
+      } else {
+         for(int i = 0; i < VAR(Size); i++) {
+            WORD8 *data = GET_MICRO_DATA(DATA_EEPROM, i);
+            if(data == NULL) {
+               BREAK("Internal error; "
+                  "GET_MICRO_DATA(DATA_EEPROM) returned NULL");
+            }
+            *data = VAR(Memory)[i];
          }
-         *data = VAR(Memory)[i];
       }
    }
    
    // Initialize memory back to $FF just as it was before simulation start
    memset(VAR(Memory), 0xFF, VAR(Size));
 
+   // If the VMLAB_COVERAGE environment variable is set, merge the coverage
+   // from this run into "<Name>.cov" so it accumulates over many runs. The
+   // coverage is then cleared so the next run starts from scratch.
+   if(!VAR(Cover).collect(GET_INSTANCE())) {
+      char strBuffer[MAXBUF];
+      snprintf(strBuffer, MAXBUF, "%s: Could not update %s.cov in "
+         COVERAGE_ENV " directory", GET_INSTANCE(), GET_INSTANCE());
+      PRINT(strBuffer);
+   }
+   VAR(Cover).clear();
+
+   // Save wear counters so they accumulate over many simulation runs
+   Wear_save();
+
    // Force hex editor to show erased $FF EEPROM contents and mode to show "?"
+   VAR(Hex).touch(0, VAR(Size));
    VAR(Dirty) = true;
 
    // The hex editor is read only since On_simulation_begin() will reload data
@@ -477,8 +869,8 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
 
          // Bits 5,4 - EEPMx: EEPROM Programming Mode Bits
          //---------------------------------------------------------
-         int newMode = pData.get_field(5,4);
-         if(newMode != REG(EECR).get_field(5,4)) {
+         int newMode = pData.field<5, 4>();
+         if(newMode != REG(EECR).field<5, 4>()) {
 
             // Mode change only allowed if EEPROM programming not already in
             // progress (i.e. EEPE must be 0).
@@ -492,8 +884,8 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
                }               
                
                // Assign individual bits to preserve positions of unknowns (X)
-               REG(EECR).set_bit(4, pData[4]);
-               REG(EECR).set_bit(5, pData[5]);               
+               REG(EECR).bit<4>(pData[4]);
+               REG(EECR).bit<5>(pData[5]);               
                
                // Refresh Mode display in GUI
                Log("Update mode: %s", Mode_text[newMode + 1]);
@@ -503,7 +895,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
 
          // Bit 3 - EERIE: EEPROM Ready Interrupt Enable
          //---------------------------------------------------------
-         REG(EECR).set_bit(3, pData[3]);
+         REG(EECR).bit<3>(pData[3]);
          SET_INTERRUPT_ENABLE(ERDY, pData[3] == 1);
 
          // Bit 1 - EEPE: EEPROM Write/Erase Enable
@@ -539,7 +931,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          // cannot occur for some other reason; writing EEMPE=0 is always
          // allowed
          if(pData[1] == 1 || pData[2] == 0) {
-            REG(EECR).set_bit(2, 0);
+            REG(EECR).bit<2>(0);
          }
          
          // Writing EEMPE=1/X is only allowed if EEPROM not busy (EEPE=0)
@@ -551,7 +943,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
                WARNING("Cannot set EEMPE=1 while EEPROM busy (EEPE=1)",
                   CAT_EEPROM, WARN_PARAM_BUSY);
             } else {
-               REG(EECR).set_bit(2, pData[2]);
+               REG(EECR).bit<2>(pData[2]);
                REMIND_ME2(4, RMD_AUTOCLEAR_EEMPE);
             }
          }
@@ -577,6 +969,12 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
                   // VMLAB API.
                   UCHAR data = VAR(Memory)[addr];
                   REG(EEDR) = data;
+                  VAR(Cover).read(addr);
+                  VAR(Hex).touch(addr);
+                  VAR(Dirty) = true;
+                  if(VAR(Flags)[addr] & Hexfile::FL_BREAK_READ) {
+                     Watch(addr, data, Hexfile::FL_BREAK_READ);
+                  }
                   Log("Read EEPROM[$%04X]=$%02X", addr, data);
                }
             }
@@ -613,9 +1011,7 @@ void On_reset(int pCause)
    // bit is set (EEPROM write/erase still in progress) then preserve the
    // contents of the EEPE, EEPM1, and EEPM0 bits across reset.
    WORD8 eecr = REG(EECR);
-   FOREACH_REGISTER(i){
-      REG(i) = 0;
-   }
+   FILL_REGISTERS(0);
    if(eecr[1] == 1) {
       REG(EECR) = eecr & 0x32;
    }
@@ -647,7 +1043,7 @@ void On_remind_me(double pTime, int pAux)
          if(!VAR(Sleep)) {
             SET_INTERRUPT_FLAG(ERDY, FLAG_LOCK);
          }
-         REG(EECR).set_bit(1, 0);
+         REG(EECR).bit<1>(0);
          VAR(Dirty) = true;
          break;
       
@@ -663,7 +1059,7 @@ void On_remind_me(double pTime, int pAux)
             WARNING("EEMPE cleared by hardware; previously set 4 cycles ago",
                CAT_EEPROM, WARN_MISC);
          }
-         REG(EECR).set_bit(2, 0);
+         REG(EECR).bit<2>(0);
          break;
    }
 }
@@ -709,9 +1105,9 @@ void On_update_tick(double pTime)
 // made since the last On_update_tick()
 {
    if(VAR(Dirty)) {
-      // Note that get_field() will return -1 if the mode bits are UNKNOWN,
+      // Note that field<>() will return -1 if the mode bits are UNKNOWN,
       // hence the +1 here to get the correct array index.
-      int mode = REG(EECR).get_field(5,4); // EEPMx (mode bits)
+      int mode = REG(EECR).field<5, 4>(); // EEPMx (mode bits)
       SetWindowText(GET_HANDLE(GDT_MODE), Mode_text[mode + 1]);
 
       // If the EEPE bit is set, then the EEPROM is simulating write/erase
@@ -725,6 +1121,7 @@ void On_update_tick(double pTime)
 
       // Refresh hex editor contents in case AVR has updated EEPROM memory
       VAR(Hex).refresh();
+      Wear_display();
 
       VAR(Dirty) = false;
    }
@@ -734,6 +1131,14 @@ void On_gadget_notify(GADGET pGadget, int pCode)
 //*********************************************
 // Response to Win32 notification coming from buttons, etc.
 {
+   // Modified text in "Endurance" edit control
+   if(pGadget == GDT_ENDURANCE) {
+      if(pCode == EN_CHANGE) {
+         Wear_endurance();
+      }
+      return;
+   }
+
    if(pCode != BN_CLICKED) {
       return;
    }
@@ -746,5 +1151,6 @@ void On_gadget_notify(GADGET pGadget, int pCode)
       case GDT_LOAD:       VAR(Hex).load(); break;
       case GDT_SAVE:       VAR(Hex).save(); break;
       case GDT_ERASE:      VAR(Hex).erase(); break;
+      case GDT_WEAR_RESET: Wear_reset(); break;
    }
 }
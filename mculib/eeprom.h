@@ -30,4 +30,8 @@
 #define GDT_SIMTIME    GADGET10
 #define GDT_PERSISTENT GADGET11
 #define GDT_MODE       GADGET12
-#define GDT_STATUS     GADGET13
\ No newline at end of file
+#define GDT_STATUS     GADGET13
+#define GDT_ENDURANCE  GADGET14
+#define GDT_WEAR_RESET GADGET15
+#define GDT_HOTTEST    GADGET16
+#define GDT_HISTOGRAM  GADGET17  // Through GADGET21; one per WEAR_BUCKETS
\ No newline at end of file
@@ -33,8 +33,11 @@
 #include <windows.h>
 #include <commctrl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 #pragma hdrstop
 #include "hexfile.h"
+#include "coverage.h"
 
 // =============================================================================
 // Global Constants and Macros
@@ -43,9 +46,16 @@
 // Return the smaller of two values
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the larger of two values
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
 // Size of temporary string buffer for generating filenames and error messages
 #define MAXBUF 256
 
+// Smallest buffer allocated by the Output class. Saving an untouched memory
+// estimates a size of zero, and realloc() of zero bytes may return NULL.
+#define OUTPUT_MIN 4096
+
 // Window class name used internally for the MDI child window which contains
 // the SHINEINHEX child window class
 #define CLASS_NAME "VMLAB Hexfile Editor"
@@ -79,13 +89,52 @@
 #define CONFIRM_ERASE \
    "Are you sure you want to erase entire EEPROM memory to $FF?"
 
-// Added to hex editor's context menu when a bitflag buffer is in use
+// Added to hex editor's context menu when a coverage bitmap is in use
 #define CLEAR_COVERAGE "Clear R/W coverage"
+#define LOAD_COVERAGE "Load merged R/W coverage..."
+
+// Filter string used with the "Load merged R/W coverage" dialog box
+#define COVERAGE_FILTER "Coverage File (*.cov)\0*.cov\0"
+
+// Error displayed if a coverage file doesn't match the memory being viewed
+#define ERROR_COVERAGE \
+   "Not a coverage file or the memory size does not match."
+
+// Added to hex editor's context menu when a bitflag buffer is in use
+#define WATCH_READ "Break on read of selection"
+#define WATCH_WRITE "Break on write to selection"
+#define WATCH_VALUE "Break on write of value to selection..."
+#define UNWATCH "Remove watchpoints in selection"
+#define UNWATCH_ALL "Remove all watchpoints"
 
 // Background colors used for tracking read/write coverage in hex editor
 const COLORREF COLOR_R  = RGB(255, 255, 0);   // Yellow
 const COLORREF COLOR_W  = RGB(0, 255, 255);   // Cyan
 const COLORREF COLOR_RW = RGB(127, 255, 127); // Light green
+
+// Text color used for bytes covered by a read or write watchpoint
+const COLORREF COLOR_BREAK = RGB(255, 0, 0);  // Red
+
+// Lookup table used by the Scanner class to decode ASCII hex digits. Every
+// character that is not a valid hex digit maps to -1.
+const signed char HEX_DIGITS[256] = {
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+   -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
    
 // Initial size of MDI child window (not client area)
 enum { INIT_WIDTH = 629, INIT_HEIGHT = 305 };
@@ -119,6 +168,8 @@ enum {
    HEXM_SETREADONLY      = WM_USER+121,
    HEXM_INVALIDATE       = WM_USER+122,
    HEXM_GETMENU          = WM_USER+123,
+   HEXM_GETSEL           = WM_USER+124,
+   HEXM_INVALIDATERANGE  = WM_USER+126,
 };
 
 // Notification codes (NMHDR.code) used with WM_NOTIFY message sent to parent
@@ -131,6 +182,18 @@ enum {
 enum {
    IDM_CLEAR_RW     = 20000,
    IDM_CLEAR_RW_SEP = 20001,
+   IDM_LOAD_RW      = 20002,
+   IDM_WATCH_SEP    = 20003,
+   IDM_WATCH_READ   = 20004,
+   IDM_WATCH_WRITE  = 20005,
+   IDM_WATCH_VALUE  = 20006,
+   IDM_UNWATCH      = 20007,
+   IDM_UNWATCH_ALL  = 20008,
+};
+
+// Control ID of the edit box in the dialog box created by Input_value()
+enum {
+   IDC_VALUE        = 100,
 };
 
 // Structure used with the HEXN_SHOWMENU notification
@@ -164,6 +227,10 @@ HWND MDI_client = NULL;      // MDI client window inside VMLAB window
 ATOM MDI_class = NULL;       // Window class of MDI_child window
 int Ref_count = 0;           // Reference count for library/class unloading
 
+// Global variables shared by all Pagemem objects; initialized by first create()
+Pagemem *Pagemem_list = NULL; // All Pagemem objects with reserved memory
+PVOID Fault_handler = NULL;   // Vectored exception handler or NULL
+
 // =============================================================================
 // Error Handling and Reporting Functions
 // =============================================================================
@@ -275,6 +342,116 @@ void Hide(HWND pWindow)
    W32_ASSERT( DrawMenuBar(VMLAB_window) );   
 }
 
+BOOL CALLBACK Value_proc(HWND pDialog, UINT pMessage, WPARAM pW, LPARAM pL)
+//******************************
+// Dialog procedure for the dialog box created by Input_value(). The "OK"
+// button only closes the dialog if the edit box holds a valid hex byte value,
+// which is then stored into the int pointed to by the dialog's parameter.
+{
+   switch(pMessage) {
+      case WM_INITDIALOG:
+         SetWindowLong(pDialog, DWL_USER, pL);
+         SendDlgItemMessage(pDialog, IDC_VALUE, EM_LIMITTEXT, 3, 0);
+         return TRUE;
+
+      case WM_COMMAND:
+         if(LOWORD(pW) == IDOK) {
+            char text[8];
+            GetDlgItemText(pDialog, IDC_VALUE, text, sizeof(text));
+
+            // Accept an optional "$" prefix as used by the hex editor
+            char *start = (text[0] == '$') ? text + 1 : text;
+            char *end;
+            ULONG value = strtoul(start, &end, 16);
+            if(end == start || *end || value > 0xFF) {
+               MessageBeep(MB_ICONWARNING);
+               return TRUE;
+            }
+
+            *(int *) GetWindowLong(pDialog, DWL_USER) = value;
+            EndDialog(pDialog, IDOK);
+         } else if(LOWORD(pW) == IDCANCEL) {
+            EndDialog(pDialog, IDCANCEL);
+         }
+         return TRUE;
+   }
+   return FALSE;
+}
+
+WORD *Dialog_text(WORD *pBuffer, const char *pText)
+//******************************
+// Append "pText" as a Unicode string to the in-memory dialog template being
+// built by Input_value(). Returns pointer to the WORD following the string.
+{
+   return pBuffer + MultiByteToWideChar(CP_ACP, 0, pText, -1,
+      (LPWSTR) pBuffer, MAXBUF);
+}
+
+WORD *Dialog_item(WORD *pBuffer, DWORD pStyle, short pX, short pY,
+   short pWidth, short pHeight, WORD pId, WORD pClass, const char *pText)
+//******************************
+// Append one control with the predefined window class atom "pClass" to the
+// in-memory dialog template being built by Input_value(). Each control must
+// start on a DWORD boundary. Returns pointer to the WORD following the item.
+{
+   pBuffer = (WORD *) (((ULONG) pBuffer + 3) & ~3);
+
+   DLGITEMTEMPLATE *item = (DLGITEMTEMPLATE *) pBuffer;
+   item->style = pStyle | WS_CHILD | WS_VISIBLE;
+   item->dwExtendedStyle = 0;
+   item->x = pX;
+   item->y = pY;
+   item->cx = pWidth;
+   item->cy = pHeight;
+   item->id = pId;
+
+   pBuffer = (WORD *) (item + 1);
+   *pBuffer++ = 0xFFFF;         // Predefined class atom follows
+   *pBuffer++ = pClass;
+   pBuffer = Dialog_text(pBuffer, pText);
+   *pBuffer++ = 0;              // No creation data
+   return pBuffer;
+}
+
+bool Input_value(HINSTANCE pInstance, const char *pTitle, int &pValue)
+//******************************
+// Display a small modal dialog box asking the user for a hex byte value. The
+// hex editor has no resource file of its own (it's shared by several DLLs),
+// so the dialog template is built in memory. Returns true and sets "pValue"
+// if the user clicked "OK" with a valid value.
+{
+   DWORD buffer[MAXBUF];        // DWORD aligned storage for dialog template
+   
+   DLGTEMPLATE *dlg = (DLGTEMPLATE *) buffer;
+   dlg->style = DS_MODALFRAME | DS_CENTER | DS_SETFONT | WS_POPUP |
+      WS_CAPTION | WS_SYSMENU;
+   dlg->dwExtendedStyle = 0;
+   dlg->cdit = 4;               // Number of controls added below
+   dlg->x = 0;
+   dlg->y = 0;
+   dlg->cx = 160;
+   dlg->cy = 52;
+
+   WORD *next = (WORD *) (dlg + 1);
+   *next++ = 0;                 // No menu
+   *next++ = 0;                 // Default dialog window class
+   next = Dialog_text(next, pTitle);
+   *next++ = 8;                 // Font point size for DS_SETFONT
+   next = Dialog_text(next, "MS Sans Serif");
+
+   next = Dialog_item(next, SS_LEFT, 7, 9, 90, 8, 0xFFFF, 0x0082,
+      "Byte value (hex):");
+   next = Dialog_item(next, ES_UPPERCASE | WS_BORDER | WS_TABSTOP,
+      100, 7, 53, 12, IDC_VALUE, 0x0081, "");
+   next = Dialog_item(next, BS_DEFPUSHBUTTON | WS_TABSTOP, 49, 31, 50, 14,
+      IDOK, 0x0080, "OK");
+   next = Dialog_item(next, BS_PUSHBUTTON | WS_TABSTOP, 103, 31, 50, 14,
+      IDCANCEL, 0x0080, "Cancel");
+
+   return DialogBoxIndirectParam(pInstance, dlg, VMLAB_window,
+      (DLGPROC) Value_proc, (LPARAM) &pValue) == IDOK;
+}
+
 LRESULT CALLBACK Hexfile::MDI_proc(HWND pWindow, UINT pMessage, WPARAM pW, LPARAM pL)
 //******************************
 // Custom window procedure for the MDI child window. Because MDI child
@@ -353,10 +530,32 @@ LRESULT CALLBACK Hexfile::MDI_proc(HWND pWindow, UINT pMessage, WPARAM pW, LPARA
       case WM_COMMAND:
       {
          switch(pW) {
-            // Clear R/W coverage in bitflag buffer registered with flags()
+            // Clear R/W coverage in bitmap registered with coverage()
             case IDM_CLEAR_RW:
                hexfile->On_clear_rw();
                break;
+
+            // Load merged R/W coverage file as an overlay
+            case IDM_LOAD_RW:
+               hexfile->On_load_coverage();
+               break;
+
+            // Add or remove watchpoints in bitflag buffer set with flags()
+            case IDM_WATCH_READ:
+               hexfile->On_watch(FL_BREAK_READ, false);
+               break;
+            case IDM_WATCH_WRITE:
+               hexfile->On_watch(FL_BREAK_WRITE, false);
+               break;
+            case IDM_WATCH_VALUE:
+               hexfile->On_watch(FL_BREAK_WRITE, true);
+               break;
+            case IDM_UNWATCH:
+               hexfile->On_unwatch(false);
+               break;
+            case IDM_UNWATCH_ALL:
+               hexfile->On_unwatch(true);
+               break;
          }
          break;
       }
@@ -392,16 +591,16 @@ LRESULT CALLBACK Hexfile::MDI_proc(HWND pWindow, UINT pMessage, WPARAM pW, LPARA
 
 class File
 //*********
-// Wrapper class around the stdio fopen(), fprintf(), fwrite(), etc. series of
-// functions. All member functions take care of performing runtime checking for
-// any possible I/O errors. If an error occurs, call File_Error() to notify the
-// user and the File::Error exception is thrown. Using exceptions for error
-// handling makes the mainline code simpler since it doesn't have to check
-// the return code of each operation to determine success or failure. However,
-// no exception is thrown when closing the file, because it's not safe to
-// do so from the destructor. Based on the pEofWanted constructor argument,
-// input routines like scanf() and read() will either return FALSE or throw
-// an exception.
+// Wrapper class around the stdio fopen(), fread(), etc. series of
+// functions. Used only for reading; see Output for writing files. All member
+// functions take care of performing runtime checking for any possible I/O
+// errors. If an error occurs, call File_Error() to notify the user and the
+// File::Error exception is thrown. Using exceptions for error handling makes
+// the mainline code simpler since it doesn't have to check the return code of
+// each operation to determine success or failure. However, no exception is
+// thrown when closing the file, because it's not safe to do so from the
+// destructor. Based on the pEofWanted constructor argument, input routines
+// like read() will either return FALSE or throw an exception.
 // TODO: The C++ iofstream could be used in place of this custom File class
 // since it too can throw exceptions on I/O, parse, and EOF errors.
 {
@@ -412,16 +611,16 @@ class File
 
       void error(const char *pError, bool pThrow = true, UINT pType = MB_ICONSTOP);
       
+      friend class Scanner; // Scanner reports parse errors through error()
+
    public:
       class Error {};    // Thrown if any I/O errors occur in File class
 
       File(const char *pName, const char *pMode, bool pEofWanted = false);      
       ~File();
       
-      void printf(const char *pFormat, ...);
-      bool scanf(int pExpectedCount, const char *pFormat, ...);
+      long size();
       bool read(char *pData, int pLength);
-      void write(const char *pData, int pLength);
 };
 
 void File::error(const char *pError, bool pThrow, UINT pType)
@@ -445,8 +644,8 @@ File::File(const char *pName, const char *pMode, bool pEofWanted) :
    File(NULL), Name(pName), EOF_Wanted(pEofWanted)
 //********************************
 // Constructor to open "pName" file using "pMode" for access. If
-// the "pEofWanted" argument is true, then the scanf() and read()
-// functions return false when an EOF is reached instead of throwing
+// the "pEofWanted" argument is true, then the read()
+// function returns false when an EOF is reached instead of throwing
 // an exception.
 {
    File = ::fopen(pName, pMode);
@@ -467,17 +666,31 @@ File::~File()
    }
 }
 
-bool File::scanf(int pExpectedCount, const char *pFormat, ...)
+long File::size()
 //********************
-// Wrapper around the fvscanf() function
+// Return the total size of the file in bytes and rewind to the beginning
 {
-   va_list argList;
-
-   va_start(argList, pFormat);
-   int actualCount = vfscanf(File, pFormat, argList);
-   va_end(argList);
+   long length = -1;
+   
+   if(fseek(File, 0, SEEK_END) == 0) {
+      length = ftell(File);
+      rewind(File);
+   }
    
-   if(actualCount != pExpectedCount) {
+   if(length < 0) {
+      error("Cannot read from file");
+   }
+   
+   return length;
+}
+
+bool File::read(char *pData, int pLength)
+//********************
+// Wrapper around the fread() function
+{
+   int actualCount = fread(pData, 1, pLength, File);
+
+   if(actualCount != pLength) {
       if(ferror(File)) {
          error("Cannot read from file");
       } else if(feof(File)) {
@@ -487,103 +700,384 @@ bool File::scanf(int pExpectedCount, const char *pFormat, ...)
             error("Unexpected end-of-file", true, MB_ICONWARNING);
          }
       } else {
-         error("Unrecognized data in file; unknown file type");
+         error("Internal error; unknown fread() error");
       }            
    }
    
    return true;
 }
 
-void File::printf(const char *pFormat, ...)
+class Scanner
+//*********
+// Parser for the text based memory image files (Intel HEX, Motorola S-Record
+// and Atmel Generic). The entire file is read into memory with one fread()
+// call and hex fields are then decoded with the HEX_DIGITS lookup table,
+// which is much faster than calling fscanf() for every byte in the file.
+// Any parse errors are reported through File::error() which throws the
+// File::Error exception. Like fscanf(), whitespace (including the "\r\n"
+// line endings) is skipped in front of every field.
+{
+   private:
+      File &Source;      // File used for reading and for error reporting
+      char *Buffer;      // Entire file contents allocated by constructor
+      const UCHAR *Next; // Next unparsed character in Buffer
+      const UCHAR *End;  // One past the last character in Buffer
+
+      void fail();
+      
+   public:
+      Scanner(File &pFile);
+      ~Scanner();
+
+      bool more();
+      void expect(char pChar);
+      
+      int hex(int pDigits)
+      //********************
+      // Skip whitespace and decode a "pDigits" long hex number. Inlined since
+      // this is called for every byte of data in the file.
+      {
+         while(Next < End && isspace(*Next)) {
+            Next++;
+         }
+         if(End - Next < pDigits) {
+            Next = End;
+            fail();
+         }
+         
+         UINT value = 0;
+         for(int i = 0; i < pDigits; i++) {
+            int digit = HEX_DIGITS[*Next++];
+            if(digit < 0) {
+               fail();
+            }
+            value = (value << 4) | digit;
+         }
+         
+         return value;
+      }
+};
+
+Scanner::Scanner(File &pFile) : Source(pFile), Buffer(NULL)
+//********************************
+// Read the entire contents of "pFile" into a newly allocated buffer
+{
+   long length = Source.size();
+   
+   Buffer = (char *) malloc(length + 1);
+   if(!Buffer) {
+      Source.error("Not enough memory to read file");
+   }
+   
+   // The File is opened without pEofWanted, so read() throws if the file is
+   // shorter than reported by size() and "length" is always the amount read.
+   // Records cut short by the real end of the file are reported by fail().
+   Source.read(Buffer, length);
+   
+   Next = (const UCHAR *) Buffer;
+   End = Next + length;
+}
+
+Scanner::~Scanner()
+//********************************
+// Destructor frees the file buffer, even if parsing stopped due to an error
+{
+   free(Buffer);
+}
+
+void Scanner::fail()
 //********************
-// Wrapper around the vfprintf() function
+// Report a parse error at the current position. Since this is not an I/O
+// error, errno is cleared so File::error() doesn't append a system message.
 {
-   va_list argList;
+   errno = 0;
+   if(Next >= End) {
+      Source.error("Unexpected end-of-file", true, MB_ICONWARNING);
+   } else {
+      Source.error("Unrecognized data in file; unknown file type");
+   }
+}
 
-   va_start(argList, pFormat);
-   vfprintf(File, pFormat, argList);
-   va_end(argList);
+bool Scanner::more()
+//********************
+// Skip whitespace and return true if there is any data left in the file
+{
+   while(Next < End && isspace(*Next)) {
+      Next++;
+   }
+   
+   return Next < End;
+}
 
-   if(ferror(File)) {
-      error("Cannot write to file");
+void Scanner::expect(char pChar)
+//********************
+// Skip whitespace and then consume the "pChar" character which must be next
+{
+   if(!more() || *Next != (UCHAR) pChar) {
+      fail();
    }
+   Next++;
 }
 
-bool File::read(char *pData, int pLength)
+void Write_error(const char *pName, const char *pError, DWORD pCode)
 //********************
-// Wrapper around the fread() function
+// Display a write error including the Win32 error code from GetLastError()
+// and throw the File::Error exception to abort the save.
 {
-   int actualCount = fread(pData, 1, pLength, File);
+   File_Error(pName, MB_ICONSTOP, "%s: Win32 error %lu", pError, pCode);
+   throw File::Error();
+}
 
-   if(actualCount != pLength) {
-      if(ferror(File)) {
-         error("Cannot read from file");
-      } else if(feof(File)) {
-         if(EOF_Wanted) {
-            return false;
-         } else {
-            error("Unexpected end-of-file", true, MB_ICONWARNING);
-         }
-      } else {
-         error("Internal error; unknown fread() error");
-      }            
+void Write_file(const char *pName, const char *pData, UINT pLength,
+   bool pAtomic)
+//********************
+// Create (or overwrite) file "pName" and write all "pLength" bytes from
+// "pData" into it with a single WriteFile() call. If "pAtomic" is true, the
+// data is first written and flushed to disk in a temporary "<pName>.tmp"
+// file which then replaces "pName". An existing file is therefore never
+// left partially written if VMLAB crashes or is killed during the save.
+{
+   char tempName[MAX_PATH];
+   const char *path = pName;
+   
+   if(pAtomic) {
+      snprintf(tempName, MAX_PATH, "%s.tmp", pName);
+      path = tempName;
+   }
+
+   HANDLE file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+      FILE_ATTRIBUTE_NORMAL, NULL);
+   if(file == INVALID_HANDLE_VALUE) {
+      Write_error(path, "Cannot open file", GetLastError());
+   }
+   
+   DWORD written;
+   bool ok = WriteFile(file, pData, pLength, &written, NULL) &&
+      written == pLength;
+   if(ok && pAtomic) {
+      ok = FlushFileBuffers(file);
+   }
+   
+   // Save the error code from WriteFile() before CloseHandle() and
+   // DeleteFile() can overwrite it
+   DWORD errorValue = GetLastError();
+   ok = CloseHandle(file) && ok;
+   
+   if(!ok) {
+      if(pAtomic) {
+         DeleteFile(path);
+      }
+      Write_error(path, "Cannot write to file", errorValue);
    }
    
+   if(pAtomic && !MoveFileEx(path, pName,
+      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+      errorValue = GetLastError();
+      DeleteFile(path);
+      Write_error(pName, "Cannot replace file", errorValue);
+   }
+}
+
+bool Replace_file(const char *pName, const char *pData, UINT pLength)
+//********************
+// Atomic Write_file() for callers outside this file that do not use the
+// File::Error exception. Returns false if the file could not be written.
+{
+   try {
+      Write_file(pName, pData, pLength, true);
+   }
+   catch (File::Error) {
+      return false;
+   }
    return true;
 }
 
-void File::write(const char *pData, int pLength)
+class Output
+//*********
+// Memory buffer used to format an entire text based memory image file
+// before it is written out with a single Write_file() call. Hex numbers are
+// encoded directly instead of calling fprintf() for every byte. The buffer
+// is allocated once based on the caller's size estimate, and it only grows
+// if the estimate was too small. Lines are terminated with the "\r\n" used
+// by Windows, the same as the stdio library would write in text mode.
+{
+   private:
+      char *Data;        // Formatted file contents
+      UINT Length;       // Number of bytes used in Data
+      UINT Capacity;     // Total size of Data in bytes
+
+      void grow(UINT pNeeded);
+      
+   public:
+      Output(UINT pCapacity);
+      ~Output();
+      
+      void text(const char *pText);
+      void bytes(const UCHAR *pData, UINT pLength);
+      void fill(UCHAR pValue, UINT pLength);
+      void save(const char *pName, bool pAtomic);
+      
+      void hex(UINT pValue, int pDigits)
+      //********************
+      // Append "pValue" as a "pDigits" long uppercase hex number. Inlined
+      // since this is called for every byte of data written to the file.
+      {
+         if(Length + pDigits > Capacity) {
+            grow(pDigits);
+         }
+         
+         for(int i = pDigits - 1; i >= 0; i--) {
+            Data[Length + i] = "0123456789ABCDEF"[pValue & 0xF];
+            pValue >>= 4;
+         }
+         Length += pDigits;
+      }
+};
+
+Output::Output(UINT pCapacity) : Data(NULL), Length(0), Capacity(0)
+//********************************
+// Allocate an initial buffer of "pCapacity" bytes
+{
+   grow(pCapacity);
+}
+
+Output::~Output()
+//********************************
+// Destructor frees the buffer, even if writing was aborted by an exception
+{
+   free(Data);
+}
+
+void Output::grow(UINT pNeeded)
+//********************
+// Enlarge the buffer so that at least "pNeeded" more bytes can be appended.
+// The capacity is doubled to keep the number of reallocations small, and it
+// is never less than OUTPUT_MIN so "pNeeded" may be zero.
+{
+   UINT capacity = MAX(Capacity * 2, OUTPUT_MIN);
+   if(capacity < Length + pNeeded) {
+      capacity = Length + pNeeded;
+   }
+   
+   char *data = (char *) realloc(Data, capacity);
+   if(!data) {
+      File_Error("", MB_ICONSTOP, "Not enough memory to write file");
+      throw File::Error();
+   }
+   
+   Data = data;
+   Capacity = capacity;
+}
+
+void Output::text(const char *pText)
 //********************
-// Wrapper around the fwrite() function
+// Append a string, translating each "\n" into the "\r\n" line ending
 {
-   fwrite(pData, 1, pLength, File);
+   for(; *pText; pText++) {
+      if(Length + 2 > Capacity) {
+         grow(2);
+      }
+      if(*pText == '\n') {
+         Data[Length++] = '\r';
+      }
+      Data[Length++] = *pText;
+   }
+}
 
-   if(ferror(File)) {
-      error("Cannot write to file");
+void Output::bytes(const UCHAR *pData, UINT pLength)
+//********************
+// Append "pLength" bytes of raw binary data
+{
+   if(Length + pLength > Capacity) {
+      grow(pLength);
    }
+   memcpy(Data + Length, pData, pLength);
+   Length += pLength;
+}
+
+void Output::fill(UCHAR pValue, UINT pLength)
+//********************
+// Append "pLength" copies of the raw binary byte "pValue"
+{
+   if(Length + pLength > Capacity) {
+      grow(pLength);
+   }
+   memset(Data + Length, pValue, pLength);
+   Length += pLength;
+}
+
+void Output::save(const char *pName, bool pAtomic)
+//********************
+// Write the entire buffer to file "pName"; see Write_file()
+{
+   Write_file(pName, Data, Length, pAtomic);
 }
 
 // =============================================================================
 // Memory image saving functions
 // =============================================================================
 
-void Write_BIN(UCHAR *pBuffer, const int pSize, const char *pName)
+void Write_BIN(const Pagemem &pMemory, const char *pName, bool pAtomic)
 //********************
 // Write full EEPROM memory contents to a raw binary file. The file will be
-// the same size as the EEPROM memory.
+// the same size as the EEPROM memory. If every page has storage, the file is
+// written directly from memory. Otherwise the pages without storage are
+// filled in with the erased value in a temporary copy.
 {
-   // Open file for writing in binary mode. The "b" specifier is needed so the
-   // stdio library does not try to translate "\n" characters written to the
-   // file into the "\r\n" line endings used by Windows.
-   File file(pName, "wb");
-   file.write(pBuffer, pSize);
+   UINT size = pMemory.size();
+
+   if(pMemory.footprint() >= size) {
+      Write_file(pName, (const char *) pMemory.data(), size, pAtomic);
+      return;
+   }
+
+   Output out(size);
+   for(UINT addr = 0; addr < size; addr += Pagemem::PAGE_SIZE) {
+      UINT length = MIN(size - addr, (UINT) Pagemem::PAGE_SIZE);
+      if(pMemory.present(addr)) {
+         out.bytes(pMemory.data() + addr, length);
+      } else {
+         out.fill(pMemory.erased(), length);
+      }
+   }
+   out.save(pName, pAtomic);
 }
 
-void Write_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
+void Write_HEX(const Pagemem &pMemory, const char *pName,
+   bool pAtomic)
 //********************
 // Write EEPROM memory contents to an Intel HEX file. Sections of memory set
 // to $FF are omitted from the file since this is the default value. EEPROMs
 // larger than 16-bits will use the "Extended Linear Address" record.
 {
+   int size = pMemory.size();
+
    // The upper 16 bits of the last EEPROM address written to file. Used to
    // detect when the "Extened Segment Address" should be written to file.
    int segment = 0;
 
-   // Open file for writing in text mode. The "t" specifier is needed for the
-   // stdio library to translate "\n" characters written to the file into the
-   // "\r\n" used by Windows.
-   File file(pName, "wt");
+   // Each 16 byte row takes 45 characters (including "\r\n") in the file.
+   // Allow for one "Extended Linear Address" record per 64KB and the final
+   // "End of File" record. Only pages with storage can contain any rows.
+   int used = MIN(pMemory.footprint(), pMemory.size());
+   Output out((used + 15) / 16 * 45 + (size / 0x10000 + 1) * 17 + 13);
 
    // Write or skip over EEPROM contents one row (16 bytes) at a time.
-   for(int addr = 0; addr < pSize; addr += 0x10) {
-      int rowAddr = (addr + 0x10 < pSize) ? (addr + 0x10) : pSize;
+   for(int addr = 0; addr < size; addr += 0x10) {
+      // Skip entire pages without storage since they contain only $FF bytes
+      if(!pMemory.present(addr) && pMemory.erased() == 0xFF) {
+         addr += Pagemem::PAGE_SIZE - 0x10;
+         continue;
+      }
+
+      int rowAddr = (addr + 0x10 < size) ? (addr + 0x10) : size;
       int count = rowAddr - addr;
       UCHAR checksum;
       int i;
    
       // If the entire row contains $FF bytes then don't write it to file
       for(i = addr; i < rowAddr; i++) {
-         if(pBuffer[i] != 0xFF) break;
+         if(pMemory.get(i) != 0xFF) break;
       }
       if(i == rowAddr) continue;
 
@@ -595,50 +1089,68 @@ void Write_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
       if(addr >> 0x10 != segment) {         
          segment = addr >> 0x10;
          checksum = -(Sum(segment) + 0x06);
-         file.printf(":02000004%04X%02X\n", segment, checksum);
+         out.text(":02000004");
+         out.hex(segment, 4);
+         out.hex(checksum, 2);
+         out.text("\n");
       }
 
       // Write beginning of "Data Record", count, and lower 16-bits of "addr"
       checksum = count + Sum(addr & 0xFFFF);
-      file.printf(":%02X%04X00", count, addr & 0xFFFF);
+      out.text(":");
+      out.hex(count, 2);
+      out.hex(addr & 0xFFFF, 4);
+      out.text("00");
       
       // Write all bytes in the row while also updating the checksum
       for(i = addr; i < rowAddr; i++) {
-         checksum += pBuffer[i];
-         file.printf("%02X", pBuffer[i]);
+         checksum += pMemory.get(i);
+         out.hex(pMemory.get(i), 2);
       }
       
       // Finish the record by printing the checksum at the end
       checksum = -checksum;
-      file.printf("%02X\n", checksum);
+      out.hex(checksum, 2);
+      out.text("\n");
    }
    
-   // Write "End of File" record
-   file.printf(":00000001FF\n");
+   // Write "End of File" record and the entire buffer to disk
+   out.text(":00000001FF\n");
+   out.save(pName, pAtomic);
 }
 
-void Write_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
+void Write_SREC(const Pagemem &pMemory, const char *pName,
+   bool pAtomic)
 //********************
 // Write EEPROM memory contents to a Motorola S-Record File. Sections of
 // memory set to $FF are omitted from the file since this is the default
 // value. EEPROMs larger than 16-bits will use the larger address "S2"
 // record type.
 {
-   // Open file for writing in text mode. The "t" specifier is needed for the
-   // stdio library to translate "\n" characters written to the file into the
-   // "\r\n" used by Windows.
-   File file(pName, "wt");
+   int size = pMemory.size();
+
+   // Each 16 byte row takes at most 46 characters (including "\r\n") in the
+   // file. Also allow for the final "End of File" record. Only pages with
+   // storage can contain any rows.
+   int used = MIN(pMemory.footprint(), pMemory.size());
+   Output out((used + 15) / 16 * 46 + 12);
 
    // Write or skip over EEPROM contents one row (16 bytes) at a time.
-   for(int addr = 0; addr < pSize; addr += 0x10) {
-      int rowAddr = (addr + 0x10 < pSize) ? (addr + 0x10) : pSize;
+   for(int addr = 0; addr < size; addr += 0x10) {
+      // Skip entire pages without storage since they contain only $FF bytes
+      if(!pMemory.present(addr) && pMemory.erased() == 0xFF) {
+         addr += Pagemem::PAGE_SIZE - 0x10;
+         continue;
+      }
+
+      int rowAddr = (addr + 0x10 < size) ? (addr + 0x10) : size;
       int count = rowAddr - addr;
       UCHAR checksum;
       int i;
    
       // If the entire row contains $FF bytes then don't write it to file
       for(i = addr; i < rowAddr; i++) {
-         if(pBuffer[i] != 0xFF) break;
+         if(pMemory.get(i) != 0xFF) break;
       }
       if(i == rowAddr) continue;
 
@@ -646,50 +1158,64 @@ void Write_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
       // or "S2" record type.
       if(addr <= 0xFFFF) {
          checksum = (count + 3) + Sum(addr);
-         file.printf("S1%02X%04X", count + 3, addr);
+         out.text("S1");
+         out.hex(count + 3, 2);
+         out.hex(addr, 4);
       } else {
          checksum = (count + 4) + Sum(addr);
-         file.printf("S2%02X%06X", count + 4, addr);
+         out.text("S2");
+         out.hex(count + 4, 2);
+         out.hex(addr, 6);
       }
       
       // Write all bytes in the row while also updating the checksum
       for(i = addr; i < rowAddr; i++) {
-         checksum += pBuffer[i];
-         file.printf("%02X", pBuffer[i]);
+         checksum += pMemory.get(i);
+         out.hex(pMemory.get(i), 2);
       }
       
       // Finish the record by printing the checksum at the end
       checksum = ~checksum;
-      file.printf("%02X\n", checksum);
+      out.hex(checksum, 2);
+      out.text("\n");
    }
       
-   // Write "End of File" record
-   file.printf("S9030000FC\n");   
+   // Write "End of File" record and the entire buffer to disk
+   out.text("S9030000FC\n");
+   out.save(pName, pAtomic);
 }
 
-void Write_GEN(UCHAR *pBuffer, const int pSize, const char *pName)
+void Write_GEN(const Pagemem &pMemory, const char *pName,
+   bool pAtomic)
 //********************
 // Write EEPROM memory contents to an Atmel Generic file in 16/8 format. Only
 // the first 65536 bytes of EEPROM memory can be saved when using this format.
 {
+   int size = pMemory.size();
    int addr;
 
-   // Open file for writing in text mode. The "t" specifier is needed for the
-   // stdio library to translate "\n" characters written to the file into the
-   // "\r\n" used by Windows.
-   File file(pName, "wt");
-
-   // Use 16/8 format for smaller EEPROMs; only write non-$FF bytes
-   int maxSize = MIN(pSize, 0x10000);
+   // Use 16/8 format for smaller EEPROMs; only write non-$FF bytes. Each
+   // byte takes 9 characters (including "\r\n") in the file. Entire pages
+   // without storage contain only $FF bytes and are skipped.
+   int maxSize = MIN(size, 0x10000);
+   Output out(MIN(pMemory.footprint(), (UINT) maxSize) * 9);
    for(addr = 0; addr < maxSize; addr++) {
-      if(pBuffer[addr] != 0xFF) {
-         file.printf("%04X:%02X\n", addr, pBuffer[addr]);
+      if(!pMemory.present(addr) && pMemory.erased() == 0xFF) {
+         addr += Pagemem::PAGE_SIZE - 1;
+      } else if(pMemory.get(addr) != 0xFF) {
+         out.hex(addr, 4);
+         out.text(":");
+         out.hex(pMemory.get(addr), 2);
+         out.text("\n");
       }
    }
+   out.save(pName, pAtomic);
 
    // Check for non $FF data at higher addresses and issue warning
-   for(; addr < pSize; addr++) {
-      if(pBuffer[addr] != 0xFF) {
+   for(addr = maxSize; addr < size; addr++) {
+      if(!pMemory.present(addr) && pMemory.erased() == 0xFF) {
+         addr += Pagemem::PAGE_SIZE - 1;
+      } else if(pMemory.get(addr) != 0xFF) {
          File_Error(pName, MB_ICONWARNING, FILEWARN_GENERICBIG);
          break;
       }
@@ -700,7 +1226,7 @@ void Write_GEN(UCHAR *pBuffer, const int pSize, const char *pName)
 // Memory image loading functions
 // =============================================================================
 
-void Read_BIN(UCHAR *pBuffer, const int pSize, const char *pName)
+void Read_BIN(Pagemem &pMemory, const char *pName)
 //********************
 // Read full EEPROM memory contents from a raw binary file. A warning if shown
 // if the file is larger than the EEPROM memory size, and the additional data
@@ -714,18 +1240,35 @@ void Read_BIN(UCHAR *pBuffer, const int pSize, const char *pName)
    // exception.
    File file(pName, "rb", true);
 
-   // Read up to the smaller size of available memory or file size
-   file.read(pBuffer, pSize);
+   // Read up to the smaller size of available memory or file size, one page
+   // at a time. The memory was already erased by the caller, so pages which
+   // only contain the erased value are not copied and need no storage.
+   UINT size = pMemory.size();
+   char page[Pagemem::PAGE_SIZE];
+   bool more = true;
+   
+   for(UINT addr = 0; more && addr < size; addr += Pagemem::PAGE_SIZE) {
+      UINT length = MIN(size - addr, (UINT) Pagemem::PAGE_SIZE);
+      memset(page, pMemory.erased(), length);
+      more = file.read(page, length);
+      
+      for(UINT i = 0; i < length; i++) {
+         if((UCHAR) page[i] != pMemory.erased()) {
+            memcpy(&pMemory[addr], page, length);
+            break;
+         }
+      }
+   }
    
    // Try readning one more byte to check if file is larger than memory. If
    // read succeesds than issue a warning because additional data is ignored.
    char dummy;
-   if(file.read(&dummy, 1)) {
+   if(more && file.read(&dummy, 1)) {
       File_Error(pName, MB_ICONWARNING, FILEERROR_TOOBIG);
    }   
 }
 
-void Read_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
+void Read_HEX(Pagemem &pMemory, const char *pName)
 //********************
 // Read EEPROM memory contents from an Intel HEX file.
 {
@@ -735,33 +1278,36 @@ void Read_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
 
    // The upper 16 bits of the last EEPROM address written to file. Updated
    // by "02" and "04" record types.
-   int segment = 0;
+   UINT segment = 0;
    
    // According the official Intel HEX file standard, the memory address is
    // supposed to wrap around within a 64KB block when reading data. If
    // an Extended Linear Address Record is read, then the address will no
    // longer wrap; reading an Extended Segment Address Record will re-enable
    // the wrapping.
-   int mask = 0xFFFF;
+   UINT mask = 0xFFFF;
    
-   // Open file for reading in text mode. The "t" specifier is needed for the
-   // stdio library to translate the "\r\n" line edings used by Windows into the
-   // "\n" specified by the C standard.
-   File file(pName, "rt");
+   // Open file for reading in binary mode and read the entire file into
+   // memory. The Scanner treats the "\r\n" line endings used by Windows as
+   // whitespace, so text mode translation by the stdio library is not needed.
+   File file(pName, "rb");
+   Scanner scan(file);
 
    // Keep reading records until "End of File" record terminates the loop
    while(!done) {
       int count, addr, type;  // Fixed size field in all records
-      char data[256];         // Variable size data field in some records
+      UCHAR data[256];        // Variable size data field in some records
       UCHAR checksum;         // Checksum computed on the fly
       
       // Read entire record into memory, including variable sized data, and
       // also compute a checksum on the fly which will be checked later
-      file.scanf(3, " :%2X%4X%2X", &count, &addr, &type);
+      scan.expect(':');
+      count = scan.hex(2);
+      addr = scan.hex(4);
+      type = scan.hex(2);
       checksum = count + Sum(addr) + type;
       for(int i = 0; i < count; i++) {
-         int temp;
-         file.scanf(1, "%2X", &temp);
+         int temp = scan.hex(2);
          data[i] = temp;
          checksum += temp;
       }
@@ -770,12 +1316,14 @@ void Read_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
       switch(type) {
       
          // Data record; copy data into EEPROM memory. Ignore data at higher
-         // addresses than supported by EEPROM.
+         // addresses than supported by EEPROM. The address is unsigned so
+         // linear addresses at $80000000 and above are out of range, and
+         // fullAddr < segment means the address wrapped past 4GB.
          case 00:
             for(int i = 0; i < count; i++, addr++) {
-               int fullAddr = segment + (addr & mask);
-               if(fullAddr < pSize) {
-                  pBuffer[fullAddr] = data[i];
+               UINT fullAddr = segment + (addr & mask);
+               if(fullAddr >= segment && fullAddr < pMemory.size()) {
+                  pMemory[fullAddr] = data[i];
                } else {
                   warnAddress = true;
                }
@@ -807,8 +1355,7 @@ void Read_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
       }
       
       // Read checksum from file and compare with locally computed checksum
-      UCHAR fileChecksum;
-      file.scanf(1, "%2X", &fileChecksum);
+      UCHAR fileChecksum = scan.hex(2);
       checksum = -checksum;
       if(fileChecksum != checksum) {
          warnChecksum = true;
@@ -824,7 +1371,7 @@ void Read_HEX(UCHAR *pBuffer, const int pSize, const char *pName)
    }
 }
 
-void Read_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
+void Read_SREC(Pagemem &pMemory, const char *pName)
 //********************
 // Read EEPROM memory contents from an Intel HEX file.
 {
@@ -832,10 +1379,11 @@ void Read_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
    bool warnChecksum = false; // File contains checksum mismatches?
    bool done = false;         // True when "End of File" record read
 
-   // Open file for reading in text mode. The "t" specifier is needed for the
-   // stdio library to translate the "\r\n" line edings used by Windows into the
-   // "\n" specified by the C standard.
-   File file(pName, "rt");
+   // Open file for reading in binary mode and read the entire file into
+   // memory. The Scanner treats the "\r\n" line endings used by Windows as
+   // whitespace, so text mode translation by the stdio library is not needed.
+   File file(pName, "rb");
+   Scanner scan(file);
 
    // Keep reading records until "End of File" record terminates the loop
    while(!done) {
@@ -844,23 +1392,24 @@ void Read_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
       UCHAR checksum;  // Checksum computed on the fly
       
       // Read record type and length and compute checksum on the fly
-      file.scanf(2, " S%1X%2X", &type, &count);
+      scan.expect('S');
+      type = scan.hex(1);
+      count = scan.hex(2);
       checksum = count;
       
       // Read variable sized address field depending on data sequence record
       // type. Other record types simply ignore the address.
-      int addr = 0;
+      UINT addr = 0;
       switch(type) {
-         case 1: file.scanf(1, "%4X", &addr); count -= 2; break;
-         case 2: file.scanf(1, "%6X", &addr); count -= 3; break;
-         case 3: file.scanf(1, "%8X", &addr); count -= 4; break;
+         case 1: addr = scan.hex(4); count -= 2; break;
+         case 2: addr = scan.hex(6); count -= 3; break;
+         case 3: addr = scan.hex(8); count -= 4; break;
       }
       checksum += Sum(addr);
 
       // Read variable sized data portion, excluding checksum byte
       for(int i = 0; i < count - 1; i++) {
-         int temp;
-         file.scanf(1, "%2X", &temp);
+         int temp = scan.hex(2);
          data[i] = temp;
          checksum += temp;
       }
@@ -869,11 +1418,13 @@ void Read_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
       switch(type) {
       
          // Data record; copy data into EEPROM memory. Ignore data at higher
-         // addresses than supported by EEPROM.
+         // addresses than supported by EEPROM. The address is unsigned, so
+         // S3 addresses at $80000000 and above are out of range as well.
+         // Checking the remaining size keeps addr + i from wrapping around.
          case 1: case 2: case 3:
-            for(int i = 0; i < count - 1; i++, addr++) {
-               if(addr < pSize) {
-                  pBuffer[addr] = data[i];
+            for(int i = 0; i < count - 1; i++) {
+               if(addr < pMemory.size() && (UINT) i < pMemory.size() - addr) {
+                  pMemory[addr + i] = data[i];
                } else {
                   warnAddress = true;
                }
@@ -891,8 +1442,7 @@ void Read_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
       }
       
       // Read checksum from file and compare with locally computed checksum
-      UCHAR fileChecksum;
-      file.scanf(1, "%2X", &fileChecksum);
+      UCHAR fileChecksum = scan.hex(2);
       checksum = ~checksum;
       if(fileChecksum != checksum) {
          warnChecksum = true;
@@ -908,25 +1458,28 @@ void Read_SREC(UCHAR *pBuffer, const int pSize, const char *pName)
    }
 }
 
-void Read_GEN(UCHAR *pBuffer, const int pSize, const char *pName)
+void Read_GEN(Pagemem &pMemory, const char *pName)
 //********************
 // Read EEPROM memory contents from an Atmel Generic file in 16/8 format.
 {
    bool warnAddress = false;  // File contain addresses too big for EEPROM?
    
-   // Open file for reading in text mode. The "t" specifier is needed for the
-   // stdio library to translate the "\r\n" line edings used by Windows into the
-   // "\n" specified by the C standard. Also request that end-of-file should be
-   // returned by file.scanf() instead of throwing an exception.
-   File file(pName, "rt", true);
+   // Open file for reading in binary mode and read the entire file into
+   // memory. The Scanner treats the "\r\n" line endings used by Windows as
+   // whitespace, so text mode translation by the stdio library is not needed.
+   File file(pName, "rb");
+   Scanner scan(file);
 
    // Atmel generic has no explicit end of data marker so continue reading
    // until the end-of-file is reached. Ignore data at higher addresses than
    // supported by current EEPROM memory size.
-   int addr, data;
-   while(file.scanf(2, " %4X:%2X", &addr, &data)) {   
-      if(addr < pSize) {
-         pBuffer[addr] = data;
+   while(scan.more()) {
+      int addr = scan.hex(4);
+      scan.expect(':');
+      int data = scan.hex(2);
+      
+      if(addr < (int) pMemory.size()) {
+         pMemory[addr] = data;
       } else {
          warnAddress = true;
       }
@@ -938,6 +1491,403 @@ void Read_GEN(UCHAR *pBuffer, const int pSize, const char *pName)
    }
 }
 
+// =============================================================================
+// Pagemem class member functions
+// =============================================================================
+
+// The vectored exception handler functions are only available starting with
+// Windows XP, so they are looked up at runtime with GetProcAddress()
+typedef LONG (WINAPI *VEH_HANDLER)(EXCEPTION_POINTERS *);
+typedef PVOID (WINAPI *VEH_ADD)(ULONG, VEH_HANDLER);
+typedef ULONG (WINAPI *VEH_REMOVE)(PVOID);
+
+Pagemem::Pagemem()
+//******************************
+// Initialize class to an empty buffer
+{
+   Base = NULL;
+   Size = Count = 0;
+   Present = NULL;
+   Erased = 0;
+   Reserved = false;
+   Mapping = NULL;
+   Next = NULL;
+}
+
+Pagemem::~Pagemem()
+//******************************
+// Release the memory if destroy() was not called explicitly
+{
+   destroy();
+}
+
+void Pagemem::commit(UINT pPage)
+//******************************
+// Commit storage for one page and fill it with the erased value. Windows
+// already fills newly committed pages with zeroes.
+{
+   UCHAR *page = Base + (pPage << PAGE_BITS);
+
+   W32_ASSERT( VirtualAlloc(page, PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE) );
+   if(Erased) {
+      memset(page, Erased, PAGE_SIZE);
+   }
+   Present[pPage] = true;
+}
+
+LONG WINAPI Pagemem::Fault(EXCEPTION_POINTERS *pInfo)
+//******************************
+// Vectored exception handler called for every exception in the VMLAB process.
+// If the hex editor caused an access violation by touching a page without
+// storage, then commit the page and resume execution of the editor. All other
+// exceptions are passed on to the next handler.
+{
+   EXCEPTION_RECORD *record = pInfo->ExceptionRecord;
+
+   if(record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION ||
+      record->NumberParameters < 2) {
+      return EXCEPTION_CONTINUE_SEARCH;
+   }
+
+   UCHAR *addr = (UCHAR *) record->ExceptionInformation[1];
+   for(Pagemem *mem = Pagemem_list; mem; mem = mem->Next) {
+      if(addr >= mem->Base && addr < mem->Base + mem->Size) {
+         UINT page = (addr - mem->Base) >> PAGE_BITS;
+         if(!mem->Present[page]) {
+            mem->commit(page);
+            return EXCEPTION_CONTINUE_EXECUTION;
+         }
+      }
+   }
+   
+   return EXCEPTION_CONTINUE_SEARCH;
+}
+
+bool Pagemem::create(UINT pSize, UCHAR pErased)
+//******************************
+// Reserve address space for a "pSize" byte memory in which every byte
+// initially reads as "pErased". The first object to reserve memory also
+// installs the exception handler. Returns false if out of memory.
+{
+   destroy();
+
+   Count = (pSize + PAGE_SIZE - 1) >> PAGE_BITS;
+   Base = (UCHAR *) VirtualAlloc(NULL, Count << PAGE_BITS, MEM_RESERVE,
+      PAGE_NOACCESS);
+   if(!Base) {
+      destroy();
+      return false;
+   }
+
+   Size = pSize;
+   Erased = pErased;
+   Reserved = true;
+
+   if(!Pagemem_list) {
+      VEH_ADD addHandler = (VEH_ADD) GetProcAddress(
+         GetModuleHandle("kernel32.dll"), "AddVectoredExceptionHandler");
+      Fault_handler = addHandler ? addHandler(true, Fault) : NULL;
+   }
+   Next = Pagemem_list;
+   Pagemem_list = this;
+
+   Present = (UCHAR *) calloc(Count, 1);
+   if(Count && !Present) {
+      destroy();
+      return false;
+   }
+
+   // Without the exception handler, the hex editor would crash on the first
+   // page without storage, so all of them must be committed now
+   if(!Fault_handler) {
+      for(UINT i = 0; i < Count; i++) {
+         commit(i);
+      }
+   }
+
+   return true;
+}
+
+bool Pagemem::attach(UCHAR *pData, UINT pSize, UCHAR pErased)
+//******************************
+// Wrap an existing "pSize" byte buffer at "pData", which is not freed by
+// destroy(). Every page always has storage, so erase() simply fills the
+// buffer with "pErased". Returns false if out of memory.
+{
+   destroy();
+
+   Count = (pSize + PAGE_SIZE - 1) >> PAGE_BITS;
+   Present = (UCHAR *) malloc(Count);
+   if(Count && !Present) {
+      destroy();
+      return false;
+   }
+   memset(Present, true, Count);
+
+   Base = pData;
+   Size = pSize;
+   Erased = pErased;
+   return true;
+}
+
+bool Pagemem::map(const char *pName, UINT pSize, UCHAR pErased)
+//******************************
+// Map the existing raw binary file "pName" directly into memory as a "pSize"
+// byte buffer. Every write lands immediately in the file's pages inside the
+// Windows file cache, so no separate save is needed and the file is still
+// written out if VMLAB crashes. A file smaller than "pSize" is extended with
+// "pErased" bytes. Returns false if the file could not be mapped.
+{
+   destroy();
+
+   HANDLE file = CreateFile(pName, GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   if(file == INVALID_HANDLE_VALUE) {
+      return false;
+   }
+
+   // The mapping object extends the file to "pSize" bytes if it is smaller
+   DWORD length = GetFileSize(file, NULL);
+   HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READWRITE, 0, pSize,
+      NULL);
+   CloseHandle(file);
+   if(!mapping) {
+      return false;
+   }
+
+   UCHAR *view = (UCHAR *) MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, pSize);
+   if(!view || !attach(view, pSize, pErased)) {
+      if(view) {
+         UnmapViewOfFile(view);
+      }
+      CloseHandle(mapping);
+      return false;
+   }
+   Mapping = mapping;
+
+   // Bytes added by extending the file are zero, so they must be erased
+   if(length < pSize) {
+      memset(Base + length, Erased, pSize - length);
+   }
+
+   return true;
+}
+
+void Pagemem::destroy()
+//******************************
+// Release the address space and storage reserved by create(), or unmap the
+// file mapped by map(). The last object to release its reserved memory also
+// removes the exception handler.
+{
+   if(Reserved) {
+      Pagemem **link = &Pagemem_list;
+      while(*link != this) {
+         link = &(*link)->Next;
+      }
+      *link = Next;
+
+      if(!Pagemem_list && Fault_handler) {
+         VEH_REMOVE removeHandler = (VEH_REMOVE) GetProcAddress(
+            GetModuleHandle("kernel32.dll"), "RemoveVectoredExceptionHandler");
+         removeHandler(Fault_handler);
+         Fault_handler = NULL;
+      }
+
+      W32_ASSERT( VirtualFree(Base, 0, MEM_RELEASE) );
+   }
+   if(Mapping) {
+      W32_ASSERT( UnmapViewOfFile(Base) );
+      CloseHandle(Mapping);
+   }
+   free(Present);
+
+   Base = NULL;
+   Size = Count = 0;
+   Present = NULL;
+   Erased = 0;
+   Reserved = false;
+   Mapping = NULL;
+   Next = NULL;
+}
+
+void Pagemem::erase()
+//******************************
+// Set the entire memory back to the erased value. The storage of pages from
+// create() is released back to Windows, unless there is no exception handler
+// to commit the pages again when they are touched by the hex editor.
+{
+   for(UINT i = 0; i < Count; i++) {
+      if(Present[i]) {
+         UCHAR *page = Base + (i << PAGE_BITS);
+         if(Reserved && Fault_handler) {
+            W32_ASSERT( VirtualFree(page, PAGE_SIZE, MEM_DECOMMIT) );
+            Present[i] = false;
+         } else {
+            UINT length = MIN(Size - (i << PAGE_BITS), (UINT) PAGE_SIZE);
+            memset(page, Erased, length);
+         }
+      }
+   }
+}
+
+UINT Pagemem::footprint() const
+//******************************
+// Return the number of bytes in all pages with storage. This can be larger
+// than size() if the last page is only partially used.
+{
+   UINT count = 0;
+   for(UINT i = 0; i < Count; i++) {
+      if(Present[i]) {
+         count++;
+      }
+   }
+   return count << PAGE_BITS;
+}
+
+// =============================================================================
+// Watchlist class member functions
+// =============================================================================
+
+UINT Watchlist::build(UINT pLow, UINT pHigh)
+//******************************
+// Recompute Max_end for the sub-tree holding the List elements from "pLow"
+// up to but not including "pHigh", which must not be empty. Returns the
+// largest End address in the sub-tree.
+{
+   UINT mid = (pLow + pHigh) / 2;
+   UINT max = List[mid].End;
+   
+   if(pLow < mid) {
+      max = MAX(max, build(pLow, mid));
+   }
+   if(mid + 1 < pHigh) {
+      max = MAX(max, build(mid + 1, pHigh));
+   }
+   
+   Max_end[mid] = max;
+   return max;
+}
+
+const Watchpoint *Watchlist::search(UINT pLow, UINT pHigh, UINT pAddr,
+   UCHAR pData, int pType) const
+//******************************
+// Return the first watchpoint in the sub-tree from "pLow" up to but not
+// including "pHigh" which covers "pAddr" and matches the "pType" access of
+// "pData" byte value. Returns NULL if no watchpoint matches.
+{
+   while(pLow < pHigh) {
+      UINT mid = (pLow + pHigh) / 2;
+
+      // No watchpoint in this sub-tree reaches up to pAddr
+      if(Max_end[mid] < pAddr) {
+         return NULL;
+      }
+
+      const Watchpoint *found = search(pLow, mid, pAddr, pData, pType);
+      if(found) {
+         return found;
+      }
+
+      // All watchpoints in the right sub-tree start after this one
+      const Watchpoint &watch = List[mid];
+      if(watch.Start > pAddr) {
+         return NULL;
+      }
+      if(pAddr <= watch.End && (watch.Type & pType) &&
+         (watch.Value < 0 || watch.Value == pData)) {
+         return &watch;
+      }
+
+      pLow = mid + 1;
+   }
+   
+   return NULL;
+}
+
+Watchlist::Watchlist()
+//******************************
+// Initialize class to an empty list
+{
+   List = NULL;
+   Max_end = NULL;
+   Count = 0;
+}
+
+Watchlist::~Watchlist()
+//******************************
+// Free the list if clear() was not called explicitly
+{
+   clear();
+}
+
+bool Watchlist::add(const Watchpoint &pWatch)
+//******************************
+// Insert a new watchpoint into the list sorted by Start address and rebuild
+// the tree. Returns false if out of memory.
+{
+   Watchpoint *list = (Watchpoint *)
+      realloc(List, (Count + 1) * sizeof(Watchpoint));
+   if(!list) {
+      return false;
+   }
+   List = list;
+   
+   UINT *max = (UINT *) realloc(Max_end, (Count + 1) * sizeof(UINT));
+   if(!max) {
+      return false;
+   }
+   Max_end = max;
+   
+   UINT i;
+   for(i = Count; i > 0 && List[i - 1].Start > pWatch.Start; i--) {
+      List[i] = List[i - 1];
+   }
+   List[i] = pWatch;
+   Count++;
+   
+   build(0, Count);
+   return true;
+}
+
+void Watchlist::remove(UINT pStart, UINT pEnd)
+//******************************
+// Remove every watchpoint which overlaps any address from "pStart" to "pEnd"
+// inclusive and rebuild the tree. The remaining list stays sorted.
+{
+   UINT count = 0;
+   
+   for(UINT i = 0; i < Count; i++) {
+      if(List[i].End < pStart || List[i].Start > pEnd) {
+         List[count++] = List[i];
+      }
+   }
+   Count = count;
+   
+   if(Count) {
+      build(0, Count);
+   }
+}
+
+void Watchlist::clear()
+//******************************
+// Remove all watchpoints and return to the empty state
+{
+   free(List);
+   free(Max_end);
+   List = NULL;
+   Max_end = NULL;
+   Count = 0;
+}
+
+const Watchpoint *Watchlist::find(UINT pAddr, UCHAR pData, int pType) const
+//******************************
+// Return a watchpoint which covers "pAddr" and matches a "pType" access
+// (FL_BREAK_READ or FL_BREAK_WRITE) of byte value "pData", or NULL if none.
+// Takes O(log n) time plus the number of overlapping watchpoints.
+{
+   return search(0, Count, pAddr, pData, pType);
+}
+
 // =============================================================================
 // Hexfile class member functions
 // =============================================================================
@@ -1162,6 +2112,13 @@ void Hexfile::destroy()
       W32_ASSERT( DrawMenuBar(VMLAB_window) );
       MDI_child = NULL;
    }
+
+   // The coverage and watchpoint menu items were destroyed along with the
+   // hex editor
+   Cover = NULL;
+   Flags = NULL;
+   delete Overlay;
+   Overlay = NULL;
 }
 
 void Hexfile::data(UCHAR *pPointer, UINT pSize, UINT pOffset)
@@ -1172,20 +2129,30 @@ void Hexfile::data(UCHAR *pPointer, UINT pSize, UINT pOffset)
 // by "pPointer". The "pOffset" is typically zero but can specify any
 // arbitrary address to display in the editor for the first byte of the
 // buffer.
+{
+   Plain_memory.attach(pPointer, pPointer ? pSize : 0, 0xFF);
+   data(&Plain_memory, pOffset);
+}
+
+void Hexfile::data(Pagemem *pMemory, UINT pOffset)
+//******************************
+// Same as above, but the data is held in a sparse Pagemem buffer. The memory
+// must have been allocated with create() or attach() before calling this.
 {
    // TODO: assert that HEX_child should always exist
 
    // Update local variables used by load() and save()
-   Pointer = (UCHAR*) pPointer;
-   Size = pSize;
+   Memory = pMemory;
    Offset = pOffset;
+   Dirty_start = Dirty_end = 0;
    
    // Update internal state in the editor. Because the editor is not stable
    // without any data, the Dummy member variable is used as a placeholder
    // when unsetting the internal data pointers.   
    SendMessage(HEX_child, HEXM_SETOFFSET, (WPARAM) Offset, 0);
-   if(Pointer && Size) {
-      SendMessage(HEX_child, HEXM_SETPOINTER, (WPARAM) Pointer, Size);
+   if(Memory->data() && Memory->size()) {
+      SendMessage(HEX_child, HEXM_SETPOINTER, (WPARAM) Memory->data(),
+         Memory->size());
    } else {
       SendMessage(HEX_child, HEXM_SETPOINTER, (WPARAM) &Dummy, 1);
    }
@@ -1196,31 +2163,101 @@ void Hexfile::data(UCHAR *pPointer, UINT pSize, UINT pOffset)
 
 void Hexfile::flags(UCHAR *pFlags, UINT pSize)
 //******************************
-// Set or change a bitflag buffer which affects how individual bytes are
-// displayed in the hex editor (e.g. color highlighting to show read/write
-// coverage). The bitflag buffer should normally be the same size as the raw
-// data, but the hex editor can still function if the
-// bitflag buffer is larger or smaller than the raw data buffer.
-// Passing zero for both arguments will disable custom coloring.
-{
-   bool oldState = (Flags && Flags_size);
-   bool newState = (pFlags && pSize);
-
-   // Add or remove the "Clear R/W coverage" menu item from the hex editor's
-   // pop-up menu depending on whether a bitflag buffer is defined
+// Set or change a bitflag buffer which holds the watchpoint bits for each
+// byte of raw data. The watchpoints set by the user are marked in the buffer
+// and affect how individual bytes are displayed in the hex editor. The
+// bitflag buffer should normally be the same size as the raw data, but the
+// hex editor can still function if the bitflag buffer is larger or smaller
+// than the raw data buffer. Passing zero for both arguments will disable
+// watchpoints.
+{
+   if(pFlags && pSize) {
+      Plain_flags.attach(pFlags, pSize, 0x00);
+      flags(&Plain_flags);
+   } else {
+      flags(NULL);
+   }
+}
+
+void Hexfile::flags(Pagemem *pFlags)
+//******************************
+// Same as above, but the bitflags are held in a sparse Pagemem buffer whose
+// erased value must be zero. Passing NULL will disable watchpoints.
+{
+   bool oldState = (Flags != NULL);
+   bool newState = (pFlags && pFlags->size());
+
+   // Add or remove the watchpoint menu items from the hex editor's pop-up
+   // menu depending on whether a bitflag buffer is defined
+   if(oldState != newState) {
+      HMENU menu = (HMENU) SendMessage(HEX_child, HEXM_GETMENU, 0, 0);
+      if(newState) {
+         W32_ASSERT( AppendMenu(menu, MF_SEPARATOR, IDM_WATCH_SEP, NULL) );
+         W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_WATCH_READ, WATCH_READ) );
+         W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_WATCH_WRITE, WATCH_WRITE) );
+         W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_WATCH_VALUE, WATCH_VALUE) );
+         W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_UNWATCH, UNWATCH) );
+         W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_UNWATCH_ALL, UNWATCH_ALL) );
+      } else {
+         W32_ASSERT( RemoveMenu(menu, IDM_WATCH_SEP, MF_BYCOMMAND) );
+         W32_ASSERT( RemoveMenu(menu, IDM_WATCH_READ, MF_BYCOMMAND) );
+         W32_ASSERT( RemoveMenu(menu, IDM_WATCH_WRITE, MF_BYCOMMAND) );
+         W32_ASSERT( RemoveMenu(menu, IDM_WATCH_VALUE, MF_BYCOMMAND) );
+         W32_ASSERT( RemoveMenu(menu, IDM_UNWATCH, MF_BYCOMMAND) );
+         W32_ASSERT( RemoveMenu(menu, IDM_UNWATCH_ALL, MF_BYCOMMAND) );
+      }
+   }
+
+   // Mark any watchpoints kept from an earlier buffer into the new one
+   Flags = newState ? pFlags : NULL;
+   mark();
+}
+
+void Hexfile::coverage(Coverage *pCoverage)
+//******************************
+// Set or change the bitmap used for tracking read/write coverage, which is
+// shown by color highlighting in the hex editor. The component records
+// accesses directly into the bitmap and calls touch() for the changed bytes.
+// Passing NULL will disable coverage highlighting.
+{
+   bool oldState = (Cover != NULL);
+   bool newState = (pCoverage && pCoverage->size());
+
+   // Add or remove the "Clear R/W coverage" and "Load merged R/W coverage"
+   // menu items from the hex editor's pop-up menu depending on whether a
+   // coverage bitmap is defined
    if(oldState != newState) {
       HMENU menu = (HMENU) SendMessage(HEX_child, HEXM_GETMENU, 0, 0);
       if(newState) {
          W32_ASSERT( AppendMenu(menu, MF_SEPARATOR, IDM_CLEAR_RW_SEP, NULL) );
          W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_CLEAR_RW, CLEAR_COVERAGE) );
+         W32_ASSERT( AppendMenu(menu, MF_STRING, IDM_LOAD_RW, LOAD_COVERAGE) );
       } else {
          W32_ASSERT( RemoveMenu(menu, IDM_CLEAR_RW_SEP, MF_BYCOMMAND) );
          W32_ASSERT( RemoveMenu(menu, IDM_CLEAR_RW, MF_BYCOMMAND) );
+         W32_ASSERT( RemoveMenu(menu, IDM_LOAD_RW, MF_BYCOMMAND) );
       }
    }
 
-   Flags = pFlags;
-   Flags_size = pSize;
+   Cover = newState ? pCoverage : NULL;
+   touch(0, Memory ? Memory->size() : 0);
+}
+
+const char *Hexfile::watch(UINT pAddr, UCHAR pData, int pType)
+//******************************
+// Called by the component on a "pType" access (FL_BREAK_READ or
+// FL_BREAK_WRITE) of byte value "pData" at offset "pAddr", but only if the
+// same bit is set in the flag byte for "pAddr". Evaluates the full
+// watchpoint conditions, and returns a message to be passed to BREAK() if a
+// watchpoint was hit, or NULL otherwise.
+{
+   if(!Watches.find(pAddr, pData, pType)) {
+      return NULL;
+   }
+
+   snprintf(Message, sizeof(Message), "%s watchpoint hit at $%04X=$%02X",
+      pType == FL_BREAK_READ ? "Read" : "Write", pAddr + Offset, pData);
+   return Message;
 }
 
 void Hexfile::hide()
@@ -1234,15 +2271,44 @@ void Hexfile::hide()
    Hide(MDI_child);
 }
 
+void Hexfile::touch(UINT pOffset, UINT pLength)
+//******************************
+// Record that the simulation has changed "pLength" bytes of memory contents
+// or bitflags starting at "pOffset" in the data buffer. The changed bytes
+// will be redrawn by the next call to refresh(). Only a single bounding range
+// is kept, since changes are normally clustered close to each other.
+{
+   if(!Memory || pOffset >= Memory->size()) {
+      return;
+   }
+   UINT end = pOffset + MIN(pLength, Memory->size() - pOffset);
+
+   if(Dirty_end <= Dirty_start) {
+      Dirty_start = pOffset;
+      Dirty_end = end;
+   } else {
+      Dirty_start = MIN(Dirty_start, pOffset);
+      Dirty_end = MAX(Dirty_end, end);
+   }
+}
+
 void Hexfile::refresh()
 //******************************
-// Update displayed hex data because simulation has changed memory contents
+// Update displayed hex data because simulation has changed memory contents.
+// Only the lines containing bytes passed to touch() since the last refresh()
+// are redrawn; if nothing was touched then this function does nothing.
 {
-   // Sending HEXM_INVALIDATE forces hex editor to recompute display colors
-   // which could have changed if read/write coverage has been updated.
-   // Passing 0 for both message arguments will always refresh the entire
-   // window.
-   SendMessage(HEX_child, HEXM_INVALIDATE, 0, 0);
+   if(Dirty_end <= Dirty_start) {
+      return;
+   }
+
+   // Sending HEXM_INVALIDATERANGE forces hex editor to recompute display
+   // colors which could have changed if read/write coverage has been updated.
+   // Only the visible lines which overlap the inclusive address range passed
+   // in the message arguments are actually invalidated and redrawn.
+   SendMessage(HEX_child, HEXM_INVALIDATERANGE, Offset + Dirty_start,
+      Offset + Dirty_end - 1);
+   Dirty_start = Dirty_end = 0;
 }
 
 void Hexfile::show()
@@ -1294,17 +2360,17 @@ void Hexfile::load(char *pFile, int pType)
    // Initialize EEPROM contents to fully erased (0xFF) state
    // before loading data so that any unspecified "holes" in the
    // file's address space end up as $FF
-   memset(Pointer, 0xFF, Size);
+   Memory->erase();
 
    // If an I/O error occurs, the File class will throw an exception
    // to abort the operation. The EEPROM memory may be partially
    // initialized if only part of the input file was read.
    try {
       switch(pType) {
-         case FT_HEX:  Read_HEX(Pointer, Size, pFile); break;
-         case FT_SREC: Read_SREC(Pointer, Size, pFile); break;
-         case FT_GEN:  Read_GEN(Pointer, Size, pFile); break;
-         case FT_BIN:  Read_BIN(Pointer, Size, pFile); break;
+         case FT_HEX:  Read_HEX(*Memory, pFile); break;
+         case FT_SREC: Read_SREC(*Memory, pFile); break;
+         case FT_GEN:  Read_GEN(*Memory, pFile); break;
+         case FT_BIN:  Read_BIN(*Memory, pFile); break;
          default:
             File_Error(pFile, MB_ICONERROR,
                "Invalid file type in Hexfile::load()");
@@ -1312,6 +2378,7 @@ void Hexfile::load(char *pFile, int pType)
       }
       
       // Force a redraw of the hex editor window to show new data
+      touch(0, Memory->size());
       refresh();
    }
    catch (File::Error) {}
@@ -1350,21 +2417,22 @@ void Hexfile::load()
    }
 }
 
-void Hexfile::save(char *pFile, int pType)
+void Hexfile::save(char *pFile, int pType, bool pAtomic)
 //******************************
 // Given the filename in "pFile" and the file type (one of the FT_HEX,
 // FT_SREC, etc. enums) in "pType", attempt to write the memory contents
-// into a memory image file.
+// into a memory image file. If "pAtomic" is true, the file is replaced
+// only after the new contents have been completely written to disk.
 {
-   // If an I/O error occurs, the File class will throw an exception
-   // to abort the operation. The output file will have been partially
-   // written at this point.
+   // If an I/O error occurs, Write_file() will throw an exception to
+   // abort the operation. Unless "pAtomic" is true, the output file may
+   // have been partially written at this point.
    try {
       switch(pType) {
-         case FT_HEX:  Write_HEX(Pointer, Size, pFile); break;
-         case FT_SREC: Write_SREC(Pointer, Size, pFile); break;
-         case FT_GEN:  Write_GEN(Pointer, Size, pFile); break;
-         case FT_BIN:  Write_BIN(Pointer, Size, pFile); break;
+         case FT_HEX:  Write_HEX(*Memory, pFile, pAtomic); break;
+         case FT_SREC: Write_SREC(*Memory, pFile, pAtomic); break;
+         case FT_GEN:  Write_GEN(*Memory, pFile, pAtomic); break;
+         case FT_BIN:  Write_BIN(*Memory, pFile, pAtomic); break;
          default:
             File_Error(pFile, MB_ICONERROR,
                "Invalid file type in Hexfile::load()");
@@ -1419,40 +2487,57 @@ void Hexfile::erase()
    );
    
    if(rc == IDYES) {
-      memset(Pointer, 0xFF, Size);
+      Memory->erase();
+      touch(0, Memory->size());
       refresh();
    }
 }
 
 void Hexfile::On_custom_colors(LPARAM lParam)
 //******************************
-// Called from MDI_proc() on a WM_NOTIFY with code HEXN_CUSTOMCOLORS. If a bit
-// flag buffer was previously registered with flags(), then customize the
-// COLORREF buffers in the HEXNM_COLORS structure to reflect the read/write
-// coverage specified by the bitflags.
+// Called from MDI_proc() on a WM_NOTIFY with code HEXN_CUSTOMCOLORS. If a
+// coverage bitmap was previously registered with coverage(), then customize
+// the COLORREF buffers in the HEXNM_COLORS structure to reflect the
+// read/write coverage of the current run combined with any loaded overlay.
+// If a bitflag buffer was registered with flags(), then also highlight all
+// the bytes covered by watchpoints.
 {
    HEXNM_COLORS *notify = (HEXNM_COLORS *) lParam;
 
+   // Bytes covered by a watchpoint are shown in a different text color
    if(Flags) {
       UINT src = notify->sc_start - Offset;
-      UINT end = MIN(notify->sc_end - Offset, Flags_size);      
+      UINT end = MIN(notify->sc_end - Offset, Flags->size());
+
+      for(UINT dst = 0; src < end; src++, dst++) {
+         if(Flags->get(src) & FLM_BREAKPOINTS) {
+            notify->colors_hex[dst].fore = COLOR_BREAK;
+            notify->colors_ansi[dst].fore = COLOR_BREAK;
+         }
+      }
+   }
+
+   if(Cover) {
+      UINT src = notify->sc_start - Offset;
+      UINT end = MIN(notify->sc_end - Offset, Cover->size());
       
       // Color buffers are always filled starting at index 0. This is the
       // first visible byte in the window, which corresponds to index "src"
       // in the data buffer.
       for(UINT dst = 0; src < end; src++, dst++) {
-         switch(Flags[src] & FLM_COVERAGE) {
-            case FL_READ:
+         int cover = Cover->get(src) | (Overlay ? Overlay->get(src) : 0);
+         switch(cover) {
+            case Coverage::CV_READ:
                notify->colors_hex[dst].back = COLOR_R;
                notify->colors_ansi[dst].back = COLOR_R;
                break;
             
-            case FL_WRITE:
+            case Coverage::CV_WRITE:
                notify->colors_hex[dst].back = COLOR_W;
                notify->colors_ansi[dst].back = COLOR_W;
                break;
             
-            case FL_READ | FL_WRITE:
+            case Coverage::CV_READ | Coverage::CV_WRITE:
                notify->colors_hex[dst].back = COLOR_RW;
                notify->colors_ansi[dst].back = COLOR_RW;
                break;
@@ -1463,14 +2548,162 @@ void Hexfile::On_custom_colors(LPARAM lParam)
 
 void Hexfile::On_clear_rw()
 //******************************
-// Called from MDI_proc() on a WM_COMMAND with code IDM_CLEAR_RW. If a bit
-// flag buffer was previously registered with flags(), then set the read/write
-// coverage portion of the flags to zero.
+// Called from MDI_proc() on a WM_COMMAND with code IDM_CLEAR_RW. If a
+// coverage bitmap was previously registered with coverage(), then clear it
+// and discard any overlay loaded with On_load_coverage().
 {
-   if(Flags) {
-      for(UINT i = 0; i < Flags_size; i++) {
-         Flags[i] &= ~FLM_COVERAGE;
+   if(Cover) {
+      Cover->clear();
+   }
+   delete Overlay;
+   Overlay = NULL;
+   
+   touch(0, Memory->size());
+   refresh();
+}
+
+void Hexfile::On_load_coverage()
+//******************************
+// Called from MDI_proc() on a WM_COMMAND with code IDM_LOAD_RW. Display the
+// common "Open" dialog box so the user can select a coverage file (usually
+// merged from many simulation runs by covmerge.exe) and merge it into the
+// overlay shown on top of the live coverage. The overlay is kept separate
+// so the file is never accumulated back into the coverage of this run.
+{
+   // Structure and pathname buffer for use with common dialog routines.
+   char pathBuffer[MAX_PATH];
+   OPENFILENAME dlg;
+   
+   // Initialize OPENFILENAME structure for use with "Open" common dialog box.
+   // All unused, reserved, and output fields are initialized to zero.
+   memset(&dlg, 0, sizeof(OPENFILENAME));  // Initialize struct to zero
+   pathBuffer[0] = '\0';                   // No initial filename in dialog
+   dlg.lStructSize = sizeof(OPENFILENAME); // Structure size required
+   dlg.hwndOwner = VMLAB_window;           // Owner window of Open dialog
+   dlg.lpstrFilter = COVERAGE_FILTER;      // Supported file types
+   dlg.lpstrFile = pathBuffer;             // Buffer to receive user's filename
+   dlg.nMaxFile = MAX_PATH;                // Total size of lpstrFile buffer
+   dlg.lpstrDefExt = "cov";                // Default filename extension
+   dlg.lpstrTitle = "Load Coverage File";  // Dialog title
+   dlg.Flags =                             // Option flags
+      OFN_NOCHANGEDIR |              // Don't change VMLAB's working directory
+      OFN_HIDEREADONLY |             // Hide "Read Only" checkbox in dialog
+      OFN_FILEMUSTEXIST |            // File names must already exist
+      OFN_PATHMUSTEXIST;             // Directory locations must already exist
+
+   if(!Cover || !GetOpenFileName(&dlg)) {
+      return;
+   }
+
+   // A new overlay is created with the size stored in the file; an existing
+   // one is merged with the new file so several files can be combined.
+   if(!Overlay) {
+      Overlay = new Coverage;
+   }
+   if(!Overlay->load(pathBuffer) || Overlay->size() != Cover->size()) {
+      File_Error(pathBuffer, MB_ICONERROR, ERROR_COVERAGE);
+      delete Overlay;
+      Overlay = NULL;
+   }
+   
+   touch(0, Memory->size());
+   refresh();
+}
+
+bool Hexfile::selection(UINT &pStart, UINT &pEnd)
+//******************************
+// Get the range of bytes currently selected in the hex editor as inclusive
+// offsets into the data buffer. If nothing is selected, the range is the
+// single byte at the cursor. Returns false if there is no bitflag buffer or
+// if the range lies outside of it.
+{
+   UINT start, end;
+   
+   // The hex editor returns the selection anchor and cursor positions, which
+   // include the display offset. The cursor may be before the anchor, and a
+   // non-empty selection ends just before the larger of the two.
+   SendMessage(HEX_child, HEXM_GETSEL, (WPARAM) &start, (LPARAM) &end);
+   start -= Offset;
+   end -= Offset;
+   if(start > end) {
+      UINT temp = start;
+      start = end;
+      end = temp;
+   }
+   if(end > start) {
+      end--;
+   }
+   
+   pStart = start;
+   pEnd = end;
+   return Flags && end < Flags->size();
+}
+
+void Hexfile::mark()
+//******************************
+// Rebuild the watchpoint bits in the bitflag buffer from the watchpoint list
+// and redraw the hex editor. Called whenever the list changes. Storage in a
+// sparse bitflag buffer is only committed for pages covered by watchpoints.
+{
+   if(!Flags) {
+      return;
+   }
+   
+   for(UINT i = 0; i < Flags->size(); i++) {
+      if(Flags->present(i)) {
+         (*Flags)[i] &= ~FLM_BREAKPOINTS;
+      }
+   }
+   
+   for(UINT w = 0; w < Watches.count(); w++) {
+      const Watchpoint &watch = Watches[w];
+      for(UINT i = watch.Start; i <= watch.End && i < Flags->size(); i++) {
+         (*Flags)[i] |= watch.Type;
       }
    }
+   
+   touch(0, Flags->size());
    refresh();
 }
+
+void Hexfile::On_watch(int pType, bool pValue)
+//******************************
+// Called from MDI_proc() on a WM_COMMAND with code IDM_WATCH_READ,
+// IDM_WATCH_WRITE, or IDM_WATCH_VALUE. Add a new "pType" watchpoint covering
+// the bytes selected in the hex editor. If "pValue" is true, the user is
+// asked for a byte value and the watchpoint only breaks on that value.
+{
+   Watchpoint watch;
+   
+   if(!selection(watch.Start, watch.End)) {
+      return;
+   }
+   watch.Type = pType;
+   watch.Value = -1;
+   
+   if(pValue && !Input_value(Instance, "Watchpoint Value", watch.Value)) {
+      return;
+   }
+   
+   if(!Watches.add(watch)) {
+      MessageBox(VMLAB_window, "Could not allocate memory", "Watchpoint",
+         MB_OK | MB_ICONERROR);
+   }
+   mark();
+}
+
+void Hexfile::On_unwatch(bool pAll)
+//******************************
+// Called from MDI_proc() on a WM_COMMAND with code IDM_UNWATCH or
+// IDM_UNWATCH_ALL. Remove all watchpoints which overlap the bytes selected
+// in the hex editor, or every watchpoint if "pAll" is true.
+{
+   UINT start, end;
+   
+   if(pAll) {
+      Watches.clear();
+   } else if(selection(start, end)) {
+      Watches.remove(start, end);
+   }
+   mark();
+}
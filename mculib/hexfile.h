@@ -33,26 +33,139 @@
 #ifndef _HEXFILE_H
 #define _HEXFILE_H
 
+class Coverage;
+
+class Pagemem
+//*********
+// Sparse memory buffer for large memories that are mostly erased. The buffer
+// occupies one contiguous range of reserved address space, so it can be shown
+// directly in the hex editor, but storage is only committed one page at a
+// time when a page is first written. All pages without storage read as the
+// erased value. If the hex editor itself touches a page without storage, a
+// vectored exception handler commits the page and resumes the editor. On
+// Windows versions without vectored exception handlers, create() commits the
+// entire buffer up front.
+//
+// An existing malloc()ed buffer can also be wrapped with attach(), or an
+// existing binary file can be mapped into memory with map(). In both cases
+// every page always has storage. Instances can be added directly to the
+// DECLARE_VAR section, since the all zero state is a valid empty buffer.
+{
+private:
+   UCHAR *Base;      // Start of contiguous address range holding all pages
+   UINT Size;        // Total size of memory in bytes
+   UINT Count;       // Total number of pages including partial last page
+   UCHAR *Present;   // One byte per page; true if page has storage
+   UCHAR Erased;     // Value of every byte in a page without storage
+   bool Reserved;    // True if create() reserved the address range
+   HANDLE Mapping;   // File mapping object created by map() or NULL
+   Pagemem *Next;    // Next buffer in list searched by Fault()
+
+   void commit(UINT pPage);
+
+   static LONG WINAPI Fault(EXCEPTION_POINTERS *pInfo);
+
+public:
+   enum { PAGE_BITS = 12, PAGE_SIZE = 1 << PAGE_BITS };
+
+   Pagemem();
+   ~Pagemem();
+
+   bool create(UINT pSize, UCHAR pErased);
+   bool attach(UCHAR *pData, UINT pSize, UCHAR pErased);
+   bool map(const char *pName, UINT pSize, UCHAR pErased);
+   void destroy();
+   void erase();
+   UINT footprint() const;
+
+   UCHAR *data() const { return Base; }
+   UINT size() const { return Size; }
+   UCHAR erased() const { return Erased; }
+   bool mapped() const { return Mapping != NULL; }
+
+   // True if the page containing "pAddr" has storage committed
+   bool present(UINT pAddr) const { return Present[pAddr >> PAGE_BITS] != 0; }
+
+   // Read one byte without committing storage for its page
+   UCHAR get(UINT pAddr) const { return present(pAddr) ? Base[pAddr] : Erased; }
+
+   // Access one byte for writing; commits storage for its page if needed
+   UCHAR &operator[](UINT pAddr)
+   {
+      if(!present(pAddr)) {
+         commit(pAddr >> PAGE_BITS);
+      }
+      return Base[pAddr];
+   }
+};
+
+struct Watchpoint
+//*********
+// One data watchpoint set by the user from the hex editor's pop-up menu. It
+// covers all addresses from Start to End inclusive.
+{
+   UINT Start;       // First address covered by watchpoint
+   UINT End;         // Last address covered by watchpoint
+   int Type;         // Hexfile::FL_BREAK_READ or Hexfile::FL_BREAK_WRITE
+   int Value;        // Only break if this byte value is accessed; -1 for any
+};
+
+class Watchlist
+//*********
+// Small interval tree holding all the watchpoints of one Hexfile. The tree
+// is implicit in an array sorted by Start: the root of any sub-range of the
+// array is its middle element, and Max_end holds the largest End address in
+// the sub-tree rooted at each element. The tree is rebuilt on every change,
+// which only happens from the GUI. Instances can be added directly to the
+// DECLARE_VAR section, since the all zero state is a valid empty list.
+{
+private:
+   Watchpoint *List; // Watchpoints sorted by Start address
+   UINT *Max_end;    // Largest End address in each sub-tree
+   UINT Count;       // Number of watchpoints in List
+
+   UINT build(UINT pLow, UINT pHigh);
+   const Watchpoint *search(UINT pLow, UINT pHigh, UINT pAddr, UCHAR pData,
+      int pType) const;
+
+public:
+   Watchlist();
+   ~Watchlist();
+
+   bool add(const Watchpoint &pWatch);
+   void remove(UINT pStart, UINT pEnd);
+   void clear();
+   const Watchpoint *find(UINT pAddr, UCHAR pData, int pType) const;
+
+   UINT count() const { return Count; }
+   const Watchpoint &operator[](UINT pIndex) const { return List[pIndex]; }
+};
+
 class Hexfile
 //*********
 // Primary interface class. A separate instance of this class should be
 // created for every data buffer. Instances can be added directly to
 // the DELCARE_VAR section.
 //
+// Read/write coverage is tracked in a packed Coverage bitmap registered with
+// coverage(). The user can also load a coverage file merged from earlier
+// simulation runs, which is shown as an overlay on top of the live coverage.
+//
 // Each byte in the bitflag buffer registered with flags() has a one-to-one
 // correspondence with the each byte in the data buffer registered with
 // data(). The bits in each flag byte are defined as follows:
 //
-// Bit 0: True if read by microcontroller
-// Bit 1: Reserved for 2nd port (i.e. device) read in dual-port memory
-// Bit 2: True if written by microcontroller
-// Bit 3: Reserved for 2nd port (i.e. device) write in dual-port memory
-// Bit 4: Reserved for read breakpoint
-// Bit 5: Reserved for write breakpoint
+// Bit 0-3: Unused; formerly read/write coverage (now kept by Coverage)
+// Bit 4: True if covered by a read watchpoint
+// Bit 5: True if covered by a write watchpoint
 // Bit 6: Reserved for valid/invalid location (will always display hex as ..)
 // Bit 7: Reserved for data type (I/O register vs normal memory)
 // 
-// At this time only bits 0 and 1 are currently implemented
+// At this time only bits 4 and 5 are currently implemented. The watchpoint
+// bits are maintained by Hexfile itself from the pop-up menu. On every memory
+// access the component tests the flag byte, and only if the FL_BREAK_READ or
+// FL_BREAK_WRITE bit is set does it call watch() to evaluate the complete
+// watchpoint conditions (e.g. a value match).
 {
 private:
    HINSTANCE Instance; // Saved copy of pInstance passed to init()
@@ -60,17 +173,30 @@ private:
    HWND MDI_child;   // Child window of MDI_client containing HEX_child
    HWND HEX_child;   // The "shineinhex" class window inside MDI_child
    
-   UCHAR *Pointer;   // Data buffer on which all operations will act on
-   UINT Size;        // Total size of data buffer in bytes
+   Pagemem *Memory;  // Data buffer on which all operations will act on
    UINT Offset;      // Value added to the offset display in the hex editor
 
-   UCHAR *Flags;     // bitflag buffer for customizing hex editor colors
-   UINT Flags_size;  // Size of the bitflag buffer
+   Pagemem *Flags;   // bitflag buffer for customizing hex editor colors
+   Coverage *Cover;  // R/W coverage tracked by the component or NULL
+   Coverage *Overlay; // Merged coverage loaded by the user or NULL
+   Watchlist Watches; // Watchpoints whose addresses are marked in Flags
+   char Message[64]; // Last watchpoint message returned by watch()
+
+   Pagemem Plain_memory; // Wraps plain buffer passed to data()
+   Pagemem Plain_flags;  // Wraps plain buffer passed to flags()
    
    char Dummy;       // Dummy data for editor because HEXM_UNSETPOINTER is buggy
 
+   UINT Dirty_start; // First byte changed since the last refresh()
+   UINT Dirty_end;   // One past last changed byte; range empty if <= start
+
    void On_custom_colors(LPARAM lParam);
    void On_clear_rw();
+   void On_load_coverage();
+   void On_watch(int pType, bool pValue);
+   void On_unwatch(bool pAll);
+   bool selection(UINT &pStart, UINT &pEnd);
+   void mark();
    
    static LRESULT CALLBACK MDI_proc(HWND pWindow, UINT pMessage, WPARAM pW, LPARAM pL);
    
@@ -80,38 +206,43 @@ public:
    // the OPENFILENAME_FILTER string in hexfile.cpp.
    enum { FT_HEX = 1, FT_SREC, FT_GEN, FT_BIN };
    
-   // bitflags used with the flags() registered buffer to indicate what type
-   // of memory access (read or write) has been performed on an address range.
-   // These presence of these flags customizes the display colors in the hex
-   // editor. All other bit positions are reserved for future use and should
-   // be zero.
-   enum { FL_READ = 0x1, FL_WRITE = 0x4 };
+   // Bitflags used with the flags() registered buffer to indicate which type
+   // of memory access (read or write) is covered by a watchpoint. The
+   // presence of these flags also changes the text color in the hex editor.
+   enum { FL_BREAK_READ = 0x10, FL_BREAK_WRITE = 0x20 };
 
    // Bitmasks used with the flags() registered buffer to select various bits.
-   // The bits used for read/write coverage are considered ephermal; they can
-   // be cleared by the user via the context menu and should be cleared by the
-   // component on simulation end.
-   enum { FLM_COVERAGE = 0x0f, FLM_BREAKPOINTS = 0x30 };
-   
+   // All other bit positions are reserved for future use and should be zero.
+   enum { FLM_BREAKPOINTS = 0x30 };   
    Hexfile();
    ~Hexfile();
 
    void init(HINSTANCE pInstance, HWND pHandle, char *pTitle, int pIcon = 0);   
    void data(UCHAR *pPointer, UINT pSize, UINT pOffset = 0);   
+   void data(Pagemem *pMemory, UINT pOffset = 0);
    void destroy();
 
    void flags(UCHAR *pFlags, UINT pSize);
+   void flags(Pagemem *pFlags);
+   void coverage(Coverage *pCoverage);
+   const char *watch(UINT pAddr, UCHAR pData, int pType);
    
    void erase();
    void load();
    void save();
    void load(char *pFile, int pType);
-   void save(char *pFile, int pType);
+   void save(char *pFile, int pType, bool pAtomic = false);
 
    void hide();
    void show();
    void readonly(bool pReadOnly);
+   void touch(UINT pOffset, UINT pLength = 1);
    void refresh();
 };
 
+// Replace file "pName" with the "pLength" bytes from "pData" by way of a
+// temporary "<pName>.tmp" file, so an existing file is never left partially
+// written. Any error is shown in a message box and false is returned.
+bool Replace_file(const char *pName, const char *pData, UINT pLength);
+
 #endif // #ifndef _HEXFILE_H
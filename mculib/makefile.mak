@@ -21,7 +21,8 @@
 
 # All the DLL files that need to be included in "mculib"
 all:  dummy168.dll timer0_168.dll timer2_168.dll timerN_168.dll \
-      wdog.dll comp.dll eeprom.dll adc.dll
+      wdog.dll comp.dll eeprom.dll adc.dll trcdump.exe covmerge.exe \
+      tmrchk0.exe tmrchk2.exe tmrchkN.exe w8bench.exe w8benchs.exe
 
 # Resource files need explicit dependencies (not handled by .autodepend)
 dummy168.dll:     dummy168.res
@@ -42,8 +43,45 @@ eeprom.res:       version.h eeprom.h
 adc.res:          version.h adc.h
 
 # DLL files that link multiple .obj files require explicit rules
-eeprom.dll:       eeprom.obj hexfile.obj eeprom.res
-   ${LD} ${LDFLAGS} ${STARTUP} eeprom.obj hexfile.obj,$@, ,${LIBS}, ,$&.res
+timer0_168.dll:   timer0_168.obj trace.obj
+   ${LD} ${LDFLAGS} ${STARTUP} timer0_168.obj trace.obj,$@, ,${LIBS}, ,$&.res
+timer2_168.dll:   timer2_168.obj trace.obj
+   ${LD} ${LDFLAGS} ${STARTUP} timer2_168.obj trace.obj,$@, ,${LIBS}, ,$&.res
+timerN_168.dll:   timerN_168.obj trace.obj
+   ${LD} ${LDFLAGS} ${STARTUP} timerN_168.obj trace.obj,$@, ,${LIBS}, ,$&.res
+wdog.dll:         wdog.obj trace.obj
+   ${LD} ${LDFLAGS} ${STARTUP} wdog.obj trace.obj,$@, ,${LIBS}, ,$&.res
+comp.dll:         comp.obj trace.obj
+   ${LD} ${LDFLAGS} ${STARTUP} comp.obj trace.obj,$@, ,${LIBS}, ,$&.res
+adc.dll:          adc.obj trace.obj
+   ${LD} ${LDFLAGS} ${STARTUP} adc.obj trace.obj,$@, ,${LIBS}, ,$&.res
+eeprom.dll:       eeprom.obj hexfile.obj coverage.obj trace.obj eeprom.res
+   ${LD} ${LDFLAGS} ${STARTUP} eeprom.obj hexfile.obj coverage.obj trace.obj,$@, ,${LIBS}, ,$&.res
+
+# Console tool for decoding binary trace files; not a DLL so no -WD flag
+trcdump.exe:      trcdump.cpp trace.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -e$@ trcdump.cpp
+
+# Console tool for merging coverage files; also not a DLL
+covmerge.exe:     covmerge.cpp coverage.obj coverage.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -e$@ covmerge.cpp coverage.obj
+
+# Console tools verifying the timer decoding tables in timer_168.h against the
+# original switch statements and timing both; one for each timer type. Run
+# after any change.
+tmrchk0.exe:      tmrcheck.cpp timer_168.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -DTIMER_0 -e$@ tmrcheck.cpp
+tmrchk2.exe:      tmrcheck.cpp timer_168.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -DTIMER_2 -e$@ tmrcheck.cpp
+tmrchkN.exe:      tmrcheck.cpp timer_168.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -DTIMER_N -e$@ tmrcheck.cpp
+
+# Console tools checking and timing the WORD8 bulk operations in word8ops.h;
+# w8bench.exe uses the default wide version and w8benchs.exe the scalar one
+w8bench.exe:      w8bench.cpp word8ops.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -e$@ w8bench.cpp
+w8benchs.exe:     w8bench.cpp word8ops.h
+   ${CC} -I"${INCLUDE}" -L"${LIBDIR}" -WC ${OPTFLAGS} -DWORD8_SCALAR -e$@ w8bench.cpp
    
          
 # Suffixes directive needed to make implicit rules work properly
@@ -76,7 +114,7 @@ RFLAGS    = -I"${INCLUDE}"
 clean:
    del *.il? *.obj *.res *.tds
 distclean: clean
-   del *.dll
+   del *.dll *.exe
    
 # Implicit rule for linking .obj and .res into .dll
 .obj.dll:
@@ -26,6 +26,7 @@
 #define IS_PERIPHERAL       // To distinguish from a normal user component
 #include "blackbox.h"
 #include "useravr.h"
+#include "trace.h"
 
 #include "timer0_168.h"
 
@@ -27,6 +27,11 @@ int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
 // Used by TIMER2 for REMIND_ME() delays.
 #define PERIOD_32K (1.0 / 32768)
 
+// Maximum number of 32.768kHz crystal ticks (one second) that TIMER2 will
+// simulate with a single REMIND_ME(). Bounds the error in Async_elapsed() if
+// the CPU clock frequency changes while no timer events are happening.
+#define MAX_32K_TICKS 32768
+
 // Involved ports. Keep same order as in .INI file "Port_map = ..." who
 // does the actual assignment to micro ports PD0, etc. This allows multiple instances
 // to be mapped into different port sets
@@ -40,24 +45,13 @@ DECLARE_PINS
 #endif
 END_PINS
 
-// Coding of work modes, status, clock sources, etc
+// Coding of work modes, status, clock sources, etc. The WGM, COM, and CS bit
+// decoding tables live in timer_168.h so tmrcheck.exe can verify them.
 //
-enum {CLK_STOP, CLK_INTERNAL, CLK_EXT_FALL, CLK_EXT_RISE, CLK_UNKNOWN, CLK_32K, CLK_EXT};
-enum {ACT_NONE, ACT_TOGGLE, ACT_CLEAR, ACT_SET, ACT_RESERVED}; // Actions on compare
+#include "timer_168.h"
 enum {DEBUG_LOG = 1, DEBUG_ASYNC_CORRUPT = 2}; // For Debug. To combine by ORing
 enum {ASY_NONE, ASY_32K, ASY_EXT}; // Type of asynchronous mode operation
 
-// Wsveform generation modes
-enum {
-   WAVE_NORMAL, WAVE_PWM_PC, WAVE_PWM_PFC, WAVE_CTC, WAVE_PWM_FAST,
-   WAVE_RESERVED, WAVE_UNKNOWN
-};
-
-// Counter TOP/overflow value selected by WGM bits
-enum {
-   VAL_NONE, VAL_OCRA, VAL_ICR, VAL_00, VAL_FF, VAL_1FF, VAL_3FF, VAL_FFFF
-};
-
 // Mask values for OCR/TCNT registers based on the VAL_XXX used as counter TOP.
 // When using a fixed counter TOP value with 16-bit timers, writes to the
 // OCR buffers and TCNT updates are masked against unused bits
@@ -121,6 +115,10 @@ END_INTERRUPTS
 // wraps due to the rules of modulo arithmetic.
 typedef unsigned int uint;
 
+// Returned by Ticks_to_event() if no timer tick can ever do anything more
+// than increment/decrement TCNTn with the current timer configuration.
+#define NO_EVENT ((uint) -1)
+
 #ifdef TIMER_2
 // Register IDs that need to be updated through a temporary register when
 // TIMER2 is in asynchronous mode. Must be listed in the same order as the
@@ -161,9 +159,6 @@ DECLARE_VAR
    int _Action_comp_B;     //    at OCR match. 
    int _Action_top_A;      // Set/Clear actions performs when counter reaches
    int _Action_top_B;      //    TOP in PWM mode
-   uint _Last_PSR;         // I/O clock cycle when last PSRSYNC/PSRASY occurred
-   uint _Last_disabled;    // I/O clock cycle when prescaler was disabled
-   uint _Total_disabled;   // Total prescaler clock cycles lost due to SLEEP
    BOOL _Compare_blocked;  // Writing TCNTn blocks output compare for one tick
    BOOL _TSM;              // Counter paused while TSM bit set in GTCCR
    int _Debug;             // To store debugging options
@@ -172,9 +167,18 @@ DECLARE_VAR
    uint _Async_interrupt;  // Bitflags of any interrupts from last async tick
    BOOL _OCA_toggle_ok;    // True if toggle on OCA pin allowed by waveform
    uint _WA_aim_io_cycles; // Work around old_io_cycles
+   BOOL _Ticking;          // True if Next_tick is valid (internal clock running)
+   uint _Next_tick;        // I/O clock cycle of next timer tick not yet counted
+   uint _Last_sync;        // I/O clock cycle up to which TCNTn is up to date
 #ifdef TIMER_2
    WORD8 _Tcnt_async;      // TCNT2 seens by MCU when TIMER2 in async mode
    uint _Async_ticks;      // Number of times Async_tick() has been called
+   BOOL _Async_ticking;    // True if 32.768kHz crystal ticks are scheduled
+   double _Async_base;     // Time of the last crystal tick from On_remind_me()
+   uint _Async_cycle;      // CPU cycle at or just before Async_base
+   double _Async_fraction; // Fraction of a CPU cycle from Async_cycle to tick
+   uint _Async_done;       // Crystal ticks since Async_base counted by Async_sync()
+   uint _Async_aim;        // Crystal tick after Async_base for next On_remind_me()
    Async_update_t _Async_update[5]; // Pending register updates in async TIMER2
 #endif
 #ifdef TIMER_N
@@ -184,6 +188,7 @@ DECLARE_VAR
    bool _ACIC_enabled;     // True if input capture using analog comparator
    LOGIC _ICP_last;        // Last logic value seen on input capture edge detector
 #endif
+   REGISTER_NAMES<_nOfRegisters> _Reg_names; // Cached names for reg()
 END_VAR
 #define Dirty VAR(_Dirty)                  // To simplify readability...
 #define Clock_source VAR(_Clock_source)
@@ -206,9 +211,6 @@ END_VAR
 #define Action_comp_B VAR(_Action_comp_B)
 #define Action_top_A  VAR(_Action_top_A)
 #define Action_top_B  VAR(_Action_top_B)
-#define Last_PSR VAR(_Last_PSR)
-#define Last_disabled VAR(_Last_disabled)
-#define Total_disabled VAR(_Total_disabled)
 #define Compare_blocked VAR(_Compare_blocked)
 #define TSM VAR(_TSM)
 #define Debug VAR(_Debug)
@@ -218,16 +220,39 @@ END_VAR
 #define Tcnt_async VAR(_Tcnt_async)
 #define Async_ticks VAR(_Async_ticks)
 #define Async_update VAR(_Async_update)
+#define Async_ticking VAR(_Async_ticking)
+#define Async_base VAR(_Async_base)
+#define Async_cycle VAR(_Async_cycle)
+#define Async_fraction VAR(_Async_fraction)
+#define Async_done VAR(_Async_done)
+#define Async_aim VAR(_Async_aim)
 #define OCA_toggle_ok VAR(_OCA_toggle_ok)
 #define ACIC_enabled VAR(_ACIC_enabled)
 #define ICP_last VAR(_ICP_last)
 #define WA_aim_io_cycles VAR(_WA_aim_io_cycles)
+#define Ticking VAR(_Ticking)
+#define Next_tick VAR(_Next_tick)
+#define Last_sync VAR(_Last_sync)
+#define Reg_names VAR(_Reg_names)
 
 // Constant WORD8 value with all bits unknown. Returned by On_register_read()
 // if the timer registers are accessed while the timer is disabled due to
 // PRR.
 WORD8 UNKNOWN8;
 
+// Binary trace file shared by all timer instances in this DLL
+Tracefile Trace;
+
+// Prescaler owned by the dummy component that clocks this timer, and the
+// function exported by the dummy component to read its phase. The function
+// is looked up once in On_simulation_begin() and shared by all instances.
+#ifdef TIMER_2
+#define PSR_TIMER PSR_ASY
+#else
+#define PSR_TIMER PSR_SYNC
+#endif
+PSR_CYCLE_FN Dummy_psr_cycle = NULL;
+
 // Some static tables for timer mode display
 const char *Clock_text[] = {
    "Stop", "Internal", "External (Fall)", "External (Rise)", "?", "32768Hz", "External"
@@ -238,16 +263,6 @@ const char *Action_text[] = {"Disconnected", "Toggle", "Clear", "Set", "Reserved
 
 USE_WINDOW(WINDOW_USER_1); // Window to display registers, etc. See .RC file
 
-// Coding and static tables for clock prescaling
-#ifdef TIMER_2
-const int Prescaler_table[] =  {0, 1, 8, 32, 64, 128, 256, 1024};
-const char *Prescaler_text[] = {"", "/ 1", "/ 8", "/ 32", "/ 64", "/ 128", "/ 256", "/ 1024" };
-
-#else
-const int Prescaler_table[] =  {0, 1, 8, 64, 256, 1024};
-const char *Prescaler_text[] = {"", "/ 1", "/ 8", "/ 64", "/ 256", "/ 1024" };
-#endif
-
 #ifdef TIMER_0
 REGISTERS_VIEW
 //           ID     .RC ID       b7        ...   bit names   ...             b0
@@ -296,7 +311,17 @@ END_VIEW
 
 void Go(uint);                  // Function prototypes
 void Count();                   //
+void Sync(uint);
+void Skip(uint);
+uint Ticks_to_event();
 void Async_tick();
+void Async_skip(uint);
+void Async_sync();
+void Async_go(double);
+double Async_since_base();
+uint Async_elapsed();
+uint Async_first_count();
+uint Async_ticks_to_event();
 void Async_change();
 void Async_sleep_check(int pMode);
 void Update_waveform();
@@ -307,7 +332,8 @@ void Log(const char *pFormat, ...);
 void Log_register_write(int pId, WORD8 pData, unsigned char pMask);
 int Value(int);
 uint Get_io_cycles(void);
-bool Is_disabled(BOOL pPRRWanted = TRUE);
+uint Get_psr_cycle();
+bool Is_disabled();
 void Update_register(REGISTER_ID, WORDSZ);
 void On_XCLK_edge(EDGE pEdge);
 void On_ICP_edge(EDGE pEdge);
@@ -329,15 +355,30 @@ void On_destroy()                         //     "        "
 
 void On_simulation_begin()                //     "        "
 {
+   TRACE_BEGIN(Trace, Reg_names);
+
+   // The prescaler phase is owned by the dummy component (see useravr.h)
+   if(Dummy_psr_cycle == NULL) {
+      HMODULE dummy = GetModuleHandle(PSR_CYCLE_DLL);
+      if(dummy) {
+         Dummy_psr_cycle = (PSR_CYCLE_FN) GetProcAddress(dummy,
+            PSR_CYCLE_EXPORT);
+      }
+      if(Dummy_psr_cycle == NULL) {
+         WARNING("Cannot read prescaler phase from " PSR_CYCLE_DLL,
+            CAT_TIMER, WARN_MISC);
+      }
+   }
+
    //TRACE(true);  // Uncomment for tracing
 }
 
 void On_simulation_end()
 //**********************
 {
-   FOREACH_REGISTER(j){
-      REG(j) = WORD8(0,0);      // All bits unknown (X)
-   }
+   TRACE_END(Trace);
+
+   FILL_REGISTERS(WORD8(0,0));      // All bits unknown (X)
 #ifdef TIMER_N
    TMP_buffer.x(0);
 #endif
@@ -351,6 +392,10 @@ void On_simulation_end()
    Prescaler_index = 0;
    Update_OCR = VAL_NONE;
    Async = ASY_NONE;
+   Ticking = false;
+#ifdef TIMER_2
+   Async_ticking = false;
+#endif
    Dirty = true;
 }
 
@@ -365,6 +410,10 @@ WORD8 *On_register_read(REGISTER_ID pId)
       WARNING("Register read while disabled by PRR", CAT_TIMER, WARN_MISC);
       return &UNKNOWN8;
    }
+
+   // Bring TCNTn (and any flags) up to date with the timer ticks that have
+   // elapsed since the last scheduled timer event.
+   Sync(Get_io_cycles());
    
    // If TIMER2 is in async mode, then reading TCNT2 returns the value from
    // a synchronization register. If TIMER2 is waking up from power-save mode
@@ -458,12 +507,18 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
       return;
    }
 
+   // Count any elapsed timer ticks before the register changes the timer
+   // state. Afterwards, if the timer is running, Go() reschedules the next
+   // timer event since the new register value may have moved it (e.g. new
+   // TCNTn or OCRnx value). Update_clock_source() calls Go() by itself.
+   Sync(Get_io_cycles());
+
 #ifdef TIMER_2
    if(Async) {
       for(int i = 0; i < countof(ASSR_UB); i++) {
          if(pId == ASSR_UB[i]) {
             Log("Write temporary asynchronous %s register: %s",
-               Assr_text[i], hex(pData));
+               Assr_text[i], hex(pData).text);
          
             if(REG(ASSR)[i] == 1) {
                WARNING("Asynchronous register update already pending",
@@ -485,6 +540,11 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
             Async_update[i].Value = pData;
             Async_update[i].Ticks = Async_ticks;
             
+            // Completing the update is a timer event that must be scheduled
+            if(Async_ticking) {
+               Async_go(Async_since_base());
+            }
+
             // Return so Update_register() is not called
             return;
          }
@@ -493,6 +553,14 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
 #endif
    
    Update_register(pId, pData);
+   if(Ticking) {
+      Go(Get_io_cycles());
+   }
+#ifdef TIMER_2
+   if(Async_ticking) {
+      Async_go(Async_since_base());
+   }
+#endif
 }
 
 void Update_register(REGISTER_ID pId, WORDSZ pData)
@@ -638,7 +706,7 @@ void Update_register(REGISTER_ID pId, WORDSZ pData)
 
           // Check if asynchronous mode is enabled or disabled in ASSR
           int oldAsync = Async;
-          switch(REG(ASSR).get_field(6, 5)) {
+          switch(REG(ASSR).field<6, 5>()) {
              case 1: Async = ASY_32K; break;   // EXCLK=0 AS2=1
              case 3: Async = ASY_EXT; break;   // EXCLK=1 AS2=2
              default: Async = ASY_NONE; break; // AS2=0 or EXCLK/AS2 unknown
@@ -693,20 +761,21 @@ void Update_register(REGISTER_ID pId, WORDSZ pData)
 
 void On_remind_me(double pTime, int pAux)
 //**************************************
-// Response to REMIND_ME2() used implement the internal
-// prescaled clock tick or an asynchronous 32.768kHz clock
-// crystal (before prescaling). The pAux parameter holds a
-// signature value used to void pending ticks in case of
-// prescaler reset or clock source changes.
+// Response to REMIND_ME2() used implement the next timer event on the
+// internal prescaled clock or to REMIND_ME() used to implement the next
+// timer event on an asynchronous 32.768kHz clock crystal (before
+// prescaling). The pAux parameter holds a signature value used to void
+// pending ticks in case of prescaler reset or clock source changes.
 {
    if(Tick_signature != pAux)        // If need to void a pending tick
       return;
    if(Is_disabled())                 // If disabled by SLEEP, PPR, etc
       return;
 
-   // If using internal clock source, increment counter and launch next tick
+   // If using internal clock source, count all the timer ticks up to and
+   // including the one with the timer event and launch the next event
    if(Clock_source == CLK_INTERNAL) {
-      if(TSM && Timer_period != 1)   // TSM holds prescaler not direct clock
+      if(!Ticking)                   // If Go() did not start ticks (TSM)
          return;
 
       // TODO: There is a problem with GET_MICRO_INFO(INFO_CPU_CYCLES) getting
@@ -717,16 +786,35 @@ void On_remind_me(double pTime, int pAux)
       // contains the cycle time at which we EXPECT On_remind_me() to run. In
       // all other instances where Go() is called, we pass Get_io_cycles()
       // instead.
-      Count();      
+      Sync(WA_aim_io_cycles);
       Go(WA_aim_io_cycles);
    }
    
-   // If using asynchronous 32kHz XTAL, always increment prescaler and schedule
-   // next oscillator tick. Async_tick() takes care of incrementing the counter.
+   // If using asynchronous 32kHz XTAL, count all the oscillator ticks before
+   // the one with the timer event, let Async_tick() handle the event itself,
+   // and schedule the next event. The oscillator tick that just happened
+   // becomes the new reference point for Async_elapsed(). Because of the
+   // INFO_CPU_CYCLES problem described above, the CPU cycle of that tick is
+   // derived from pTime rather than read here. Otherwise every event would
+   // move the crystal timeline by the cycles still left in an instruction.
 #ifdef TIMER_2
    else if(Async == ASY_32K) {
-      REMIND_ME(PERIOD_32K, ++Tick_signature);
+      if(!Async_ticking)
+         return;
+      Async_skip(Async_aim - 1 - Async_done);
+
+      // The time at which Async_change() started the oscillator is not known,
+      // but it was exactly Async_aim crystal periods before this tick
+      double elapsed = Async_base < 0 ? Async_aim * PERIOD_32K :
+         pTime - Async_base;
+      double cycles = Async_fraction + elapsed * GET_CLOCK();
+      Async_cycle += (uint) cycles;
+      Async_fraction = cycles - (uint) cycles;
+      Async_base = pTime;
+
+      Async_done = 0;
       Async_tick();
+      Async_go(0);
    }
 #endif
 }
@@ -757,6 +845,8 @@ void On_ICP_edge(LOGIC pState)
 //*****************************************************
 // Handle input capture
 {   
+   Sync(Get_io_cycles());
+
    // Using ICR as TOP value disables input capture. Only trigger input capture
    // if the new input state is different from previous. This is needed because
    // (a) the comparator could send a double notify for the same state (once
@@ -807,12 +897,10 @@ void On_XCLK_edge(EDGE pEdge)
 
 void On_reset(int pCause)
 //***********************
-// Initialize registers to the desired value. Use the FOREACH macro for
-// a general initialization
+// Initialize registers to the desired value. FILL_REGISTERS() clears all of
+// them at once before the timer state is reset.
 {
-   FOREACH_REGISTER(j) {
-      REG(j)= 0;
-   }
+   FILL_REGISTERS(0);
    OCRA_buffer = 0;
    OCRB_buffer = 0;
    PRR = false;
@@ -845,24 +933,30 @@ void On_reset(int pCause)
 #ifdef TIMER_2
    TAKEOVER_PORT(XCLK, false);  // Release TOSC1 pins in case async mode used
 #endif
-   Last_PSR = 0;
-   Last_disabled = 0;
-   Total_disabled = 0;
+   Ticking = false;
    Compare_blocked = true; // Prevent compare match immediately after reset 
    TSM = false;
    Async = ASY_NONE;
    Async_prescaler = 0;
    Async_interrupt = 0;
+#ifdef TIMER_2
+   Async_ticking = false;
+#endif
    Dirty = true;
 }
 
 void On_notify(int pWhat)
 //**********************
 // Notification coming from some other DLL instance. Used here to
-// handle the PRR register and prescaler reset (coming from dummy component)
+// handle the PRR register, prescaler reset and prescaler phase after SLEEP
+// (coming from dummy component)
 {
    int wasDisabled;
 
+   // Count any elapsed timer ticks before the prescaler or the enabled state
+   // changes. Each case below calls Go() to reschedule the next timer event.
+   Sync(Get_io_cycles());
+
    switch(pWhat) {
       case NTF_PRR0:                 // A 0 set in PPR register bit for TIMER
          wasDisabled = Is_disabled();
@@ -888,12 +982,15 @@ void On_notify(int pWhat)
          Log("Started TSM");
          TSM = true;
          Dirty = true;
+         if(Ticking) {
+            Go(Get_io_cycles());
+         }
          break;
 
       case NTF_PSR:                  // Prescaler reset.
-         // Record elapsed I/O clock cycles to simulate the reset and ensure all
-         // timers sharing the same prescaler stay synchronized
-         Last_PSR = Get_io_cycles();
+         // The dummy component has already reset the phase returned by
+         // Get_psr_cycle() and notifies all timers sharing the prescaler at
+         // once. Only the explicit asynchronous prescaler is kept here.
          Async_prescaler = 0;
 #ifdef TIMER_2
          Log("Prescaler reset by PSRASY");
@@ -929,9 +1026,20 @@ void On_notify(int pWhat)
          On_ICP_edge(GET_LOGIC(ICP));
          break;
 #endif      
-      default:
+      case NTF_PHASE:
+         // The prescaler, which is shared with other timers and stopped in
+         // some SLEEP modes, is running again. The dummy component has
+         // restored its phase, so only the next timer event has to move.
+         Go(Get_io_cycles());
          break;
    }
+
+#ifdef TIMER_2
+   // A prescaler reset or TSM changes which oscillator tick increments TCNT2
+   if(Async_ticking) {
+      Async_go(Async_since_base());
+   }
+#endif
 }
 
 void On_sleep(int pMode)
@@ -941,6 +1049,8 @@ void On_sleep(int pMode)
 {
    int wasDisabled = Is_disabled();
 
+   Sync(Get_io_cycles());
+
 #ifdef TIMER_2
    // Warn if any 2UB bits in ASSR are set (updates pending) and TIMER2 is
    // entering a non IDLE sleep. The updates are not lost but they will not
@@ -948,7 +1058,7 @@ void On_sleep(int pMode)
    // entering power-save or ADC noice reduction mode where TIMER2 continues
    // to run in async mode.
    if(Sleep_mode == SLEEP_EXIT && pMode != SLEEP_IDLE) {
-      if(REG(ASSR).get_field(4, 0) > 0) {
+      if(REG(ASSR).field<4, 0>() > 0) {
          WARNING("Entering SLEEP with pending updates to asynchronous registers",
             CAT_TIMER, WARN_PARAM_BUSY);
       }
@@ -979,6 +1089,13 @@ void On_sleep(int pMode)
       Dirty = true;
       Go(Get_io_cycles());
    }
+
+#ifdef TIMER_2
+   // Pending asynchronous register updates are held during some sleep modes
+   if(Async_ticking) {
+      Async_go(Async_since_base());
+   }
+#endif
 }
 
 void On_gadget_notify(GADGET pGadget, int pCode)
@@ -1060,6 +1177,141 @@ void Async_tick()
    }
 }
 
+void Async_skip(uint pTicks)
+//*****************************************
+// Handle pTicks 32.768kHz oscillator ticks at once, none of which is a timer
+// event as computed by Async_ticks_to_event(). This has the same effect on
+// the timer as calling Async_tick() pTicks times.
+{
+   if(!pTicks)
+      return;
+
+   // None of these ticks completes a pending asynchronous register update
+   Async_ticks += pTicks;
+
+   // TSM stops prescaled clock but a direct clock will still tick the timer
+   if(TSM && Timer_period != 1)
+      return;
+
+   // Count how many of these ticks reach the prescaler divisor
+   if(Timer_period) {
+      uint first = Async_first_count();
+      if(pTicks >= first) {
+         Skip((pTicks - first) / Timer_period + 1);
+      }
+   }
+   
+   if(!TSM)
+      Async_prescaler += pTicks;
+      
+   if(Sleep_mode != SLEEP_POWERSAVE) {
+      Tcnt_async = REG(TCNTn);
+   }
+}
+
+void Async_sync()
+//*****************************************
+// Count all 32.768kHz oscillator ticks that occured since the last one
+// counted, based on the elapsed CPU time. Called from Sync() so TCNT2 and
+// the prescaler appear to have been updated on every oscillator tick.
+// The tick with the next timer event is always left for On_remind_me().
+{
+   if(!Async_ticking)
+      return;
+
+   uint elapsed = Async_elapsed();
+   if(elapsed >= Async_aim) {
+      elapsed = Async_aim - 1;
+   }
+   if(elapsed > Async_done) {
+      Async_skip(elapsed - Async_done);
+      Async_done = elapsed;
+   }
+}
+
+void Async_go(double pElapsed)
+//*****************************************
+// Schedule the 32.768kHz oscillator tick with the next timer event. Called
+// from On_remind_me() after each event and each time a register write,
+// notification, or sleep mode change could have moved the next event. The
+// pElapsed argument is the time since Async_base; On_remind_me() passes 0
+// and all other callers pass Async_since_base(). The Tick_signature is
+// updated each time to cancel any already pending event.
+{
+   ++Tick_signature;
+   Async_aim = Async_done + Async_ticks_to_event() + 1;
+
+   double delay = Async_aim * PERIOD_32K - pElapsed;
+   REMIND_ME(delay > 0 ? delay : 0, Tick_signature);
+}
+
+double Async_since_base()
+//*****************************************
+// Return the time in seconds since the last 32.768kHz oscillator tick handled
+// by On_remind_me() (or since Async_change()), as computed from the CPU cycle
+// count and CPU clock. Must not be relied on inside On_remind_me(), where the
+// CPU cycle count may lag behind; the result is never negative.
+{
+   int whole = (int) ((uint) GET_MICRO_INFO(INFO_CPU_CYCLES) - Async_cycle);
+   double cycles = whole - Async_fraction;
+   return cycles > 0 ? cycles / GET_CLOCK() : 0;
+}
+
+uint Async_elapsed()
+//*****************************************
+// Return the number of whole 32.768kHz oscillator periods that have elapsed
+// since Async_base, as computed from the CPU cycle count and CPU clock.
+{
+   return (uint) (Async_since_base() / PERIOD_32K);
+}
+
+uint Async_first_count()
+//*****************************************
+// Return how many 32.768kHz oscillator ticks, including the one on which
+// the timer increments, until Async_tick() next calls Count(). Only valid if
+// the timer clock is not stopped.
+{
+   if(TSM)
+      return 1; // Prescaler is held, direct clock ticks timer every time
+
+   uint ticks = (Timer_period - (Async_prescaler + 1) % Timer_period) %
+      Timer_period;
+   return ticks ? ticks : Timer_period;
+}
+
+uint Async_ticks_to_event()
+//*****************************************
+// Return the number of 32.768kHz oscillator ticks, starting with the next one,
+// that Async_tick() would handle by only incrementing the prescaler and
+// TCNT2. The tick after that either completes a pending asynchronous register
+// update or calls Count() on a timer event (see Ticks_to_event()). The
+// result is limited to MAX_32K_TICKS - 1.
+{
+   uint ticks = MAX_32K_TICKS - 1;
+
+   // Register updates complete after 2 ticks but are held in some sleep modes
+   if(Sleep_mode == SLEEP_EXIT || Sleep_mode == SLEEP_IDLE) {
+      for(int i = 0; i < countof(ASSR_UB); i++) {
+         if(REG(ASSR)[i] == 1) {
+            uint wait = Async_ticks - Async_update[i].Ticks >= 1 ? 0 : 1;
+            if(wait < ticks)
+               ticks = wait;
+         }
+      }
+   }
+
+   if(Timer_period && !(TSM && Timer_period != 1)) {
+      uint counts = Ticks_to_event();
+      if(counts < ticks) {
+         uint wait = Async_first_count() - 1 + counts * Timer_period;
+         if(wait < ticks)
+            ticks = wait;
+      }
+   }
+   
+   return ticks;
+}
+
 void Async_change()
 //*****************************************
 // Called when TIMER2 is switching to/from asynchronous mode or when TIMER2
@@ -1082,16 +1334,22 @@ void Async_change()
 
    // If leaving async mode (AS2=0) then cancel any pending asynchronous
    // register updates and clear 2UB bits.
-   if(Async == ASY_NONE && REG(ASSR).get_field(4, 0) > 0) {
+   if(Async == ASY_NONE && REG(ASSR).field<4, 0>() > 0) {
       WARNING("Pending updates to asynchronous registers lost",
          CAT_TIMER, WARN_PARAM_BUSY);
       REG(ASSR) = REG(ASSR) & 0x60;
    }
                 
-   // If the 32.768kHz crystal oscillator was (re)enabled then schedule
-   // the first oscillator tick with REMIND_ME()
+   // If the 32.768kHz crystal oscillator was (re)enabled then the first
+   // oscillator tick happens one period from now. Async_go() schedules the
+   // first timer event with REMIND_ME().
    if(Async == ASY_32K && !Is_disabled()) {
-      REMIND_ME(PERIOD_32K, ++Tick_signature);
+      Async_ticking = true;
+      Async_base = -1; // Not known until the first On_remind_me()
+      Async_cycle = (uint) GET_MICRO_INFO(INFO_CPU_CYCLES);
+      Async_fraction = 0;
+      Async_done = 0;
+      Async_go(0);
       // TODO: Warn about waiting 1 sec for 32K oscillator to stabilize
    }
 
@@ -1100,6 +1358,7 @@ void Async_change()
    // clock signal on TOSC1. Update Tick_signature to cancel any 32.768kHz
    // oscillator ticks that may be pending.
    else {
+      Async_ticking = false;
       ++Tick_signature;
    }
 
@@ -1149,43 +1408,181 @@ void Async_sleep_check(int pMode)
 
 void Go(uint pCurrentCycles)
 //******
-// Schedule the next timer tick if the counter is not disabled and using the
-// internal clock source. Called on every timer tick, each time the counter
-// is re-enabled, and each time the clock source changes. The Tick_signature
-// is updated each time to cancel any already pending ticks which may no longer
-// be valid. For TIMER2 in 32kHz asynchronous mode, this function never
-// schedules timer ticks.
+// Schedule the next timer event if the counter is not disabled and using the
+// internal clock source. Rather than scheduling every prescaled timer tick,
+// only the tick on which Count() has to do more than increment/decrement TCNTn
+// (see Ticks_to_event()) is scheduled; the ticks in between are counted by
+// Sync(). Called on every timer event, after register writes while the timer
+// is running, each time the counter is re-enabled, and each time the clock
+// source changes. The Tick_signature is updated each time to cancel any
+// already pending events which may no longer be valid. For TIMER2 in 32kHz
+// asynchronous mode, this function never schedules timer ticks.
 // TODO: Once GET_MICRO_INFO(INFO_CPU_CYCLES) works correctly when called from
 // inside On_remind_me(), the Go() function should always use Get_io_cycles()
 // and use pCurrentCycles
 {
-   if(Is_disabled(false)) {
-      // Track when prescaler clock first became disabled due to sleep mode
-      // but not due to PRR (which only stops timer clock and not prescaler)
-      if(!Last_disabled)
-         //Last_disabled = Get_io_cycles();
-         Last_disabled = pCurrentCycles;
-      return;
-   }
-   
-   // If the prescaler clock was re-enabled, compute how long it was disabled for
-   if(Last_disabled) {
-      Total_disabled = (uint) GET_MICRO_INFO(INFO_CPU_CYCLES) - Last_disabled;
-      Last_disabled = 0;
+   // Never schedule ticks before the point that Sync() already counted up to.
+   // This can happen if a register was accessed after an event's scheduled
+   // cycle but before its On_remind_me(), or due to the WA_aim_io_cycles
+   // workaround described in On_remind_me().
+   if(Ticking && (int) (pCurrentCycles - Last_sync) < 0) {
+      pCurrentCycles = Last_sync;
    }
+   Ticking = false;
 
    if(Is_disabled()) {
-      return; // Don't schedule ticks if timer itself is still disabled by PRR
+      return; // Don't schedule ticks if disabled by SLEEP or PRR
    }
    
    if(Clock_source == CLK_INTERNAL) {
       if(TSM && Timer_period != 1) // TSM only holds prescaler not direct clock
          return;
-      //uint cycles = Get_io_cycles() - Last_PSR;
-      uint cycles = pCurrentCycles - Last_PSR;
-      //WA_aim_io_cycles = Get_io_cycles() + Timer_period - (cycles % Timer_period);
-      WA_aim_io_cycles = pCurrentCycles + Timer_period - (cycles % Timer_period);
-      REMIND_ME2(Timer_period - (cycles % Timer_period), ++Tick_signature);      
+      uint cycles = pCurrentCycles - Get_psr_cycle();
+      Next_tick = pCurrentCycles + Timer_period - (cycles % Timer_period);
+      Last_sync = pCurrentCycles;
+      Ticking = true;
+
+      // Void any pending event. If no tick will ever do more than change
+      // TCNTn then Sync() alone keeps the counter up to date and no event
+      // is needed until a register write or notification calls Go() again.
+      ++Tick_signature;
+      uint ticks = Ticks_to_event();
+      if(ticks != NO_EVENT) {
+         WA_aim_io_cycles = Next_tick + ticks * Timer_period;
+         REMIND_ME2(WA_aim_io_cycles - pCurrentCycles, Tick_signature);
+      }
+   }
+}
+
+void Sync(uint pCurrentCycles)
+//******
+// Count all timer ticks from the internal clock source that occured up to and
+// including the I/O clock cycle pCurrentCycles. Called before any timer state
+// is accessed or modified so that TCNTn appears to have been incremented on
+// every prescaled tick. Ticks that cannot cause any timer event are counted
+// all at once by Skip(), while Count() handles the remaining ticks one at a
+// time. Since Go() has scheduled an On_remind_me() for the first such event,
+// Count() usually runs here only from On_remind_me(). For TIMER2 in 32kHz
+// asynchronous mode, Async_sync() counts the elapsed oscillator ticks instead.
+{
+#ifdef TIMER_2
+   Async_sync();
+#endif
+
+   if(!Ticking)
+      return;
+   if((int) (pCurrentCycles - Last_sync) > 0)
+      Last_sync = pCurrentCycles;
+   if((int) (pCurrentCycles - Next_tick) < 0)
+      return;
+
+   uint total = (pCurrentCycles - Next_tick) / Timer_period + 1;
+   Next_tick += total * Timer_period;
+
+   while(total) {
+      uint ticks = Ticks_to_event();
+      if(ticks >= total) {
+         Skip(total);
+         break;
+      }
+      Skip(ticks);
+      Count();
+      total -= ticks + 1;
+   }
+}
+
+void Event_distance(uint &pTicks, uint pCount, int pValue)
+//******
+// Helper for Ticks_to_event(). If the counter (currently at pCount) will reach
+// pValue in fewer than pTicks timer ticks, then update pTicks to that number.
+// When counting up, TCNTn wraps around through the MASK[] of the TOP value
+// (or the register size for 8-bit timers) just like in Count(). When counting
+// down, TCNTn never goes below BOTTOM. If TCNTn is above the mask (e.g. after
+// a switch to a lower fixed TOP), let Count() itself wrap it on the next tick.
+{
+   uint mask = MASK[Top] & WORDSZ::MASK;
+   
+   if(pValue < 0 || (uint) pValue > mask)
+      return;
+
+   uint ticks;
+   if(pCount > mask) {
+      ticks = 0;
+   } else if(Counting_up) {
+      ticks = ((uint) pValue - pCount) & mask;
+   } else if((uint) pValue <= pCount) {
+      ticks = pCount - pValue;
+   } else {
+      return;
+   }
+   
+   if(ticks < pTicks)
+      pTicks = ticks;
+}
+
+uint Ticks_to_event()
+//******
+// Return the number of timer ticks, starting with the next one, that Count()
+// would handle by only incrementing or decrementing TCNTn. The tick after that
+// is the next timer event where TCNTn equals one of the values that Count()
+// checks for (BOTTOM, TOP, overflow, OCRnx match, double-buffer update) and
+// must be handled by Count() itself. Returns NO_EVENT if no tick will ever
+// be an event (e.g. TCNTn has unknown bits so no comparison can match).
+{
+   if(Waveform == WAVE_RESERVED || Waveform == WAVE_UNKNOWN)
+      return NO_EVENT;
+   if(!REGHL(TCNTn).known())
+      return NO_EVENT;
+
+   // The tick after a TCNTn write clears Compare_blocked
+   if(Compare_blocked)
+      return 0;
+
+   uint count = REGHL(TCNTn).d();
+   uint ticks = NO_EVENT;
+
+   Event_distance(ticks, count, Value(Overflow));
+   Event_distance(ticks, count, Value(Top));
+   if(IS_WAVE_DUAL_SLOPE() || !Counting_up) {
+      Event_distance(ticks, count, 0);
+   }
+   if(Update_OCR) {
+      Event_distance(ticks, count, Value(Update_OCR));
+   }
+   if(REGHL(OCRnA).known()) {
+      Event_distance(ticks, count, REGHL(OCRnA).d());
+   }
+   if(REGHL(OCRnB).known()) {
+      Event_distance(ticks, count, REGHL(OCRnB).d());
+   }
+#ifdef TIMER_N
+   if(Top == VAL_ICR && REGHL(ICRn).known()) {
+      Event_distance(ticks, count, REGHL(ICRn).d());
+   }
+#endif
+
+   return ticks;
+}
+
+void Skip(uint pTicks)
+//******
+// Handle pTicks timer ticks at once, none of which is a timer event as
+// computed by Ticks_to_event(). This has the same effect on the timer as
+// calling Count() pTicks times.
+{
+   if(!pTicks)
+      return;
+
+   Async_interrupt = 0;
+   if(Waveform == WAVE_RESERVED || Waveform == WAVE_UNKNOWN)
+      return;
+
+   Compare_blocked = false;
+   
+   if(Counting_up) {
+      REGHL(TCNTn).d( (REGHL(TCNTn).d() + pTicks) & MASK[Top] );
+   } else if(REGHL(TCNTn) != 0) {
+      REGHL(TCNTn).d( REGHL(TCNTn).d() - pTicks );
    }
 }
 
@@ -1264,7 +1661,7 @@ void Count()
    // In TIMER2 async mode output compare match is disabled if TCNT/OCRx
    // updates are pending in ASSR
 #ifdef TIMER_2
-   if(REG(ASSR).get_field(4, 2) <= 0)
+   if(REG(ASSR).field<4, 2>() <= 0)
 #endif
    {
       // Update output pins if a compare output match occurs. A CPU write to
@@ -1303,10 +1700,10 @@ void Count()
    if(Update_OCR) {                         
       if(REGHL(TCNTn) == Value(Update_OCR)) {
          if(REGHL(OCRnA) != (OCRA_buffer & MASK[Top])) {
-            Log("Updating double buffered register OCRnA: %s", hex(OCRA_buffer));
+            Log("Updating double buffered register OCRnA: %s", hex(OCRA_buffer).text);
          }
          if(REGHL(OCRnB) != (OCRB_buffer & MASK[Top])) {
-            Log("Updating double buffered register OCRnB: %s", hex(OCRB_buffer));
+            Log("Updating double buffered register OCRnB: %s", hex(OCRB_buffer).text);
          }
          REGHL(OCRnA) = OCRA_buffer & MASK[Top];
          REGHL(OCRnB) = OCRB_buffer & MASK[Top];
@@ -1322,175 +1719,34 @@ void Count()
    }
 }
 
-#ifdef TIMER_N
-
 void Update_waveform()
 //********************
-// 16-bit Timers (TIMER1, TIMER3, etc.):
-// Determine the waveform mode according to bits WGMxx located in TCCRnB TCCRnA
+// Determine the waveform mode according to bits WGMxx located in TCCRnB and
+// TCCRnA. The combined bits are decoded with a single Wave_table[] lookup.
 {
-   int waveCode1 = REG(TCCRnA).get_field(1, 0);  // Bits 1, 0 of TCCRnA
-   int waveCode2 = REG(TCCRnB).get_field(4, 3);  // Bit 4, 3 of TCCRnB
-   int fullWaveCode = -1;                        // Initialize to unknown
-   if(waveCode1 >= 0 && waveCode2 >= 0)
-      fullWaveCode = waveCode2 * 4 + waveCode1;  // Combine both register's bits
-
-   int newWaveform = WAVE_UNKNOWN;
-   Top = VAL_NONE;
-   Update_OCR = VAL_NONE;
-   OCA_toggle_ok = false;
-   
-   switch(fullWaveCode) {       // Apply AVR manual Table 15-4
-
-      case 0: // Normal timer mode (TOP=0xFFFF / 16-bit) 
-         newWaveform = WAVE_NORMAL; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_FFFF; Update_OCR = VAL_NONE; Overflow = VAL_FFFF;
-         break;
-
-      case 1: // PWM phase correct (TOP=0xFF / 8-bit)
-         newWaveform = WAVE_PWM_PC;
-         Top = VAL_FF; Update_OCR = VAL_FF; Overflow = VAL_00;
-         break;
-
-      case 2: // PWM phase correct (TOP=0x1FF / 9-bit)
-         newWaveform = WAVE_PWM_PC;
-         Top = VAL_1FF; Update_OCR = VAL_1FF; Overflow = VAL_00;
-         break;
-
-      case 3: // PWM phase correct (TOP=0x3FF / 10-bit)
-         newWaveform = WAVE_PWM_PC;
-         Top = VAL_3FF; Update_OCR = VAL_3FF; Overflow = VAL_00;
-         break;
-
-      case 4: // CTC (TOP=OCRA)
-         newWaveform = WAVE_CTC; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_NONE; Overflow = VAL_FFFF;
-         break;
-
-      case 5: // Fast PWM (TOP=0xFF / 8-bit)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true;
-         Top = VAL_FF; Update_OCR = VAL_00; Overflow = VAL_FF;
-         break;
-
-      case 6: // Fast PWM (TOP=0x1FF / 9-bit)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true;
-         Top = VAL_1FF; Update_OCR = VAL_00; Overflow = VAL_1FF;
-         break;
-
-      case 7: // Fast PWM (TOP=0x3FF / 10-bit)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true;
-         Top = VAL_3FF; Update_OCR = VAL_00; Overflow = VAL_3FF;
-         break;
-
-      case 8: // PWM phase and frequency correct (TOP=ICR)
-         newWaveform = WAVE_PWM_PFC;
-         Top = VAL_ICR; Update_OCR = VAL_00; Overflow = VAL_00;
-         break;
-
-      case 9: // PWM phase and frequency correct (TOP=OCRA)
-         newWaveform = WAVE_PWM_PFC; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_00; Overflow = VAL_00;
-         break;
-
-      case 10: // PWM phase correct (TOP=ICR)
-         newWaveform = WAVE_PWM_PC;
-         Top = VAL_ICR; Update_OCR = VAL_ICR; Overflow = VAL_00;
-         break;
-
-      case 11: // PWM phase correct (TOP=OCRA)
-         newWaveform = WAVE_PWM_PC; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_OCRA; Overflow = VAL_00;
-         break;
-
-      case 12: // CTC (TOP=ICR)
-         newWaveform = WAVE_CTC; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_ICR; Update_OCR = VAL_NONE; Overflow = VAL_FFFF;
-         break;
-
-      case 13: // Reserved
-         newWaveform = WAVE_RESERVED;
-         Top = VAL_NONE; Update_OCR = VAL_NONE; Overflow = VAL_NONE;
-         break;
-         
-      case 14: // Fast PWM (TOP=ICR)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_ICR; Update_OCR = VAL_00; Overflow = VAL_ICR;
-         break;
-
-      case 15: // Fast PWM (TOP=OCRA)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_00; Overflow = VAL_OCRA;
-         break;
-   }
-
-   if(newWaveform != Waveform) {
-      Waveform = newWaveform;
-      Log("Updating waveform: %s (TOP=%s)", Wave_text[Waveform], Top_text[Top]);
-#if 0
-      // TODO: This warning scheduled for removal. It's not really an error and
-      // it could cause false positives just like the TCNT=0 warning
-      if(Clock_source != CLK_STOP) // TODO: Don't issue warning if in TSM mode
-      	WARNING("Changing waveform while the timer is running", CAT_TIMER, WARN_PARAM_BUSY);
+   int waveCode1 = REG(TCCRnA).field<1, 0>();  // Bits 1, 0 of TCCRnA
+#ifdef TIMER_N
+   int waveCode2 = REG(TCCRnB).field<4, 3>();  // Bit 4, 3 of TCCRnB
+#else
+   int waveCode2 = REG(TCCRnB).field<3, 3>();  // Bit 3 of TCCRnB
 #endif
-      if(Waveform == WAVE_RESERVED)
-         WARNING("Reserved waveform mode", CAT_TIMER, WARN_PARAM_RESERVED);
-   }
-}
-
-#else // #ifdef TIMER_N
-
-void Update_waveform()
-//********************
-// 8-bit Timers (TIMER0, TIMER2):
-// Determine the waveform mode according to bits WGMxx located in TCCRnB TCCRnA
-{
-   int waveCode1 = REG(TCCRnA).get_field(1, 0);  // Bits 1, 0 of TCCRnA
-   int waveCode2 = REG(TCCRnB).get_field(3, 3);  // Bit 3 of TCCRnB
-   int fullWaveCode = -1;                        // Initialize to unknown
-   if(waveCode1 >= 0 && waveCode2 >= 0)
-      fullWaveCode = waveCode2 * 4 + waveCode1;  // Combine both register's bits
 
    int newWaveform = WAVE_UNKNOWN;
    Top = VAL_NONE;
    Update_OCR = VAL_NONE;
    OCA_toggle_ok = false;
-   
-   switch(fullWaveCode) {       // Apply AVR manual (table #51)
-
-      case 0: // Normal timer mode (TOP=0xFF)
-         newWaveform = WAVE_NORMAL; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_FF; Update_OCR = VAL_NONE; Overflow = VAL_FF;
-         break;
-
-      case 1: // PWM phase correct (TOP=0xFF)
-         newWaveform = WAVE_PWM_PC;
-         Top = VAL_FF; Update_OCR = VAL_FF; Overflow = VAL_00;
-         break;
-
-      case 2: // CTC (TOP=OCRA)
-         newWaveform = WAVE_CTC; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_NONE; Overflow = VAL_FF;
-         break;
-
-      case 3: // Fast PWM (TOP=0xFF)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true;
-         Top = VAL_FF; Update_OCR = VAL_00; Overflow = VAL_FF;
-         break;
-
-      case 5: // PWM phase correct (TOP=OCRA)
-         newWaveform = WAVE_PWM_PC; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_OCRA; Overflow = VAL_00;
-         break;
-
-      case 7: // Fast PWM (TOP=OCRA)
-         newWaveform = WAVE_PWM_FAST; Counting_up = true; OCA_toggle_ok = true;
-         Top = VAL_OCRA; Update_OCR = VAL_00; Overflow = VAL_OCRA;
-         break;
 
-      case 4: case 6:   // Reserved
-         newWaveform = WAVE_RESERVED; OCA_toggle_ok = true;
-         Top = VAL_NONE; Update_OCR = VAL_NONE; Overflow = VAL_NONE;
-         break;
+   // If any WGM bit unknown, leave Overflow and counting direction unchanged
+   if(waveCode1 >= 0 && waveCode2 >= 0) {
+      const WAVE_MODE &mode = Wave_table[waveCode2 * 4 + waveCode1];
+      newWaveform = mode.waveform;
+      Top = mode.top;
+      Update_OCR = mode.updateOcr;
+      Overflow = mode.overflow;
+      OCA_toggle_ok = mode.toggleOk;
+      if(mode.countUp) {
+         Counting_up = true;
+      }
    }
 
    if(newWaveform != Waveform) {
@@ -1506,7 +1762,6 @@ void Update_waveform()
          WARNING("Reserved waveform mode", CAT_TIMER, WARN_PARAM_RESERVED);
    }
 }
-#endif // #ifdef TIMER_N
 
 void Update_compare_actions()
 // **************************
@@ -1518,51 +1773,21 @@ void Update_compare_actions()
 
    Action_comp_A = ACT_NONE;  // Compare A
    Action_top_A = ACT_NONE;
-   int compCode = REG(TCCRnA).get_field(7, 6); // Bits 7, 6  COM0A1, COM0A0
-   switch(compCode) {
-      case 1:                               // Toggle
-         if(OCA_toggle_ok) {
-            Action_comp_A = ACT_TOGGLE;
-         } else {
-            Action_comp_A = ACT_NONE;
-         }
-         break;
-         
-      case 2:                               // Clear port
-         Action_comp_A = ACT_CLEAR;
-         Action_top_A = ACT_CLEAR;
-         break;
-         
-      case 3:                               // Set port
-         Action_comp_A = ACT_SET;
-         Action_top_A = ACT_SET;
-         break;
+   int compCode = REG(TCCRnA).field<7, 6>(); // Bits 7, 6  COM0A1, COM0A0
+   if(compCode >= 0) {
+      const COMPARE_MODE &mode = Compare_A_table[OCA_toggle_ok][compCode];
+      Action_comp_A = mode.comp;
+      Action_top_A = mode.top;
    }
 
    Action_comp_B = ACT_NONE;  // Compare B; some small different behaviour
    Action_top_B = ACT_NONE;
-   compCode = REG(TCCRnA).get_field(5, 4); // Bits 5, 4  COM0B1, COM0B0
-   switch(compCode) {
-      case 1:                               // Toggle
-         Action_comp_B = ACT_TOGGLE;
-         if(Waveform == WAVE_PWM_FAST || IS_WAVE_DUAL_SLOPE()) {
-#ifdef TIMER_N
-            Action_comp_B = ACT_NONE;          // Tables 15-2, 15-3 manual         
-#else
-            Action_comp_B = ACT_RESERVED;      // Tables #49/50 manual
-#endif
-         }
-         break;
-         
-      case 2:                               // Clear port
-         Action_comp_B = ACT_CLEAR;
-         Action_top_B = ACT_CLEAR;
-         break;
-         
-      case 3:                               // Set port
-         Action_comp_B = ACT_SET;
-         Action_top_B = ACT_SET;
-         break;
+   compCode = REG(TCCRnA).field<5, 4>(); // Bits 5, 4  COM0B1, COM0B0
+   if(compCode >= 0) {
+      bool pwm = Waveform == WAVE_PWM_FAST || IS_WAVE_DUAL_SLOPE();
+      const COMPARE_MODE &mode = Compare_B_table[pwm][compCode];
+      Action_comp_B = mode.comp;
+      Action_top_B = mode.top;
    }
    if(Action_comp_B == ACT_RESERVED) {
       WARNING("Reserved combination of COM0Bx bits", CAT_TIMER, WARN_PARAM_RESERVED);
@@ -1596,39 +1821,23 @@ void Update_clock_source()
    int newClockSource;
    int newPrescIndex = 0;
 
-   int clkBits = REG(TCCRnB).get_field(2, 0);   // CSx bits field 2 - 0
-   switch(clkBits) {
-   	case 0:                            // Stopped
-      	newClockSource = CLK_STOP;
-         break;
-
-#ifndef TIMER_2
-      case 6:                            // External clock, falling edge
-      	newClockSource = CLK_EXT_FALL;
-         break;
+   int clkBits = REG(TCCRnB).field<2, 0>();   // CSx bits field 2 - 0
+   if(clkBits < 0) {
+      newClockSource = CLK_UNKNOWN;      // If CS bits in TCCRnB are unknown
+   } else {
+      newClockSource = Clock_table[clkBits];
+   }
 
-      case 7:                            // External clock rising edge
-      	newClockSource = CLK_EXT_RISE;
-         break;
-#endif
+   if(newClockSource == CLK_INTERNAL) {  // Internal or asynchronous clock
+      newPrescIndex = clkBits;
 
-      case -1:
-         newClockSource = CLK_UNKNOWN;   // If CS bits in TCCRnB are unknown
-         break;
-         
-      default:                           // Internal or asynchronous clock
-         newClockSource = CLK_INTERNAL;
-         newPrescIndex = clkBits;
-         
 #ifdef TIMER_2
-         // Asynchronous mode overrides clock selection
-         switch(Async) {
-            case ASY_32K: newClockSource = CLK_32K; break; 
-            case ASY_EXT: newClockSource = CLK_EXT; break; 
-         }
+      // Asynchronous mode overrides clock selection
+      switch(Async) {
+         case ASY_32K: newClockSource = CLK_32K; break; 
+         case ASY_EXT: newClockSource = CLK_EXT; break; 
+      }
 #endif
-         
-         break;
    }
 
    // Warn about a clock hot switching and log changes
@@ -1660,6 +1869,9 @@ void On_update_tick(double pTime)
 // The GUI is only updated if VAR(Dirty) is true to indicate that internal
 // state has changed. WORD_8_VIEW_c controls are refreshed automatically. 
 {
+   // Keep the TCNTn register view current between timer events
+   Sync(Get_io_cycles());
+
    // Do nothing if state not changed since last On_update_tick()
    if (!Dirty) {
       return;
@@ -1673,8 +1885,8 @@ void On_update_tick(double pTime)
    SetWindowText(GET_HANDLE(GDT_TOP), Top_text[Top]);
 
    // Output compare buffers in hex
-   SetWindowText(GET_HANDLE(GDT_BUFA), hex(OCRA_buffer));
-   SetWindowText(GET_HANDLE(GDT_BUFB), hex(OCRB_buffer));
+   SetWindowText(GET_HANDLE(GDT_BUFA), hex(OCRA_buffer).text);
+   SetWindowText(GET_HANDLE(GDT_BUFB), hex(OCRB_buffer).text);
    
    // Disable (i.e. gray out) double-buffer displays if not in use
    EnableWindow(GET_HANDLE(GDT_BUFA), Update_OCR);
@@ -1683,7 +1895,7 @@ void On_update_tick(double pTime)
 
 #ifdef TIMER_N
    // Output TMP (high byte for 16-bit registers) value in hex
-   SetWindowText(GET_HANDLE(GDT_TMP), hex(TMP_buffer));
+   SetWindowText(GET_HANDLE(GDT_TMP), hex(TMP_buffer).text);
 #endif
 }
 /* >>> Improvement: a set of variables, Handle_xxx, can be declared at DECLARE_VAR, to
@@ -1719,18 +1931,25 @@ int Value(int pMode)
 
 uint Get_io_cycles(void)
 //*************************
-// Return the total number of I/O clock cycles seen by the timer. The I/O clock
-// runs at the same speed as the CPU clock but it can be disabled by either
-// SLEEP mode or by the PRR (Power Reduction Register)
+// Return the total number of I/O clock cycles. The I/O clock runs at the same
+// speed as the CPU clock. It can be disabled by SLEEP mode but the timer is not
+// ticking at that time. The prescaler phase, which must not advance while the
+// I/O clock is stopped, is kept by the dummy component (see Get_psr_cycle()).
 {
-   if(Last_disabled) {
-      return Last_disabled;
-   } else {
-      return (uint) GET_MICRO_INFO(INFO_CPU_CYCLES) - Total_disabled;
-   }
+   return (uint) GET_MICRO_INFO(INFO_CPU_CYCLES);
 }
 
-bool Is_disabled(BOOL pPRRWanted)
+uint Get_psr_cycle()
+//*************************
+// Return the I/O clock cycle when the phase of the prescaler clocking this
+// timer was last 0. The phase is owned by the dummy component, so every timer
+// sharing the prescaler sees the same value. If the dummy component could not
+// be found, the prescaler is assumed to have started at cycle 0.
+{
+   return Dummy_psr_cycle ? Dummy_psr_cycle(PSR_TIMER) : 0;
+}
+
+bool Is_disabled()
 //*************************
 // Return TRUE if the timer is really disabled based on the current sleep mode and
 // the bit in PRR. Idle sleep never disabled any timer. Power-down and standby sleep
@@ -1738,9 +1957,7 @@ bool Is_disabled(BOOL pPRRWanted)
 // timers except TIMER2 when it's in asynchronous mode. Power-save disables any
 // timer except TIMER2 in either synchronous or asynchronous mode. Although ADC
 // and power-save sleep don't disable TIMER2 in asynchronous mode, they do put
-// any asynchronous register updates on hold (see Async_tick). If pPRRWanted is
-// FALSE then only consider the sleep mode and not PRR; this is used for prescaler
-// synchronization since the PRR bit does not stop the prescaler.
+// any asynchronous register updates on hold (see Async_tick).
 {
    switch(Sleep_mode) {
       case SLEEP_NOISE_REDUCTION:
@@ -1755,7 +1972,7 @@ bool Is_disabled(BOOL pPRRWanted)
 
       // SLEEP_EXIT and SLEEP_IDLE (and for TIMER_2 also SLEEP_POWERSAVE)
       default:
-         return Async ? false : (pPRRWanted ? PRR : false);      
+         return Async ? false : PRR;      
    }
 }
 
@@ -1763,20 +1980,26 @@ void Log(const char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
 // This function also automatically prepends the instance name to the formatted
-// message. The message is only printed if DEBUG_LOG is enabled.
+// message. The message is only printed if DEBUG_LOG is enabled. If a trace
+// file is open then only the format and arguments are added to the trace file,
+// and trcdump.exe formats the message. pFormat must be a string literal.
 {
    if(Debug & DEBUG_LOG) {   
-      char strBuffer[MAXBUF];
       va_list argList;
+      va_start(argList, pFormat);
 
-      snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
-      int len = strlen(strBuffer);
+      // The trace file records the instance so it's not part of the message
+      if(Trace.active()) {
+         TRACE_LOG(Trace, pFormat, argList);
+      } else {
+         char strBuffer[MAXBUF];
+         snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
+         int len = strlen(strBuffer);
+         vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
+         PRINT(strBuffer);
+      }
 
-      va_start(argList, pFormat);
-      vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
       va_end(argList);
-
-      PRINT(strBuffer);
    }
 }
 
@@ -1788,20 +2011,23 @@ void Log_register_write(int pId, WORD8 pData, unsigned char pMask)
 // unknown bits in the pMask position then issue a warning. In either case
 // Log() a message indicating the register is being written with pData. The
 // pId is used to look up the true register name (as given in the .ini file)
-// for the warning and log messages.
+// for the warning and log messages. If a trace file is open, known writes
+// are recorded in binary form together with the old register value.
 {
    if((pData.x() & pMask) != pMask) {      
       char strBuffer[64];
-      char *strName = reg(pId);      
+      const char *strName = Reg_names[pId];      
       
       snprintf(strBuffer, 64, "Unknown bits (X) written into %s register",
          strName);
          
       WARNING(strBuffer, CAT_MEMORY, WARN_MEMORY_WRITE_X_IO);
       Log("Write register %s: $??", strName);      
+   } else if((Debug & DEBUG_LOG) && Trace.active()) {
+      TRACE_WRITE(Trace, pId, REG(pId), pData, pMask);
    } else {
-      if(Debug & DEBUG_LOG) { // Don't waste time in reg() if not logging
-         char *strName = reg(pId);
+      if(Debug & DEBUG_LOG) { // Don't waste time if not logging
+         const char *strName = Reg_names[pId];
          Log("Write register %s: $%02X", strName, pData.d() & pMask);
       }
    }
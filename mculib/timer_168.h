@@ -0,0 +1,147 @@
+// Decoding tables for the WGM, COM, and CS bits shared by all the timer
+// models in timer_168.cpp. The TIMER_0, TIMER_2, or TIMER_N macro must be
+// defined before including this file. Also included by tmrcheck.cpp which
+// verifies every table row against the original switch statement decoding.
+//
+// Copyright (C) 2009 Advanced MicroControllers Tools (http://www.amctools.com/)
+// Copyright (C) 2009, 2010, 2011 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#ifndef _TIMER_168_H
+#define _TIMER_168_H
+
+// Clock sources and actions on compare match
+enum {CLK_STOP, CLK_INTERNAL, CLK_EXT_FALL, CLK_EXT_RISE, CLK_UNKNOWN, CLK_32K, CLK_EXT};
+enum {ACT_NONE, ACT_TOGGLE, ACT_CLEAR, ACT_SET, ACT_RESERVED}; // Actions on compare
+
+// Waveform generation modes
+enum {
+   WAVE_NORMAL, WAVE_PWM_PC, WAVE_PWM_PFC, WAVE_CTC, WAVE_PWM_FAST,
+   WAVE_RESERVED, WAVE_UNKNOWN
+};
+
+// Counter TOP/overflow value selected by WGM bits
+enum {
+   VAL_NONE, VAL_OCRA, VAL_ICR, VAL_00, VAL_FF, VAL_1FF, VAL_3FF, VAL_FFFF
+};
+
+// Coding and static tables for clock prescaling
+#ifdef TIMER_2
+const int Prescaler_table[] =  {0, 1, 8, 32, 64, 128, 256, 1024};
+const char *Prescaler_text[] = {"", "/ 1", "/ 8", "/ 32", "/ 64", "/ 128", "/ 256", "/ 1024" };
+
+#else
+const int Prescaler_table[] =  {0, 1, 8, 64, 256, 1024};
+const char *Prescaler_text[] = {"", "/ 1", "/ 8", "/ 64", "/ 256", "/ 1024" };
+#endif
+
+// Decoding of the WGMn bits into a waveform mode. Indexed by the combined
+// WGMn3:0 bits (16-bit timers) or WGMn2:0 bits (8-bit timers). countUp is
+// true for single slope modes where the counter always counts upwards.
+typedef struct {
+   int waveform;         // WAVE_xxx waveform mode
+   int top;              // VAL_xxx counter top value
+   int updateOcr;        // VAL_xxx value at which OCR double buffer updated
+   int overflow;         // VAL_xxx value at which TOV interrupt flag is set
+   bool countUp;         // If true then counting direction forced up
+   bool toggleOk;        // If true then OCA toggle on compare match allowed
+} WAVE_MODE;
+
+#ifdef TIMER_N
+const WAVE_MODE Wave_table[] = {  // AVR manual Table 15-4
+//  Waveform        Top       Update_OCR Overflow  Up     Toggle
+   {WAVE_NORMAL,   VAL_FFFF, VAL_NONE,  VAL_FFFF, true,  true },  // 0: Normal
+   {WAVE_PWM_PC,   VAL_FF,   VAL_FF,    VAL_00,   false, false},  // 1: PWM PC 8-bit
+   {WAVE_PWM_PC,   VAL_1FF,  VAL_1FF,   VAL_00,   false, false},  // 2: PWM PC 9-bit
+   {WAVE_PWM_PC,   VAL_3FF,  VAL_3FF,   VAL_00,   false, false},  // 3: PWM PC 10-bit
+   {WAVE_CTC,      VAL_OCRA, VAL_NONE,  VAL_FFFF, true,  true },  // 4: CTC (OCRA)
+   {WAVE_PWM_FAST, VAL_FF,   VAL_00,    VAL_FF,   true,  false},  // 5: Fast PWM 8-bit
+   {WAVE_PWM_FAST, VAL_1FF,  VAL_00,    VAL_1FF,  true,  false},  // 6: Fast PWM 9-bit
+   {WAVE_PWM_FAST, VAL_3FF,  VAL_00,    VAL_3FF,  true,  false},  // 7: Fast PWM 10-bit
+   {WAVE_PWM_PFC,  VAL_ICR,  VAL_00,    VAL_00,   false, false},  // 8: PWM PFC (ICR)
+   {WAVE_PWM_PFC,  VAL_OCRA, VAL_00,    VAL_00,   false, true },  // 9: PWM PFC (OCRA)
+   {WAVE_PWM_PC,   VAL_ICR,  VAL_ICR,   VAL_00,   false, false},  // 10: PWM PC (ICR)
+   {WAVE_PWM_PC,   VAL_OCRA, VAL_OCRA,  VAL_00,   false, true },  // 11: PWM PC (OCRA)
+   {WAVE_CTC,      VAL_ICR,  VAL_NONE,  VAL_FFFF, true,  true },  // 12: CTC (ICR)
+   {WAVE_RESERVED, VAL_NONE, VAL_NONE,  VAL_NONE, false, false},  // 13: Reserved
+   {WAVE_PWM_FAST, VAL_ICR,  VAL_00,    VAL_ICR,  true,  true },  // 14: Fast PWM (ICR)
+   {WAVE_PWM_FAST, VAL_OCRA, VAL_00,    VAL_OCRA, true,  true },  // 15: Fast PWM (OCRA)
+};
+#else
+const WAVE_MODE Wave_table[] = {  // AVR manual (table #51)
+//  Waveform        Top       Update_OCR Overflow  Up     Toggle
+   {WAVE_NORMAL,   VAL_FF,   VAL_NONE,  VAL_FF,   true,  true },  // 0: Normal
+   {WAVE_PWM_PC,   VAL_FF,   VAL_FF,    VAL_00,   false, false},  // 1: PWM PC (0xFF)
+   {WAVE_CTC,      VAL_OCRA, VAL_NONE,  VAL_FF,   true,  true },  // 2: CTC (OCRA)
+   {WAVE_PWM_FAST, VAL_FF,   VAL_00,    VAL_FF,   true,  false},  // 3: Fast PWM (0xFF)
+   {WAVE_RESERVED, VAL_NONE, VAL_NONE,  VAL_NONE, false, true },  // 4: Reserved
+   {WAVE_PWM_PC,   VAL_OCRA, VAL_OCRA,  VAL_00,   false, true },  // 5: PWM PC (OCRA)
+   {WAVE_RESERVED, VAL_NONE, VAL_NONE,  VAL_NONE, false, true },  // 6: Reserved
+   {WAVE_PWM_FAST, VAL_OCRA, VAL_00,    VAL_OCRA, true,  true },  // 7: Fast PWM (OCRA)
+};
+#endif
+
+// Decoding of the COMnx1:0 bits into the actions performed on the OCnx pin
+// at compare match and at TOP. The first index selects if a toggle is allowed
+// (OCnA) or if the waveform is a PWM mode (OCnB).
+typedef struct {
+   int comp;             // ACT_xxx action on compare match
+   int top;              // ACT_xxx action when counter reaches TOP
+} COMPARE_MODE;
+
+#ifdef TIMER_N
+#define ACT_PWM_TOGGLE_B ACT_NONE       // Tables 15-2, 15-3 manual
+#else
+#define ACT_PWM_TOGGLE_B ACT_RESERVED   // Tables #49/50 manual
+#endif
+
+const COMPARE_MODE Compare_A_table[2][4] = {
+   {  // OCnA toggle not allowed by waveform mode
+      {ACT_NONE, ACT_NONE}, {ACT_NONE, ACT_NONE},
+      {ACT_CLEAR, ACT_CLEAR}, {ACT_SET, ACT_SET}
+   },
+   {  // OCnA toggle allowed by waveform mode
+      {ACT_NONE, ACT_NONE}, {ACT_TOGGLE, ACT_NONE},
+      {ACT_CLEAR, ACT_CLEAR}, {ACT_SET, ACT_SET}
+   }
+};
+const COMPARE_MODE Compare_B_table[2][4] = {
+   {  // Non PWM waveform mode
+      {ACT_NONE, ACT_NONE}, {ACT_TOGGLE, ACT_NONE},
+      {ACT_CLEAR, ACT_CLEAR}, {ACT_SET, ACT_SET}
+   },
+   {  // Fast PWM or dual slope waveform mode
+      {ACT_NONE, ACT_NONE}, {ACT_PWM_TOGGLE_B, ACT_NONE},
+      {ACT_CLEAR, ACT_CLEAR}, {ACT_SET, ACT_SET}
+   }
+};
+
+// Decoding of the CSn2:0 bits into a clock source. For CLK_INTERNAL, the
+// CS bits are also the index into Prescaler_table[].
+#ifdef TIMER_2
+const int Clock_table[] = {
+   CLK_STOP, CLK_INTERNAL, CLK_INTERNAL, CLK_INTERNAL,
+   CLK_INTERNAL, CLK_INTERNAL, CLK_INTERNAL, CLK_INTERNAL
+};
+#else
+const int Clock_table[] = {
+   CLK_STOP, CLK_INTERNAL, CLK_INTERNAL, CLK_INTERNAL,
+   CLK_INTERNAL, CLK_INTERNAL, CLK_EXT_FALL, CLK_EXT_RISE
+};
+#endif
+
+#endif // #ifndef _TIMER_168_H
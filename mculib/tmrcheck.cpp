@@ -0,0 +1,481 @@
+// Command line tool to verify the WGM, COM, and CS decoding tables in
+// timer_168.h against the switch statements they replaced in timer_168.cpp.
+// Every table row is compared against the original decoding, which is kept
+// here verbatim. If all rows match, the decoding done on every TCCRnA/TCCRnB
+// write is then timed with both versions. The tool is built once for each
+// timer type (tmrchk0.exe, tmrchk2.exe, tmrchkN.exe) and prints any mismatch.
+// Usage: tmrchk<n>
+//
+// Copyright (C) 2009 Advanced MicroControllers Tools (http://www.amctools.com/)
+// Copyright (C) 2009, 2010, 2011 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#include <stdio.h>
+#include <time.h>
+#include "timer_168.h"
+
+#if defined(TIMER_0)
+#define TIMER_NAME "TIMER_0"
+#elif defined(TIMER_2)
+#define TIMER_NAME "TIMER_2"
+#elif defined(TIMER_N)
+#define TIMER_NAME "TIMER_N"
+#else
+#error "One of TIMER_0, TIMER_2, or TIMER_N must be defined"
+#endif
+
+#define COUNT(x) ((int) (sizeof(x) / sizeof((x)[0])))
+
+// Number of times all 64K TCCRnA/TCCRnB combinations are decoded when timing
+#define BENCH_PASSES 200
+
+// Return true if counter uses dual slope operation
+#define IS_WAVE_DUAL_SLOPE() (Waveform == WAVE_PWM_PC || Waveform == WAVE_PWM_PFC)
+
+// Same global state as in timer_168.cpp that the original decoding modifies.
+// Overflow and Counting_up are only written by some of the switch cases.
+int Waveform;
+int Top;
+int Update_OCR;
+int Overflow;
+bool Counting_up;
+bool OCA_toggle_ok;
+int Action_comp_A, Action_top_A;
+int Action_comp_B, Action_top_B;
+
+// Total number of table rows that did not match the original decoding
+int Errors;
+
+// Accumulates the decoded state so the timed loops are not optimized away
+volatile int Sink;
+
+#ifdef TIMER_N
+
+int Old_waveform(int fullWaveCode)
+//*************************
+// Original 16-bit decoding from Update_waveform(); returns new Waveform
+{
+   int newWaveform = WAVE_UNKNOWN;
+   Top = VAL_NONE;
+   Update_OCR = VAL_NONE;
+   OCA_toggle_ok = false;
+   
+   switch(fullWaveCode) {       // Apply AVR manual Table 15-4
+
+      case 0: // Normal timer mode (TOP=0xFFFF / 16-bit) 
+         newWaveform = WAVE_NORMAL; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_FFFF; Update_OCR = VAL_NONE; Overflow = VAL_FFFF;
+         break;
+
+      case 1: // PWM phase correct (TOP=0xFF / 8-bit)
+         newWaveform = WAVE_PWM_PC;
+         Top = VAL_FF; Update_OCR = VAL_FF; Overflow = VAL_00;
+         break;
+
+      case 2: // PWM phase correct (TOP=0x1FF / 9-bit)
+         newWaveform = WAVE_PWM_PC;
+         Top = VAL_1FF; Update_OCR = VAL_1FF; Overflow = VAL_00;
+         break;
+
+      case 3: // PWM phase correct (TOP=0x3FF / 10-bit)
+         newWaveform = WAVE_PWM_PC;
+         Top = VAL_3FF; Update_OCR = VAL_3FF; Overflow = VAL_00;
+         break;
+
+      case 4: // CTC (TOP=OCRA)
+         newWaveform = WAVE_CTC; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_NONE; Overflow = VAL_FFFF;
+         break;
+
+      case 5: // Fast PWM (TOP=0xFF / 8-bit)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true;
+         Top = VAL_FF; Update_OCR = VAL_00; Overflow = VAL_FF;
+         break;
+
+      case 6: // Fast PWM (TOP=0x1FF / 9-bit)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true;
+         Top = VAL_1FF; Update_OCR = VAL_00; Overflow = VAL_1FF;
+         break;
+
+      case 7: // Fast PWM (TOP=0x3FF / 10-bit)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true;
+         Top = VAL_3FF; Update_OCR = VAL_00; Overflow = VAL_3FF;
+         break;
+
+      case 8: // PWM phase and frequency correct (TOP=ICR)
+         newWaveform = WAVE_PWM_PFC;
+         Top = VAL_ICR; Update_OCR = VAL_00; Overflow = VAL_00;
+         break;
+
+      case 9: // PWM phase and frequency correct (TOP=OCRA)
+         newWaveform = WAVE_PWM_PFC; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_00; Overflow = VAL_00;
+         break;
+
+      case 10: // PWM phase correct (TOP=ICR)
+         newWaveform = WAVE_PWM_PC;
+         Top = VAL_ICR; Update_OCR = VAL_ICR; Overflow = VAL_00;
+         break;
+
+      case 11: // PWM phase correct (TOP=OCRA)
+         newWaveform = WAVE_PWM_PC; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_OCRA; Overflow = VAL_00;
+         break;
+
+      case 12: // CTC (TOP=ICR)
+         newWaveform = WAVE_CTC; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_ICR; Update_OCR = VAL_NONE; Overflow = VAL_FFFF;
+         break;
+
+      case 13: // Reserved
+         newWaveform = WAVE_RESERVED;
+         Top = VAL_NONE; Update_OCR = VAL_NONE; Overflow = VAL_NONE;
+         break;
+         
+      case 14: // Fast PWM (TOP=ICR)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_ICR; Update_OCR = VAL_00; Overflow = VAL_ICR;
+         break;
+
+      case 15: // Fast PWM (TOP=OCRA)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_00; Overflow = VAL_OCRA;
+         break;
+   }
+
+   return newWaveform;
+}
+
+#else // #ifdef TIMER_N
+
+int Old_waveform(int fullWaveCode)
+//*************************
+// Original 8-bit decoding from Update_waveform(); returns new Waveform
+{
+   int newWaveform = WAVE_UNKNOWN;
+   Top = VAL_NONE;
+   Update_OCR = VAL_NONE;
+   OCA_toggle_ok = false;
+   
+   switch(fullWaveCode) {       // Apply AVR manual (table #51)
+
+      case 0: // Normal timer mode (TOP=0xFF)
+         newWaveform = WAVE_NORMAL; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_FF; Update_OCR = VAL_NONE; Overflow = VAL_FF;
+         break;
+
+      case 1: // PWM phase correct (TOP=0xFF)
+         newWaveform = WAVE_PWM_PC;
+         Top = VAL_FF; Update_OCR = VAL_FF; Overflow = VAL_00;
+         break;
+
+      case 2: // CTC (TOP=OCRA)
+         newWaveform = WAVE_CTC; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_NONE; Overflow = VAL_FF;
+         break;
+
+      case 3: // Fast PWM (TOP=0xFF)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true;
+         Top = VAL_FF; Update_OCR = VAL_00; Overflow = VAL_FF;
+         break;
+
+      case 5: // PWM phase correct (TOP=OCRA)
+         newWaveform = WAVE_PWM_PC; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_OCRA; Overflow = VAL_00;
+         break;
+
+      case 7: // Fast PWM (TOP=OCRA)
+         newWaveform = WAVE_PWM_FAST; Counting_up = true; OCA_toggle_ok = true;
+         Top = VAL_OCRA; Update_OCR = VAL_00; Overflow = VAL_OCRA;
+         break;
+
+      case 4: case 6:   // Reserved
+         newWaveform = WAVE_RESERVED; OCA_toggle_ok = true;
+         Top = VAL_NONE; Update_OCR = VAL_NONE; Overflow = VAL_NONE;
+         break;
+   }
+
+   return newWaveform;
+}
+
+#endif // #ifdef TIMER_N
+
+void Old_compare_A(int compCode)
+//*************************
+// Original OCnA decoding from Update_compare_actions()
+{
+   Action_comp_A = ACT_NONE;  // Compare A
+   Action_top_A = ACT_NONE;
+   switch(compCode) {
+      case 1:                               // Toggle
+         if(OCA_toggle_ok) {
+            Action_comp_A = ACT_TOGGLE;
+         } else {
+            Action_comp_A = ACT_NONE;
+         }
+         break;
+         
+      case 2:                               // Clear port
+         Action_comp_A = ACT_CLEAR;
+         Action_top_A = ACT_CLEAR;
+         break;
+         
+      case 3:                               // Set port
+         Action_comp_A = ACT_SET;
+         Action_top_A = ACT_SET;
+         break;
+   }
+}
+
+void Old_compare_B(int compCode)
+//*************************
+// Original OCnB decoding from Update_compare_actions()
+{
+   Action_comp_B = ACT_NONE;  // Compare B; some small different behaviour
+   Action_top_B = ACT_NONE;
+   switch(compCode) {
+      case 1:                               // Toggle
+         Action_comp_B = ACT_TOGGLE;
+         if(Waveform == WAVE_PWM_FAST || IS_WAVE_DUAL_SLOPE()) {
+#ifdef TIMER_N
+            Action_comp_B = ACT_NONE;          // Tables 15-2, 15-3 manual         
+#else
+            Action_comp_B = ACT_RESERVED;      // Tables #49/50 manual
+#endif
+         }
+         break;
+         
+      case 2:                               // Clear port
+         Action_comp_B = ACT_CLEAR;
+         Action_top_B = ACT_CLEAR;
+         break;
+         
+      case 3:                               // Set port
+         Action_comp_B = ACT_SET;
+         Action_top_B = ACT_SET;
+         break;
+   }
+}
+
+int Old_clock_source(int clkBits, int &newPrescIndex)
+//*************************
+// Original CS decoding from Update_clock_source() without the asynchronous
+// mode override, which is still applied after the Clock_table[] lookup
+{
+   int newClockSource;
+   newPrescIndex = 0;
+
+   switch(clkBits) {
+   	case 0:                            // Stopped
+      	newClockSource = CLK_STOP;
+         break;
+
+#ifndef TIMER_2
+      case 6:                            // External clock, falling edge
+      	newClockSource = CLK_EXT_FALL;
+         break;
+
+      case 7:                            // External clock rising edge
+      	newClockSource = CLK_EXT_RISE;
+         break;
+#endif
+
+      case -1:
+         newClockSource = CLK_UNKNOWN;   // If CS bits in TCCRnB are unknown
+         break;
+         
+      default:                           // Internal or asynchronous clock
+         newClockSource = CLK_INTERNAL;
+         newPrescIndex = clkBits;
+         break;
+   }
+
+   return newClockSource;
+}
+
+void Check(bool pOk, const char *pTable, int pRow, const char *pField)
+//*************************
+// Report a mismatch between a table row field and the original decoding
+{
+   if(!pOk) {
+      printf("%s: %s[%d].%s does not match original decoding\n",
+         TIMER_NAME, pTable, pRow, pField);
+      Errors++;
+   }
+}
+
+void Check_waveform()
+//*************************
+// Every WGM code, with both initial counting directions and an Overflow value
+// that no table row uses, to catch rows that should leave them unchanged
+{
+   for(int code = 0; code < COUNT(Wave_table); code++) {
+      for(int up = 0; up < 2; up++) {
+         Counting_up = up;
+         Overflow = -1;
+         int waveform = Old_waveform(code);
+         const WAVE_MODE &mode = Wave_table[code];
+
+         bool tableUp = mode.countUp ? true : (bool) up;
+
+         Check(mode.waveform == waveform, "Wave_table", code, "waveform");
+         Check(mode.top == Top, "Wave_table", code, "top");
+         Check(mode.updateOcr == Update_OCR, "Wave_table", code, "updateOcr");
+         Check(mode.overflow == Overflow, "Wave_table", code, "overflow");
+         Check(tableUp == Counting_up, "Wave_table", code, "countUp");
+         Check(mode.toggleOk == OCA_toggle_ok, "Wave_table", code, "toggleOk");
+      }
+   }
+
+   // One table row for each possible combination of the WGM bits
+   if(Old_waveform(COUNT(Wave_table)) != WAVE_UNKNOWN) {
+      Check(false, "Wave_table", COUNT(Wave_table), "size");
+   }
+}
+
+void Check_compare()
+//*************************
+// Every COM code against every toggle setting (OCnA) and waveform (OCnB)
+{
+   for(int code = 0; code < 4; code++) {
+      for(int toggle = 0; toggle < 2; toggle++) {
+         OCA_toggle_ok = toggle;
+         Old_compare_A(code);
+         const COMPARE_MODE &mode = Compare_A_table[toggle][code];
+         Check(mode.comp == Action_comp_A, "Compare_A_table", code, "comp");
+         Check(mode.top == Action_top_A, "Compare_A_table", code, "top");
+      }
+
+      for(Waveform = WAVE_NORMAL; Waveform <= WAVE_UNKNOWN; Waveform++) {
+         Old_compare_B(code);
+         bool pwm = Waveform == WAVE_PWM_FAST || IS_WAVE_DUAL_SLOPE();
+         const COMPARE_MODE &mode = Compare_B_table[pwm][code];
+         Check(mode.comp == Action_comp_B, "Compare_B_table", code, "comp");
+         Check(mode.top == Action_top_B, "Compare_B_table", code, "top");
+      }
+   }
+}
+
+void Check_clock()
+//*************************
+// Every CS code, including the prescaler index used for internal clocks
+{
+   if(COUNT(Clock_table) != 8) {
+      Check(false, "Clock_table", COUNT(Clock_table), "size");
+   }
+
+   for(int code = 0; code < COUNT(Clock_table); code++) {
+      int oldIndex;
+      int source = Old_clock_source(code, oldIndex);
+      int newIndex = Clock_table[code] == CLK_INTERNAL ? code : 0;
+
+      Check(Clock_table[code] == source, "Clock_table", code, "source");
+      Check(newIndex == oldIndex, "Clock_table", code, "prescaler");
+      Check(newIndex < COUNT(Prescaler_table), "Prescaler_table", newIndex, "size");
+   }
+}
+
+int Wave_code(int pTccra, int pTccrb)
+//*************************
+// Return the combined WGM bits of TCCRnA and TCCRnB as used by both versions
+{
+#ifdef TIMER_N
+   return ((pTccrb >> 1) & 0xC) | (pTccra & 3);
+#else
+   return ((pTccrb >> 1) & 0x4) | (pTccra & 3);
+#endif
+}
+
+void Old_write(int pTccra, int pTccrb)
+//*************************
+// Decode a TCCRnA/TCCRnB write with the original switch statements, in the
+// same order as Update_waveform(), Update_compare_actions(), and
+// Update_clock_source() are called in timer_168.cpp
+{
+   int prescIndex;
+   Waveform = Old_waveform(Wave_code(pTccra, pTccrb));
+   Old_compare_A((pTccra >> 6) & 3);
+   Old_compare_B((pTccra >> 4) & 3);
+   Sink += Old_clock_source(pTccrb & 7, prescIndex) + prescIndex;
+}
+
+void New_write(int pTccra, int pTccrb)
+//*************************
+// Decode a TCCRnA/TCCRnB write with the tables, as done in timer_168.cpp
+{
+   const WAVE_MODE &wave = Wave_table[Wave_code(pTccra, pTccrb)];
+   Waveform = wave.waveform;
+   Top = wave.top;
+   Update_OCR = wave.updateOcr;
+   Overflow = wave.overflow;
+   OCA_toggle_ok = wave.toggleOk;
+   if(wave.countUp) {
+      Counting_up = true;
+   }
+
+   const COMPARE_MODE &compA = Compare_A_table[OCA_toggle_ok][(pTccra >> 6) & 3];
+   Action_comp_A = compA.comp;
+   Action_top_A = compA.top;
+
+   bool pwm = Waveform == WAVE_PWM_FAST || IS_WAVE_DUAL_SLOPE();
+   const COMPARE_MODE &compB = Compare_B_table[pwm][(pTccra >> 4) & 3];
+   Action_comp_B = compB.comp;
+   Action_top_B = compB.top;
+
+   int clkBits = pTccrb & 7;
+   int source = Clock_table[clkBits];
+   Sink += source + (source == CLK_INTERNAL ? clkBits : 0);
+}
+
+void Benchmark(const char *pName, void (*pWrite)(int, int))
+//*************************
+// Time pWrite() over every TCCRnA/TCCRnB combination and print the average.
+// Only the decoding is timed, not the register access or the GUI updates.
+{
+   clock_t start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      for(int value = 0; value < 0x10000; value++) {
+         pWrite(value & 0xFF, value >> 8);
+      }
+      Sink += Waveform + Top + Update_OCR + Overflow + Action_comp_A +
+         Action_top_A + Action_comp_B + Action_top_B;
+   }
+
+   double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+   printf("%s: %-8s %8.3f ns/write\n", TIMER_NAME, pName,
+      seconds * 1E9 / (65536.0 * BENCH_PASSES));
+}
+
+int main()
+//*************************
+{
+   Check_waveform();
+   Check_compare();
+   Check_clock();
+
+   if(Errors) {
+      printf("%s: %d mismatches found\n", TIMER_NAME, Errors);
+      return 1;
+   }
+
+   printf("%s: all %d WGM, 2x8 COM, and %d CS table rows match\n",
+      TIMER_NAME, COUNT(Wave_table), COUNT(Clock_table));
+
+   Benchmark("switch", Old_write);
+   Benchmark("table", New_write);
+   return 0;
+}
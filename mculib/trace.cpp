@@ -0,0 +1,440 @@
+// Binary trace file shared by all AVR peripherals. See trace.h for details.
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#pragma hdrstop
+#include "trace.h"
+
+// =============================================================================
+// Global Constants and Macros
+// =============================================================================
+
+// Size of temporary string buffer for generating filenames
+#define MAXBUF 256
+
+// Milliseconds the writer thread sleeps if not woken up by a full ring buffer
+#define WRITER_PERIOD 50
+
+// Number of bytes of text stored in each text record
+#define TEXT_SIZE sizeof(TRACE_RECORD)
+
+// =============================================================================
+// Private Functions
+// =============================================================================
+
+bool Tracefile::push(const TRACE_RECORD &pRecord)
+//*************************
+// Add one record to the ring buffer. If the ring buffer is full, the record
+// is counted as dropped and a TRC_DROPPED record is added ahead of the next
+// record that fits. Returns false if the record was dropped.
+{
+   ULONG head = (ULONG) Head;
+   ULONG used = head - (ULONG) Tail;
+   ULONG needed = Dropped ? 2 : 1;
+
+   if(RING_SIZE - used < needed) {
+      Dropped++;
+      return false;
+   }
+
+   if(Dropped) {
+      TRACE_RECORD &drop = Ring[head++ & (RING_SIZE - 1)];
+      memset(&drop, 0, sizeof(TRACE_RECORD));
+      drop.Cycle = pRecord.Cycle;
+      drop.Event = TRC_DROPPED;
+      memcpy(drop.Data, &Dropped, sizeof(Dropped));
+      Dropped = 0;
+   }
+   Ring[head++ & (RING_SIZE - 1)] = pRecord;
+
+   // InterlockedExchange() is a full memory barrier so the record contents
+   // are visible to the writer thread before the new Head value.
+   InterlockedExchange(&Head, (LONG) head);
+
+   // Wake up the writer early if the ring buffer is getting full
+   if(used + needed == RING_SIZE / 2) {
+      SetEvent(Wakeup);
+   }
+   return true;
+}
+
+bool Tracefile::push_data(TRACE_RECORD &pRecord, const void *pData,
+   UINT pSize)
+//*************************
+// Add the event record pRecord followed by enough records to hold pSize bytes
+// of pData, and set pRecord.Length to their number. If the ring buffer cannot
+// hold all of them, then all of them are dropped and false is returned.
+{
+   UINT count = (pSize + TEXT_SIZE - 1) / TEXT_SIZE;
+   if(count > 255) {
+      count = 255;
+      pSize = count * TEXT_SIZE;
+   }
+
+   ULONG used = (ULONG) Head - (ULONG) Tail;
+   if(RING_SIZE - used < count + 1 + (Dropped ? 1 : 0)) {
+      Dropped += count + 1;
+      return false;
+   }
+
+   pRecord.Length = count;
+   push(pRecord);
+
+   TRACE_RECORD record;
+   for(UINT i = 0; i < count; i++) {
+      UINT size = pSize - i * TEXT_SIZE;
+      if(size > TEXT_SIZE) {
+         size = TEXT_SIZE;
+      }
+      memset(&record, 0, sizeof(TRACE_RECORD));
+      memcpy(&record, (const char *) pData + i * TEXT_SIZE, size);
+      push(record);
+   }
+   return true;
+}
+
+bool Tracefile::push_text(UINT pCycle, int pEvent, int pInstance,
+   const char *pText, int pRegister)
+//*************************
+// Add an event record followed by enough text records to hold pText. If
+// the ring buffer cannot hold all of them, then all of them are dropped.
+{
+   TRACE_RECORD record;
+   memset(&record, 0, sizeof(TRACE_RECORD));
+   record.Cycle = pCycle;
+   record.Event = pEvent;
+   record.Instance = pInstance;
+   record.Register = pRegister;
+   return push_data(record, pText, strlen(pText));
+}
+
+int Tracefile::find_format(UINT pCycle, int pInstance, const char *pFormat)
+//*************************
+// Return the ID of the Log() format pFormat. The first time a format is seen,
+// its argument types are parsed and its text is recorded with TRC_FORMAT.
+// Formats are identified by address, so pFormat must be a string literal as
+// in all Log() calls. Returns -1 if the format cannot be recorded.
+{
+   for(int i = 0; i < Formats; i++) {
+      if(Format[i] == pFormat) {
+         return i;
+      }
+   }
+
+   if(Formats == TRACE_FORMATS ||
+      !Trace_format_args(pFormat, Format_args[Formats])) {
+      return -1;
+   }
+
+   // If the TRC_FORMAT record is dropped, the format is recorded again by the
+   // next Log() call using it
+   TRACE_RECORD record;
+   memset(&record, 0, sizeof(TRACE_RECORD));
+   record.Cycle = pCycle;
+   record.Event = TRC_FORMAT;
+   record.Instance = pInstance;
+   record.Data[0] = Formats;
+   if(!push_data(record, pFormat, strlen(pFormat))) {
+      return -1;
+   }
+
+   Format[Formats] = pFormat;
+   return Formats++;
+}
+
+bool Tracefile::write_file(const void *pData, DWORD pSize)
+//*************************
+// Write pSize bytes to the trace file. If only part of the data could be
+// written, then the partial data is removed again so the file always ends on
+// a record boundary. Returns false if the data was not written.
+{
+   DWORD written = 0;
+
+   if(WriteFile(File, pData, pSize, &written, NULL) && written == pSize) {
+      return true;
+   }
+   if(written) {
+      SetFilePointer(File, -(LONG) written, NULL, FILE_CURRENT);
+      SetEndOfFile(File);
+   }
+   return false;
+}
+
+void Tracefile::drain()
+//*************************
+// Write all records currently in the ring buffer to the file. Called only
+// from the writer thread (or after the thread has terminated). Records that
+// cannot be written are counted and reported by a TRC_FAILED record ahead of
+// the next block that is written successfully, and by close().
+{
+   ULONG head = (ULONG) Head;
+   ULONG tail = (ULONG) Tail;
+
+   while(tail != head) {
+      // Write the largest contiguous block before the end of the ring buffer
+      ULONG index = tail & (RING_SIZE - 1);
+      ULONG count = head - tail;
+      if(count > RING_SIZE - index) {
+         count = RING_SIZE - index;
+      }
+
+      if(Unwritten) {
+         TRACE_RECORD failed;
+         memset(&failed, 0, sizeof(TRACE_RECORD));
+         failed.Cycle = Ring[index].Cycle;
+         failed.Event = TRC_FAILED;
+         memcpy(failed.Data, &Unwritten, sizeof(Unwritten));
+         if(write_file(&failed, sizeof(TRACE_RECORD))) {
+            Unwritten = 0;
+         }
+      }
+
+      // Blocks are skipped until the TRC_FAILED record marking the gap has
+      // been written, so records never silently go missing from the file
+      if(Unwritten || !write_file(&Ring[index], count * sizeof(TRACE_RECORD))) {
+         Unwritten += count;
+         Lost += count;
+      }
+
+      tail += count;
+      InterlockedExchange(&Tail, (LONG) tail);
+   }
+}
+
+DWORD WINAPI Tracefile::Writer(LPVOID pThis)
+//*************************
+// Background thread which periodically drains the ring buffer into the
+// trace file until close() sets the Stop flag.
+{
+   Tracefile *trace = (Tracefile *) pThis;
+
+   while(!trace->Stop) {
+      WaitForSingleObject(trace->Wakeup, WRITER_PERIOD);
+      trace->drain();
+   }
+   trace->drain();
+
+   return 0;
+}
+
+// =============================================================================
+// Public Functions
+// =============================================================================
+
+Tracefile::Tracefile()
+//*************************
+// Initialize class to safe defaults
+{
+   Head = Tail = 0;
+   Dropped = 0;
+   Unwritten = Lost = 0;
+   Formats = 0;
+   File = INVALID_HANDLE_VALUE;
+   Thread = NULL;
+   Wakeup = NULL;
+   Stop = 0;
+   Users = 0;
+}
+
+Tracefile::~Tracefile()
+//*************************
+// Normally close() is called from On_simulation_end() before the DLL is
+// unloaded. If not, then it's not safe to wait for the writer thread while
+// the DLL is being unloaded, so the thread is terminated and any remaining
+// records are written out directly.
+{
+   if(active()) {
+      TerminateThread(Thread, 0);
+      drain();
+      CloseHandle(Thread);
+      CloseHandle(Wakeup);
+      CloseHandle(File);
+   }
+}
+
+bool Tracefile::open(const char *pName, UINT pCycle, int pInstance)
+//*************************
+// Called by every component instance when the simulation begins. The first
+// call creates the "<pName>.trc" file in the directory given by the
+// VMLAB_TRACE environment variable and starts the writer thread. Every call
+// records the instance's pName in the file. Returns true if tracing active.
+{
+   if(Users++ == 0) {
+      char dir[MAX_PATH];
+      char path[MAXBUF];
+
+      DWORD rc = GetEnvironmentVariable(TRACE_ENV, dir, MAX_PATH);
+      if(rc == 0 || rc >= MAX_PATH) {
+         return false;
+      }
+      snprintf(path, MAXBUF, "%s\\%s.trc", dir, pName);
+
+      File = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+      if(File == INVALID_HANDLE_VALUE) {
+         return false;
+      }
+
+      Head = Tail = 0;
+      Dropped = 0;
+      Unwritten = Lost = 0;
+      Formats = 0;
+
+      if(!write_file(TRACE_SIGNATURE, strlen(TRACE_SIGNATURE))) {
+         CloseHandle(File);
+         File = INVALID_HANDLE_VALUE;
+         return false;
+      }
+      Stop = 0;
+
+      DWORD id;
+      Wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+      Thread = CreateThread(NULL, 0, Writer, this, 0, &id);
+      if(Wakeup == NULL || Thread == NULL) {
+         if(Wakeup) CloseHandle(Wakeup);
+         CloseHandle(File);
+         File = INVALID_HANDLE_VALUE;
+         return false;
+      }
+   }
+
+   if(active()) {
+      push_text(pCycle, TRC_NAME, pInstance, pName);
+   }
+   return active();
+}
+
+UINT Tracefile::close()
+//*************************
+// Called by every component instance when the simulation ends. The last call
+// stops the writer thread, which first writes out all remaining records.
+// Returns the number of records that could not be written to the file; this
+// is only non-zero for the last call.
+{
+   if(Users == 0 || --Users > 0 || !active()) {
+      return 0;
+   }
+
+   InterlockedExchange(&Stop, 1);
+   SetEvent(Wakeup);
+   WaitForSingleObject(Thread, INFINITE);
+
+   CloseHandle(Thread);
+   CloseHandle(Wakeup);
+   CloseHandle(File);
+   Thread = NULL;
+   Wakeup = NULL;
+   File = INVALID_HANDLE_VALUE;
+
+   return Lost;
+}
+
+void Tracefile::message(UINT pCycle, int pInstance, const char *pText)
+//*************************
+// Record a Log() message already formatted into pText
+{
+   push_text(pCycle, TRC_MESSAGE, pInstance, pText);
+}
+
+void Tracefile::log(UINT pCycle, int pInstance, const char *pFormat,
+   va_list pArgs)
+//*************************
+// Record a Log() call without formatting the message. Only the format ID and
+// a copy of the arguments are recorded, and trcdump.exe does the formatting.
+// Strings are copied since they may be temporary buffers. If the format
+// cannot be recorded, the message is formatted here and recorded as text.
+{
+   int id = find_format(pCycle, pInstance, pFormat);
+   if(id < 0) {
+      char text[MAXBUF];
+      vsnprintf(text, MAXBUF, pFormat, pArgs);
+      push_text(pCycle, TRC_MESSAGE, pInstance, text);
+      return;
+   }
+
+   // Strings are truncated if necessary to leave room for the largest
+   // possible size of all following arguments
+   char data[MAXBUF];
+   UINT size = 0;
+   for(const char *type = Format_args[id]; *type; type++) {
+      if(*type == 'i') {
+         int value = va_arg(pArgs, int);
+         memcpy(data + size, &value, sizeof(value));
+         size += sizeof(value);
+      } else if(*type == 'f') {
+         double value = va_arg(pArgs, double);
+         memcpy(data + size, &value, sizeof(value));
+         size += sizeof(value);
+      } else {
+         const char *value = va_arg(pArgs, const char *);
+         UINT room = sizeof(data) - size - 1 -
+            strlen(type + 1) * sizeof(double);
+         if(!value) {
+            value = "(null)";
+         }
+         UINT length = strlen(value);
+         if(length > room) {
+            length = room;
+         }
+         memcpy(data + size, value, length);
+         size += length;
+         data[size++] = '\0';
+      }
+   }
+
+   TRACE_RECORD record;
+   memset(&record, 0, sizeof(TRACE_RECORD));
+   record.Cycle = pCycle;
+   record.Event = TRC_LOG;
+   record.Instance = pInstance;
+   record.Data[0] = id;
+   push_data(record, data, size);
+}
+
+void Tracefile::write(UINT pCycle, int pInstance, int pId, UCHAR pOld_d,
+   UCHAR pOld_x, UCHAR pNew_d, UCHAR pNew_x, UCHAR pMask)
+//*************************
+// Record a register write of pNew_d/pNew_x into register pId which held
+// pOld_d/pOld_x before the write. The "x" values are known bit masks.
+{
+   TRACE_RECORD record;
+
+   memset(&record, 0, sizeof(TRACE_RECORD));
+   record.Cycle = pCycle;
+   record.Event = TRC_WRITE;
+   record.Instance = pInstance;
+   record.Register = pId;
+   record.Data[0] = pOld_d;
+   record.Data[1] = pOld_x;
+   record.Data[2] = pNew_d;
+   record.Data[3] = pNew_x;
+   record.Data[4] = pMask;
+   push(record);
+}
+
+void Tracefile::regname(UINT pCycle, int pInstance, int pId, const char *pText)
+//*************************
+// Record the name pText of register pId so the trace reader can show it
+// instead of the register ID
+{
+   push_text(pCycle, TRC_REGNAME, pInstance, pText, pId);
+}
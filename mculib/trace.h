@@ -0,0 +1,195 @@
+// Binary trace file shared by all AVR peripherals. Instead of formatting every
+// log message and synchronously calling PRINT() on the simulation thread, the
+// peripherals push small fixed-size records into a lock-free ring buffer. A
+// background thread drains the ring buffer into a binary trace file which
+// can be decoded after the simulation with the trcdump.exe tool.
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// Name of the environment variable with the directory where trace files are
+// written. If the variable is not set, tracing is disabled and peripherals
+// PRINT() their log messages as before.
+#define TRACE_ENV "VMLAB_TRACE"
+
+// Signature at the start of every trace file, followed by TRACE_RECORDs
+#define TRACE_SIGNATURE "VMLABTRC"
+
+// Event codes stored in TRACE_RECORD::Event
+enum {
+   TRC_NAME,      // Instance name; text follows in Length records
+   TRC_MESSAGE,   // Log() message; text follows in Length records
+   TRC_WRITE,     // Register write; Data[] = old d/x, new d/x, mask
+   TRC_DROPPED,   // Ring buffer overflowed; Data[0..3] = records lost
+   TRC_REGNAME,   // Register name; Register = ID, text follows in Length records
+   TRC_FAILED,    // Writing the file failed; Data[0..3] = records lost
+   TRC_FORMAT,    // Log() format; Data[0] = format ID, text follows
+   TRC_LOG,       // Log() call; Data[0] = format ID, arguments follow
+};
+
+// Most formats and arguments that can be recorded by TRC_FORMAT and TRC_LOG.
+// Log() calls with other formats are formatted by the peripheral and recorded
+// as TRC_MESSAGE instead.
+#define TRACE_FORMATS 256
+#define TRACE_ARGS 8
+
+struct TRACE_RECORD
+//*********
+// All trace file records have the same 16 byte size. Events with a text
+// string (TRC_NAME, TRC_MESSAGE, TRC_REGNAME, and TRC_FORMAT) are followed by
+// "Length" records which contain the raw text padded with zeroes instead of
+// the fields below. TRC_LOG is followed in the same way by the Log()
+// arguments: 4 bytes for each integer, 8 bytes for each double, and the
+// characters of each string with a terminating zero.
+{
+   UINT Cycle;       // CPU cycle count when event happened
+   UCHAR Event;      // Type of event (TRC_xxx)
+   UCHAR Instance;   // Index of component instance that created the event
+   UCHAR Register;   // REGISTER_ID for TRC_WRITE and TRC_REGNAME events
+   UCHAR Length;     // Number of text records following this one
+   UCHAR Data[8];    // Event specific data
+};
+
+class Tracefile
+//*********
+// One global instance of this class should be declared by each peripheral
+// DLL and shared by all of its component instances. Every component instance
+// calls open() from On_simulation_begin() and close() from
+// On_simulation_end(). The file is created by the first open() and closed by
+// the last close().
+//
+// Records must be added from a single thread (the VMLAB simulation thread).
+// The background thread only uses Win32 API calls, so it's safe with the
+// single-threaded run time library used to build the peripherals.
+{
+private:
+   enum { RING_SIZE = 4096 };         // Must be a power of two
+
+   TRACE_RECORD Ring[RING_SIZE];      // Records waiting to be written
+   volatile LONG Head;                // Next record written by producer
+   volatile LONG Tail;                // Next record read by writer thread
+   UINT Dropped;                      // Records lost since last TRC_DROPPED
+   UINT Unwritten;                    // Records lost since last TRC_FAILED
+   UINT Lost;                         // All records lost to write errors
+
+   const char *Format[TRACE_FORMATS]; // Log() formats already recorded
+   char Format_args[TRACE_FORMATS][TRACE_ARGS + 1]; // Argument types
+   int Formats;                       // Number of entries in Format[]
+
+   HANDLE File;                       // Trace file or INVALID_HANDLE_VALUE
+   HANDLE Thread;                     // Background writer thread
+   HANDLE Wakeup;                     // Signaled to make thread drain ring
+   volatile LONG Stop;                // Set to make writer thread exit
+   int Users;                         // Count of open() without close()
+
+   bool push(const TRACE_RECORD &pRecord);
+   bool push_data(TRACE_RECORD &pRecord, const void *pData, UINT pSize);
+   bool push_text(UINT pCycle, int pEvent, int pInstance, const char *pText,
+      int pRegister = 0);
+   int find_format(UINT pCycle, int pInstance, const char *pFormat);
+   bool write_file(const void *pData, DWORD pSize);
+   void drain();
+
+   static DWORD WINAPI Writer(LPVOID pThis);
+
+public:
+   Tracefile();
+   ~Tracefile();
+
+   bool open(const char *pName, UINT pCycle, int pInstance);
+   UINT close();
+
+   // True if a trace file is open and records should be added
+   bool active() const { return File != INVALID_HANDLE_VALUE; }
+
+   void message(UINT pCycle, int pInstance, const char *pText);
+   void log(UINT pCycle, int pInstance, const char *pFormat, va_list pArgs);
+   void regname(UINT pCycle, int pInstance, int pId, const char *pText);
+   void write(UINT pCycle, int pInstance, int pId, UCHAR pOld_d, UCHAR pOld_x,
+      UCHAR pNew_d, UCHAR pNew_x, UCHAR pMask);
+};
+
+// Helper macros for use inside the peripherals, which supply the current cycle
+// count and instance index from the VMLAB API. The WORD8 register values are
+// split into their data and known bit masks. TRACE_BEGIN() also records the
+// name of every register, taken from a REGISTER_NAMES cache, so trcdump.exe
+// can show register names. TRACE_END() prints a message if any records could
+// not be written to the file.
+#define TRACE_BEGIN(t, names) \
+   if((t).open(GET_INSTANCE(), GET_MICRO_INFO(INFO_CPU_CYCLES), \
+      PRIVATE::_Instance_index)) { \
+      FOREACH_REGISTER(_id) { \
+         (t).regname(GET_MICRO_INFO(INFO_CPU_CYCLES), \
+            PRIVATE::_Instance_index, _id, (names)[_id]); \
+      } \
+   }
+#define TRACE_END(t) \
+   if((t).close()) { \
+      PRINT("Error writing trace file; some records were lost"); \
+   }
+#define TRACE_MESSAGE(t, s) \
+   (t).message(GET_MICRO_INFO(INFO_CPU_CYCLES), PRIVATE::_Instance_index, s)
+#define TRACE_LOG(t, f, a) \
+   (t).log(GET_MICRO_INFO(INFO_CPU_CYCLES), PRIVATE::_Instance_index, f, a)
+#define TRACE_WRITE(t, id, old, new, mask) \
+   (t).write(GET_MICRO_INFO(INFO_CPU_CYCLES), PRIVATE::_Instance_index, id, \
+      (old).d(), (old).x(), (new).d(), (new).x(), mask)
+
+inline bool Trace_format_args(const char *pFormat, char *pTypes)
+//*************************
+// Fill pTypes with one character for each argument used by the printf() style
+// pFormat: 'i' for an integer, 'f' for a double, or 's' for a string, and a
+// terminating zero. Used by Tracefile::log() to record the arguments and by
+// trcdump.exe to decode them. Returns false if the format has more than
+// TRACE_ARGS arguments or uses a conversion that cannot be recorded.
+{
+   int count = 0;
+
+   for(const char *p = pFormat; *p; p++) {
+      if(*p != '%') {
+         continue;
+      }
+      if(*++p == '%') {
+         continue;
+      }
+
+      // Flags, width, precision, and size prefixes do not take arguments
+      while(*p && strchr("-+ #0123456789.hl", *p)) {
+         p++;
+      }
+      if(count == TRACE_ARGS) {
+         return false;
+      }
+      if(*p && strchr("diouxXcp", *p)) {
+         pTypes[count++] = 'i';
+      } else if(*p && strchr("eEfgG", *p)) {
+         pTypes[count++] = 'f';
+      } else if(*p == 's') {
+         pTypes[count++] = 's';
+      } else {
+         return false;
+      }
+   }
+
+   pTypes[count] = '\0';
+   return true;
+}
+
+#endif // #ifndef _TRACE_H
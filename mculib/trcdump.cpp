@@ -0,0 +1,230 @@
+// Command line tool to decode the binary trace files written by the Tracefile
+// class (see trace.h) into readable text. Usage: trcdump <file.trc>
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#pragma hdrstop
+#include "trace.h"
+
+// Longest text string or Log() arguments which can follow a record
+#define MAXTEXT (255 * sizeof(TRACE_RECORD))
+
+// Instance names from TRC_NAME records, indexed by TRACE_RECORD::Instance
+char *Names[256];
+
+// Register names from TRC_REGNAME records, indexed by Instance and Register
+char *Registers[256][256];
+
+// Log() formats from TRC_FORMAT records, indexed by format ID
+char *Formats[TRACE_FORMATS];
+
+char *Copy_text(char *pOld, const char *pText)
+//*************************
+// Replace a previously recorded name pOld (may be NULL) with a copy of pText
+{
+   delete[] pOld;
+   return strcpy(new char[strlen(pText) + 1], pText);
+}
+
+bool Read_text(FILE *pFile, const TRACE_RECORD &pRecord, char *pText)
+//*************************
+// Read the text records following pRecord into pText (MAXTEXT + 1 bytes)
+{
+   size_t size = pRecord.Length * sizeof(TRACE_RECORD);
+
+   if(fread(pText, 1, size, pFile) != size) {
+      return false;
+   }
+   pText[size] = '\0';
+   return true;
+}
+
+void Print_value(UCHAR pData, UCHAR pKnown)
+//*************************
+// Print a register value as hex with "?" in place of unknown nibbles
+{
+   putchar('$');
+   putchar((pKnown & 0xF0) == 0xF0 ? "0123456789ABCDEF"[pData >> 4] : '?');
+   putchar((pKnown & 0x0F) == 0x0F ? "0123456789ABCDEF"[pData & 0xF] : '?');
+}
+
+void Print_log(const char *pFormat, const char *pData, size_t pSize)
+//*************************
+// Print a TRC_LOG message by formatting the pSize bytes of recorded arguments
+// in pData with the Log() format string pFormat
+{
+   char types[TRACE_ARGS + 1];
+   if(!Trace_format_args(pFormat, types)) {
+      printf("*** Invalid Log() format: %s\n", pFormat);
+      return;
+   }
+
+   // Each conversion is copied into spec[] and printed on its own, together
+   // with the literal text preceding it
+   char spec[MAXTEXT + 1];
+   const char *type = types;
+   const char *start = pFormat;
+   size_t offset = 0;
+
+   for(const char *p = pFormat; *p; p++) {
+      if(*p != '%') {
+         continue;
+      }
+      if(*++p == '%') {
+         continue;
+      }
+      while(strchr("-+ #0123456789.hl", *p)) {
+         p++;
+      }
+
+      size_t length = p + 1 - start;
+      memcpy(spec, start, length);
+      spec[length] = '\0';
+      start = p + 1;
+
+      if(*type == 'i') {
+         int value = 0;
+         if(offset + sizeof(value) <= pSize) {
+            memcpy(&value, pData + offset, sizeof(value));
+         }
+         offset += sizeof(value);
+         printf(spec, value);
+      } else if(*type == 'f') {
+         double value = 0;
+         if(offset + sizeof(value) <= pSize) {
+            memcpy(&value, pData + offset, sizeof(value));
+         }
+         offset += sizeof(value);
+         printf(spec, value);
+      } else {
+         const char *value = "";
+         if(offset < pSize) {
+            value = pData + offset;
+         }
+         offset += strlen(value) + 1;
+         printf(spec, value);
+      }
+      type++;
+   }
+
+   printf(start);
+   printf("\n");
+}
+
+int main(int argc, char *argv[])
+//*************************
+{
+   if(argc != 2) {
+      fprintf(stderr, "Usage: trcdump <file.trc>\n");
+      return 1;
+   }
+
+   FILE *file = fopen(argv[1], "rb");
+   if(file == NULL) {
+      fprintf(stderr, "Cannot open %s\n", argv[1]);
+      return 1;
+   }
+
+   char signature[sizeof(TRACE_SIGNATURE)];
+   size_t length = strlen(TRACE_SIGNATURE);
+   if(fread(signature, 1, length, file) != length ||
+      memcmp(signature, TRACE_SIGNATURE, length)) {
+      fprintf(stderr, "%s is not a trace file\n", argv[1]);
+      return 1;
+   }
+
+   TRACE_RECORD record;
+   static char text[MAXTEXT + 1];
+
+   while(fread(&record, sizeof(TRACE_RECORD), 1, file) == 1) {
+      if(!Read_text(file, record, text)) {
+         break;
+      }
+
+      const char *name = Names[record.Instance];
+      printf("%10u %-10s ", record.Cycle, name ? name : "?");
+
+      UINT count;
+      switch(record.Event) {
+         case TRC_NAME:
+            Names[record.Instance] = Copy_text(Names[record.Instance], text);
+            printf("Instance %d: %s\n", record.Instance, text);
+            break;
+
+         case TRC_MESSAGE:
+            printf("%s\n", text);
+            break;
+
+         case TRC_REGNAME:
+            Registers[record.Instance][record.Register] =
+               Copy_text(Registers[record.Instance][record.Register], text);
+            printf("Register #%d: %s\n", record.Register, text);
+            break;
+
+         case TRC_FORMAT:
+            Formats[record.Data[0]] =
+               Copy_text(Formats[record.Data[0]], text);
+            printf("Format #%d: %s\n", record.Data[0], text);
+            break;
+
+         case TRC_LOG:
+            if(Formats[record.Data[0]]) {
+               Print_log(Formats[record.Data[0]], text,
+                  record.Length * sizeof(TRACE_RECORD));
+            } else {
+               printf("Log format #%d not recorded\n", record.Data[0]);
+            }
+            break;
+
+         case TRC_WRITE: {
+            const char *reg = Registers[record.Instance][record.Register];
+            if(reg) {
+               printf("Write register %s: ", reg);
+            } else {
+               printf("Write register #%d: ", record.Register);
+            }
+            Print_value(record.Data[0], record.Data[1]);
+            printf(" -> ");
+            Print_value(record.Data[2] & record.Data[4],
+               record.Data[3] | ~record.Data[4]);
+            printf("\n");
+            break;
+         }
+
+         case TRC_DROPPED:
+            memcpy(&count, record.Data, sizeof(count));
+            printf("*** %u trace records lost; ring buffer full\n", count);
+            break;
+
+         case TRC_FAILED:
+            memcpy(&count, record.Data, sizeof(count));
+            printf("*** %u trace records lost; error writing file\n", count);
+            break;
+
+         default:
+            printf("Unknown event %d\n", record.Event);
+            break;
+      }
+   }
+
+   fclose(file);
+   return 0;
+}
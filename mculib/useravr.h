@@ -41,48 +41,67 @@ enum {
    NTF_ACIC_OFF, // COMP -> TIMER1 : Restore input capture when ACSR[ACIC]=0
    NTF_ACIC_0,   // COMP -> TIMER1 : Falling edge on ACSR[ACO] when ACSR[ACIC]=1
    NTF_ACIC_1,   // COMP -> TIMER1 : Rising edge on ACSR[ACO] when ACSR[ACIC]=1
+   NTF_PHASE,    // DUMMY -> TIMER* : Prescaler running again after SLEEP
 };
 
-char *hex(const WORD8 &pData)
+// Timer prescalers owned by the dummy component. Each timer reads the phase of
+// its prescaler from the dummy component instead of keeping its own copy. The
+// dummy DLL exports PSR_CYCLE_EXPORT which returns the I/O clock cycle at which
+// the phase of a prescaler was last 0. Borland adds a leading underscore to
+// the names of exported extern "C" functions.
+enum {PSR_SYNC, PSR_ASY};
+typedef UINT (*PSR_CYCLE_FN)(int pPsr);
+#define PSR_CYCLE_DLL "dummy168.dll"
+#define PSR_CYCLE_EXPORT "_Psr_cycle"
+
+// Prescaler phases kept by the dummy component while SLEEP stops the I/O clock
+// are modulo this value. Since every timer prescaler divisor is a factor of
+// PHASE_MODULO, the phase is enough to know which I/O clock cycle will next
+// increment a timer.
+#define PHASE_MODULO 1024
+
+// String returned by value from hex(). Since each call has its own copy, several
+// hex() calls can be used in one expression. Use the "text" member as the string.
+struct HEX_TEXT {
+   char text[8];
+};
+
+HEX_TEXT hex(const WORD8 &pData)
 //*******************
 // Return a hex string representation of a WORD8 value. If the WORD8 contains any unknown
-// bits then return "$??". Because this function uses a static buffer, the returned string
-// is only valid until the next call to this function.
+// bits then return "$??". The returned string is valid until the end of the expression.
 {
-   static char strBuffer[8];
+   HEX_TEXT str;
 
    if(pData.known())
-      snprintf(strBuffer, 8, "$%02X", pData.d());
+      snprintf(str.text, 8, "$%02X", pData.d());
    else
-      snprintf(strBuffer, 8, "$??");
+      snprintf(str.text, 8, "$??");
    
-   return strBuffer;
+   return str;
 }
 
-char *hex(const WORD16 &pData)
+HEX_TEXT hex(const WORD16 &pData)
 //*******************
 // Return a hex string representation of a WORD16 value. If the WORD16 contains any unknown
-// bits then return "$????". Because this function uses a static buffer, the returned string
-// is only valid until the next call to this function.
+// bits then return "$????". The returned string is valid until the end of the expression.
 {
-   static char strBuffer[8];
+   HEX_TEXT str;
 
    if(pData.known())
-      snprintf(strBuffer, 8, "$%04X", pData.d());
+      snprintf(str.text, 8, "$%04X", pData.d());
    else
-      snprintf(strBuffer, 8, "$????");
+      snprintf(str.text, 8, "$????");
    
-   return strBuffer;
+   return str;
 }
 
-char *reg(int pId)
+char *reg(int pId, char *pBuffer, int pSize)
 //*************************
-// Given a register ID, return the "true" register name that was specified in
-// the .ini file. Because this function uses a static buffer, the returned
-// string is only valid until the next call to this function.
+// Given a register ID, copy the "true" register name that was specified in
+// the .ini file into pBuffer and return pBuffer. This queries the component
+// window every time, so use a REGISTER_NAMES cache for frequent lookups.
 {
-   static char strBuffer[16]; // Register name returned by this function
-
    int gadget;    // The register's gadget ID
    WORD8 *w;      // Dummy argument needed for GetRegisterInfo() call 
    const char *s; // Dummy argument needed for GetRegisterInfo() call
@@ -91,7 +110,8 @@ char *reg(int pId)
    // REGISTERS_VIEW block to retrieve the register's gadget ID.
    gadget = GetRegisterInfo(pId, &w, &s, &s, &s, &s, &s, &s, &s, &s);   
    if(gadget == -1) {
-      return "?";
+      snprintf(pBuffer, pSize, "?");
+      return pBuffer;
    }
    
    // True name was assigned to the static label associated with register.
@@ -99,11 +119,36 @@ char *reg(int pId)
    // use a more indirect way to get static label handle.
    HWND parentHandle = GetParent(GET_HANDLE(gadget));
    HWND labelHandle = GetDlgItem(parentHandle, gadget + 100);
-   GetWindowText(labelHandle, strBuffer, 16);
+   GetWindowText(labelHandle, pBuffer, pSize);
    
-   return strBuffer;
+   return pBuffer;
 }
 
+template<int N>
+class REGISTER_NAMES
+//*************************
+// Per-instance cache of "true" register names, declared inside DECLARE_VAR
+// with _nOfRegisters as the template argument. Each name is looked up with
+// reg() the first time it is needed, so logging register writes does not
+// require a round trip through the component window. Relies on the instance
+// variables being zero initialized by DECLARE_VAR.
+{
+private:
+   char Name[N][16];
+
+public:
+   const char *operator [] (int pId)
+   {
+      if(pId < 0 || pId >= N) {
+         return "?";
+      }
+      if(Name[pId][0] == '\0') {
+         reg(pId, Name[pId], sizeof(Name[pId]));
+      }
+      return Name[pId];
+   }
+};
+
 void SetWindowTextf(HWND pHandle, const char *pFormat, ...)
 //*************************
 // Wrapper around SetWindowText() that provides printf() like functionality
@@ -0,0 +1,270 @@
+// Command line tool to check and time the WORD8 bulk operations in
+// word8ops.h. Every operation is first compared against a simple loop over
+// random data of every length up to MAX_CHECK and every start offset, since
+// the wide implementation handles odd lengths and unaligned arrays separately.
+// Each operation is then timed over a 64 KB array. The tool is built twice:
+// w8bench.exe uses the default wide implementation and w8benchs.exe uses the
+// WORD8_SCALAR one, so the timings of both can be compared. Usage: w8bench
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+class WORD8
+//*********
+// Same memory layout as WORDX<WORDN<UCHAR> > in blackbox.h, but with only the
+// methods used by word8ops.h. The real class cannot be used because the rest
+// of blackbox.h only compiles as part of a component DLL.
+{
+private:
+   UCHAR _x;  // Says, by bit, if data is defined: 1=defined; 0=undefined
+   UCHAR _d;  // The real data
+
+public:
+   WORD8() : _x(0), _d(0) {}
+   WORD8(UCHAR pDefined, UCHAR pData) : _x(pDefined), _d(pData) {}
+
+   UCHAR d() const { return _d; }
+   UCHAR x() const { return _x; }
+   void d(UCHAR pInteger) { _d = pInteger; }
+   void x(UCHAR pInteger) { _x = pInteger; }
+};
+
+#include "word8ops.h"
+
+#if defined(WORD8_SCALAR)
+#define VERSION_NAME "scalar"
+#else
+#define VERSION_NAME "wide"
+#endif
+
+// Longest array used for checking; all shorter lengths are checked as well
+#define MAX_CHECK 67
+
+// Number of elements in the timed arrays and number of passes over them
+#define BENCH_SIZE 65536
+#define BENCH_PASSES 2000
+
+// Extra elements around the checked arrays to detect writes out of bounds
+#define GUARD 4
+
+#define COUNT(x) ((int) (sizeof(x) / sizeof((x)[0])))
+
+// Total number of results that did not match the simple loops
+int Errors;
+
+// Prevents the compiler from discarding the results of the timed operations
+volatile int Sink;
+
+UCHAR Random()
+//************
+// Return a random byte; rand() may only provide 15 bits
+{
+   return (UCHAR) (rand() >> 3);
+}
+
+void Randomize(WORD8 *pDst, int pCount)
+//*************************************
+// Fill pDst with random data. Most elements are fully known as in real use,
+// but some have unknown bits.
+{
+   for(int i = 0; i < pCount; i++) {
+      pDst[i].d(Random());
+      pDst[i].x(Random() < 32 ? Random() : 0xFF);
+   }
+}
+
+void Check(bool pOk, const char *pName, int pLength, int pOffset)
+//***************************************************************
+// Print and count a result that did not match the simple loop
+{
+   if(!pOk) {
+      printf("%s: mismatch with length %d at offset %d\n", pName, pLength,
+         pOffset);
+      Errors++;
+   }
+}
+
+void Check_all()
+//**************
+// Compare every operation against a simple loop for all lengths and offsets
+{
+   WORD8 a[MAX_CHECK + 2 * GUARD], b[MAX_CHECK + 2 * GUARD];
+   WORD8 expect[MAX_CHECK + 2 * GUARD];
+   UCHAR data[MAX_CHECK + GUARD], known[MAX_CHECK + GUARD];
+   UCHAR expectData[MAX_CHECK + GUARD], expectKnown[MAX_CHECK + GUARD];
+
+   for(int len = 0; len <= MAX_CHECK; len++) {
+      for(int off = 0; off < GUARD; off++) {
+      
+         // WORD8_FILL()
+         Randomize(a, COUNT(a));
+         memcpy(expect, a, sizeof(a));
+         WORD8 value(Random(), Random());
+         for(int i = 0; i < len; i++) {
+            expect[off + i] = value;
+         }
+         WORD8_FILL(a + off, value, len);
+         Check(!memcmp(a, expect, sizeof(a)), "WORD8_FILL", len, off);
+
+         // WORD8_COPY() with the source before, at, and after the destination
+         for(int src = off - 2; src <= off + 2; src++) {
+            if(src < 0) {
+               continue;
+            }
+            Randomize(a, COUNT(a));
+            memcpy(expect, a, sizeof(a));
+            memcpy(b, a + src, len * sizeof(WORD8));
+            memcpy(expect + off, b, len * sizeof(WORD8));
+            WORD8_COPY(a + off, a + src, len);
+            Check(!memcmp(a, expect, sizeof(a)), "WORD8_COPY", len, off);
+         }
+
+         // WORD8_KNOWN() and WORD8_EQUAL() with a random mask
+         Randomize(a, COUNT(a));
+         memcpy(b, a, sizeof(a));
+         if(len && Random() < 128) {
+            int i = off + Random() % len;
+            if(Random() < 128) {
+               b[i].d(b[i].d() ^ (1 << (Random() & 7)));
+            } else {
+               b[i].x(b[i].x() & ~(1 << (Random() & 7)));
+            }
+         }
+         UCHAR mask = Random() < 64 ? 0xFF : Random();
+         UCHAR allKnown = 0xFF, bothKnown = 0xFF, diff = 0;
+         for(int i = off; i < off + len; i++) {
+            allKnown &= a[i].x();
+            bothKnown &= a[i].x() & b[i].x();
+            diff |= a[i].d() ^ b[i].d();
+         }
+         Check(!WORD8_KNOWN(a + off, len, mask) == !((allKnown & mask) == mask),
+            "WORD8_KNOWN", len, off);
+         Check(!WORD8_EQUAL(a + off, b + off, len, mask) ==
+            !((bothKnown & mask) == mask && (diff & mask) == 0),
+            "WORD8_EQUAL", len, off);
+
+         // WORD8_PACK() with and without the known bit masks
+         Randomize(a, COUNT(a));
+         for(int i = 0; i < COUNT(data); i++) {
+            data[i] = expectData[i] = Random();
+            known[i] = expectKnown[i] = Random();
+         }
+         for(int i = 0; i < len; i++) {
+            expectData[off + i] = a[off + i].d();
+            expectKnown[off + i] = a[off + i].x();
+         }
+         WORD8_PACK(data + off, known + off, a + off, len);
+         Check(!memcmp(data, expectData, sizeof(data)) &&
+            !memcmp(known, expectKnown, sizeof(known)), "WORD8_PACK", len, off);
+         Randomize(a, COUNT(a));
+         WORD8_PACK(data + off, NULL, a + off, len);
+         for(int i = 0; i < len; i++) {
+            expectData[off + i] = a[off + i].d();
+         }
+         Check(!memcmp(data, expectData, sizeof(data)) &&
+            !memcmp(known, expectKnown, sizeof(known)), "WORD8_PACK", len, off);
+
+         // WORD8_UNPACK() with and without the known bit masks
+         Randomize(a, COUNT(a));
+         memcpy(expect, a, sizeof(a));
+         for(int i = 0; i < len; i++) {
+            expect[off + i] = WORD8(known[i], data[i]);
+         }
+         WORD8_UNPACK(a + off, data, known, len);
+         Check(!memcmp(a, expect, sizeof(a)), "WORD8_UNPACK", len, off);
+         for(int i = 0; i < len; i++) {
+            expect[off + i] = WORD8(0xFF, data[i]);
+         }
+         WORD8_UNPACK(a + off, data, NULL, len);
+         Check(!memcmp(a, expect, sizeof(a)), "WORD8_UNPACK", len, off);
+      }
+   }
+}
+
+void Report(const char *pName, clock_t pStart)
+//********************************************
+// Print the time per element taken since pStart
+{
+   double seconds = (double) (clock() - pStart) / CLOCKS_PER_SEC;
+   printf("%-14s %8.3f ns/element\n", pName,
+      seconds * 1E9 / ((double) BENCH_SIZE * BENCH_PASSES));
+}
+
+int main()
+//********
+{
+   Check_all();
+   printf("%s implementation: %d mismatches\n", VERSION_NAME, Errors);
+   if(Errors) {
+      return 1;
+   }
+
+   WORD8 *a = new WORD8[BENCH_SIZE];
+   WORD8 *b = new WORD8[BENCH_SIZE];
+   UCHAR *data = new UCHAR[BENCH_SIZE];
+   UCHAR *known = new UCHAR[BENCH_SIZE];
+   Randomize(a, BENCH_SIZE);
+   clock_t start;
+
+   start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      WORD8_FILL(b, WORD8(0xFF, i), BENCH_SIZE);
+   }
+   Report("WORD8_FILL", start);
+
+   start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      WORD8_COPY(b, a, BENCH_SIZE);
+   }
+   Report("WORD8_COPY", start);
+
+   start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      Sink += WORD8_KNOWN(a, BENCH_SIZE);
+   }
+   Report("WORD8_KNOWN", start);
+
+   start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      Sink += WORD8_EQUAL(a, b, BENCH_SIZE);
+   }
+   Report("WORD8_EQUAL", start);
+
+   start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      WORD8_PACK(data, known, a, BENCH_SIZE);
+   }
+   Report("WORD8_PACK", start);
+
+   start = clock();
+   for(int i = 0; i < BENCH_PASSES; i++) {
+      WORD8_UNPACK(b, data, known, BENCH_SIZE);
+   }
+   Report("WORD8_UNPACK", start);
+
+   delete[] a;
+   delete[] b;
+   delete[] data;
+   delete[] known;
+   return 0;
+}
@@ -20,7 +20,9 @@
 
 // NOTE: Because the VMLAB API does not have a "pTime" argument in
 // On_register_write(), it's necessary to keep track of the explicit prescaler
-// counter value and to only use REMIND_ME() with a fixed 128kHz period.
+// counter value. Rather than using a REMIND_ME() on every 128kHz tick, only
+// the tick with the next watchdog timeout is scheduled. The ticks in between
+// are added to the prescaler counter by Sync() based on the elapsed CPU cycles.
 
 #include <windows.h>
 #include <commctrl.h>
@@ -30,6 +32,7 @@
 #define IS_PERIPHERAL       // To distinguish from a normal user component
 #include "blackbox.h"
 #include "useravr.h"
+#include "trace.h"
 #include "wdog.h"
 
 int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
@@ -38,8 +41,14 @@ int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
 // Maximum value allowed in WDP field
 #define MAX_PRESCALER_INDEX 9
 
-// Period of one watchdog timer tick of 128kHz clock
-#define WDOG_PERIOD (1.0 / 128000)
+// Frequency and period of one watchdog timer tick of 128kHz clock
+#define WDOG_CLOCK 128000
+#define WDOG_PERIOD (1.0 / WDOG_CLOCK)
+
+// Maximum number of watchdog ticks (one second) scheduled by a single
+// REMIND_ME(). Bounds the error in Elapsed_ticks() if the CPU clock frequency
+// changes and keeps the counter updated when the prescaler is unknown.
+#define MAX_TICKS 128000
 
 // Watchdog mode as a combination of WDE and WDIE bits
 const char *Mode_text[] = {
@@ -92,13 +101,21 @@ DECLARE_VAR
    UINT Count;            // Current prescaler counter value
    int Prescaler;         // Prescaler divisor selected by WDP bits
    int Tick_signature;    // For REMIND_ME, to validate ticks
+   bool Running;          // True if watchdog enabled and ticks are scheduled
+   UINT Base;             // CPU cycle of the last tick in On_remind_me()
+   UINT Done;             // Ticks since Base already added to Count
+   UINT Aim;              // Tick after Base for which REMIND_ME() is pending
    // TODO: Need a separate signature for the autoclear
    
    bool Log;              // True if the "Log" checkbox button is checked
    bool Dirty;            // True if "Mode" and "Clock" fields need update
    bool Dirty_time;       // True if "Time Left" field needs update
+
+   REGISTER_NAMES<_nOfRegisters> Reg_names; // Cached names for reg()
 END_VAR
 
+Tracefile Trace;          // Binary trace file shared by all instances
+
 USE_WINDOW(WINDOW_USER_1); // Window to display registers, etc. See .RC file
 
 REGISTERS_VIEW
@@ -113,34 +130,41 @@ END_VIEW
 // Extract the Watchdog Timer Prescaler (WDP) bits and return as single field
 int Wdp(const WORD8 &pData)
 {
-   return ((pData & 0x7) | ((pData & 0x20) >> 2)).get_field(3, 0);
+   return ((pData & 0x7) | ((pData & 0x20) >> 2)).field<3, 0>();
 }
 
 //*************************
 // Extract the WDE and WDIE bits as a single field
 int Mode(const WORD8 &pData)
 {
-   return (((pData & 0x8) >> 2) | ((pData & 0x40) >> 6)).get_field(1, 0);
+   return (((pData & 0x8) >> 2) | ((pData & 0x40) >> 6)).field<1, 0>();
 }
 
 void Log(const char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
 // This function also automatically prepends the instance name to the formatted
-// message. The message is only printed if logging is enabled in GUI.
+// message. The message is only printed if logging is enabled in GUI. If a
+// trace file is open then only the format and arguments are added to the
+// trace file, and trcdump.exe formats the message. pFormat must be a string
+// literal.
 {
    if(VAR(Log)) {   
-      char strBuffer[MAXBUF];
       va_list argList;
+      va_start(argList, pFormat);
 
-      snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
-      int len = strlen(strBuffer);
+      // The trace file records the instance so it's not part of the message
+      if(Trace.active()) {
+         TRACE_LOG(Trace, pFormat, argList);
+      } else {
+         char strBuffer[MAXBUF];
+         snprintf(strBuffer, MAXBUF, "%s: ", GET_INSTANCE());
+         int len = strlen(strBuffer);
+         vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
+         PRINT(strBuffer);
+      }
 
-      va_start(argList, pFormat);
-      vsnprintf(strBuffer + len, MAXBUF - len, pFormat, argList);
       va_end(argList);
-
-      PRINT(strBuffer);
    }
 }
 
@@ -152,44 +176,112 @@ void Log_register_write(int pId, WORD8 pData, unsigned char pMask)
 // unknown bits in the pMask position then issue a warning. In either case
 // Log() a message indicating the register is being written with pData. The
 // pId is used to look up the true register name (as given in the .ini file)
-// for the warning and log messages.
+// for the warning and log messages. If a trace file is open, known writes
+// are recorded in binary form together with the old register value.
 {
    if((pData.x() & pMask) != pMask) {      
       char strBuffer[64];
-      char *strName = reg(pId);      
+      const char *strName = VAR(Reg_names)[pId];      
       
       snprintf(strBuffer, 64, "Unknown bits (X) written into %s register",
          strName);
          
       WARNING(strBuffer, CAT_MEMORY, WARN_MEMORY_WRITE_X_IO);
       Log("Write register %s: $??", strName);      
+   } else if(VAR(Log) && Trace.active()) {
+      TRACE_WRITE(Trace, pId, REG(pId), pData, pMask);
    } else {
-      if(VAR(Log)) { // Don't waste time in reg() if not logging
-         char *strName = reg(pId);
+      if(VAR(Log)) { // Don't waste time if not logging
+         const char *strName = VAR(Reg_names)[pId];
          Log("Write register %s: $%02X", strName, pData.d() & pMask);
       }
    }
 }
 
+double Elapsed_ticks()
+//*************************
+// Return the number of watchdog ticks (including any fraction of a tick) since
+// the tick at VAR(Base), computed from the CPU cycle count and the current CPU
+// clock frequency. Never negative even if the cycle count went backwards.
+{
+   int cycles = (int) ((UINT) GET_MICRO_INFO(INFO_CPU_CYCLES) - VAR(Base));
+   return cycles > 0 ? cycles * (double) WDOG_CLOCK / GET_CLOCK() : 0;
+}
+
 void Go()
 //*************************
-// Schedule the next watchdog timer tick
+// Schedule the watchdog tick with the next timeout, or MAX_TICKS from the last
+// tick counted if that is sooner or the prescaler divisor is unknown. Called
+// when the watchdog starts, after every timeout tick, and whenever the counter
+// or divisor changes. Invalidates any tick that may already be pending.
 {
+   UINT ticks = MAX_TICKS;
+   if(VAR(Prescaler)) {
+      UINT left = VAR(Prescaler) - VAR(Count) % VAR(Prescaler);
+      if(left < ticks) {
+         ticks = left;
+      }
+   }
+   VAR(Aim) = VAR(Done) + ticks;
+
+   double delay = (VAR(Aim) - Elapsed_ticks()) * WDOG_PERIOD;
    VAR(Tick_signature) += 2;            
-   REMIND_ME(WDOG_PERIOD, VAR(Tick_signature));
+   REMIND_ME(delay > 0 ? delay : 0, VAR(Tick_signature));
+}
+
+void Start()
+//*************************
+// Start the watchdog with its first tick one 128kHz period from now
+{
+   VAR(Running) = true;
+   VAR(Base) = (UINT) GET_MICRO_INFO(INFO_CPU_CYCLES);
+   VAR(Done) = 0;
+   Go();
+}
+
+void Stop()
+//*************************
+// Stop the watchdog and cancel the pending tick
+{
+   VAR(Running) = false;
+   VAR(Tick_signature) += 2;
+}
+
+void Sync()
+//*************************
+// Add the watchdog ticks that elapsed since the last Sync() to the prescaler
+// counter. Called before the counter or the watchdog configuration is used or
+// changed. The tick scheduled by Go() is always left for Count().
+{
+   if(!VAR(Running)) {
+      return;
+   }
+
+   UINT elapsed = (UINT) Elapsed_ticks();
+   if(elapsed >= VAR(Aim)) {
+      elapsed = VAR(Aim) - 1;
+   }
+   if(elapsed > VAR(Done)) {
+      VAR(Count) += elapsed - VAR(Done);
+      VAR(Done) = elapsed;
+      VAR(Dirty_time) = true;
+   }
 }
 
 void Count()
 //*************************
-// Called on every tick of the watchdog timer if the watchdog is enabled
-// (i.e. WDE/WDIE are both known and at least one is true). Increments the
-// prescaler counter, checks counter against the prescaler divisor for
-// a watchdog timeout, and schedules a new watchdog timer tick.
+// Called on the tick scheduled by Go() if the watchdog is enabled (i.e.
+// WDE/WDIE are both known and at least one is true). Adds all ticks not yet
+// counted by Sync() to the prescaler counter, checks counter against the
+// prescaler divisor for a watchdog timeout, and schedules the next tick.
 {
    // Increment the prescaler counter. Real counter is only 20 bits but for
    // the modulo arithmetic it doesn't matter that a 32 bit integer is used.
-   // The "Time_left" field will also need updating as a result.
-   VAR(Count)++;
+   // The "Time_left" field will also need updating as a result. This tick
+   // becomes the new reference point for Elapsed_ticks().
+   VAR(Count) += VAR(Aim) - VAR(Done);
+   VAR(Base) = (UINT) GET_MICRO_INFO(INFO_CPU_CYCLES);
+   VAR(Done) = 0;
    VAR(Dirty_time) = true;
 
    // Schedule next timer tick to keep watchdog running. If watchdog becomes
@@ -206,7 +298,7 @@ void Count()
       // If WDIE=1 then using either Interrupt or Interrupt/Reset mode
       if(REG(WDTCSR)[6] == 1) {
          SET_INTERRUPT_FLAG(WDT, FLAG_SET);
-         REG(WDTCSR).set_bit(7, 1);
+         REG(WDTCSR).bit<7>(1);
       }
       
       // Otherwise WDE=1 should be set for Reset only mode
@@ -238,6 +330,8 @@ void On_simulation_begin()                //     "        "
 // happens inside On_reset() since that will always get called immediately
 // after On_simulation_begin().
 {
+   TRACE_BEGIN(Trace, VAR(Reg_names));
+
    // Save the state of the WDTON fuse which locks the WDE and WDIE bits
    // to respectively 1 and 0, forcing the watchdog into system reset mode.
    VAR(Wdton) = GET_FUSE("WDTON") == 0;
@@ -257,12 +351,15 @@ void On_simulation_begin()                //     "        "
 
    // The count is not zeroed on a reset because watchdog keeps runnning
    VAR(Count) = 0;
+   VAR(Running) = false;
 }
 
 void On_simulation_end()
 //**********************
 // If the simulation is ending, set all registers and text fieds to unknown.
 {
+   TRACE_END(Trace);
+
    REG(WDTCSR) = WORD8(0, 0);
    SetWindowText(GET_HANDLE(GDT_MODE), "?");
    SetWindowText(GET_HANDLE(GDT_CLOCK), "?");
@@ -275,6 +372,7 @@ void On_simulation_end()
    
    // WDRF bit in MCUSR is always 0 after a power-on reset
    VAR(Wdrf) = false;
+   Stop();
 }
 
 void On_register_write(REGISTER_ID pId, WORD8 pData)
@@ -286,6 +384,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
    switch(pId) {
       case WDTCSR:
          Log_register_write(WDTCSR, pData, VAR(Mask));
+         Sync();
 
          int oldMode = Mode(REG(WDTCSR));
 
@@ -331,14 +430,14 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
             } else if(REG(WDTCSR)[4] != 1) {
                Warn("Cannot set WDE=0 if WDCE is not already set");
             } else {
-               REG(WDTCSR).set_bit(3, 0);
+               REG(WDTCSR).bit<3>(0);
             }
          }
          
          // If WDTON=0 (programmed) then WDE is read only and always 1
          // If WDTON=1 then writing WDE=X or WDE=1 always allowed
          else if(!VAR(Wdton)) { 
-            REG(WDTCSR).set_bit(3, pData[3]);
+            REG(WDTCSR).bit<3>(pData[3]);
          }
          
          // Bit 4 - WDCE: Watchdog Change Enable
@@ -347,7 +446,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          // was already set to 1 in WDTCSR.
          if(pData[4] == 1 && REG(WDTCSR)[4] != 1) {
             if(pData[3] == 1) {
-               REG(WDTCSR).set_bit(4, 1);
+               REG(WDTCSR).bit<4>(1);
                REMIND_ME2(4, RMD_AUTOCLEAR_WDCE);
             } else {
                Warn("Must write both WDCE=1 and WDE=1 to set WDCE");          
@@ -356,12 +455,12 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          
          // Writing WDCE=X only allowed if WDE=1 or WDE=X
          else if(pData[4] == UNKNOWN && REG(WDTCSR)[3] != 0) {
-            REG(WDTCSR).set_bit(4, UNKNOWN);
+            REG(WDTCSR).bit<4>(UNKNOWN);
          }
 
          // Writing WDCE=0 is always allowed
          else if(pData[4] == 0) {
-            REG(WDTCSR).set_bit(4, 0);
+            REG(WDTCSR).bit<4>(0);
          }
          
          // Bit 6 - WDIE: Watchdog Interrupt Enable
@@ -376,7 +475,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          // Writing WDIE=X silently ignored if WDTON programmed
          else if(!VAR(Wdton)) { 
             SET_INTERRUPT_ENABLE(WDT, pData[6] == 1);
-            REG(WDTCSR).set_bit(6, pData[6]);
+            REG(WDTCSR).bit<6>(pData[6]);
          }
          
          // Bit 7 - WDIF: Watchdog Interrupt Flag
@@ -384,7 +483,7 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
          // Writing WDIF=1 clears interrupt flag; writing WDIF=0 has no effect
          if(pData[7] == 1) {
             SET_INTERRUPT_FLAG(WDT, FLAG_CLEAR);
-            REG(WDTCSR).set_bit(7, 0);
+            REG(WDTCSR).bit<7>(0);
          }
 
          // Log changes made to the timer's mode (WDIE and WDE fields)
@@ -396,12 +495,17 @@ void On_register_write(REGISTER_ID pId, WORD8 pData)
 
          // If watchdog just became enabled, then schedule new tick
          if(oldMode <= 0 && newMode > 0) {
-            Go();
+            Start();
          }
          
          // If watchdog just became disabled, then cancel pending tick
-         if(oldMode > 0 && newMode <= 0) {
-            VAR(Tick_signature) += 2;
+         else if(oldMode > 0 && newMode <= 0) {
+            Stop();
+         }
+         
+         // A new prescaler divisor changes when the next timeout happens
+         else if(VAR(Running) && newWdp != oldWdp) {
+            Go();
          }
          
          break;
@@ -423,6 +527,7 @@ void On_reset(int pCause)
    // If fuse WDTON=0 (programmed) or WRDF=1 in MCUSR (either from this
    // RESET_WATCHDOG, from a previous RESET_WATCHDOG, or because AVR code
    // previously set WRDF=1 manually) then WDE=1 after reset.
+   Sync();
    int oldMode = Mode(REG(WDTCSR));
    if(VAR(Wdton) || VAR(Wdrf)) {
       REG(WDTCSR) = 0x08;
@@ -438,14 +543,26 @@ void On_reset(int pCause)
    // power on reset or because user initiated watchdog reset from GUI)
    // then schedule the first watchdog timer tick.
    if(oldMode <= 0 && newMode > 0) {
-      Go();
+      Start();
    }
    
    // If watchdog was already running and became disabled after reset
    // (e.g. WDIE was 1 before an external reset) then invalidate pending
    // timer tick.
-   if(oldMode > 0 && newMode <= 0) {
-      VAR(Tick_signature) += 2;
+   else if(oldMode > 0 && newMode <= 0) {
+      Stop();
+   }
+
+   // If the watchdog keeps running, the prescaler divisor may have changed.
+   // If the CPU cycle count restarted due to the reset, then the current time
+   // becomes the new reference point for Elapsed_ticks().
+   else if(VAR(Running)) {
+      UINT cycles = (UINT) GET_MICRO_INFO(INFO_CPU_CYCLES);
+      if((int) (cycles - VAR(Base)) < 0) {
+         VAR(Base) = cycles;
+         VAR(Done) = 0;
+      }
+      Go();
    }
 
    // Force the GUI to display new values
@@ -455,7 +572,7 @@ void On_reset(int pCause)
 
 void On_remind_me(double pTime, int pAux)
 //***************************************
-// Response to REMIND_ME() used implement the watchdog timeer ticks and the
+// Response to REMIND_ME() used implement the watchdog timeout ticks and the
 // autoclearing of the WDCE bit 4 system clock cycles after it was set.
 {
    switch(pAux) {
@@ -463,7 +580,7 @@ void On_remind_me(double pTime, int pAux)
          if(REG(WDTCSR)[4] != 0) {
             Warn("WDCE cleared by hardware; previously set 4 cycles ago");
          }
-         REG(WDTCSR).set_bit(4, 0);
+         REG(WDTCSR).bit<4>(0);
          break;
          
       default:
@@ -484,8 +601,12 @@ void On_notify(int pWhat)
    
       // The WDR instruction was executed; reset watchdog counter
       case NTF_WDR:
+         Sync();
          VAR(Count) = 0;
          VAR(Dirty_time) = true;
+         if(VAR(Running)) {
+            Go();
+         }
          break;
 
       // The WDRF bit in MCUSR was cleared; WDE is read-write again
@@ -498,9 +619,9 @@ void On_notify(int pWhat)
       case NTF_WDRF1:
          VAR(Wdrf) = true;
          if(Mode(REG(WDTCSR)) <= 0) {
-            Go();
+            Start();
          }
-         REG(WDTCSR).set_bit(3, 1);
+         REG(WDTCSR).bit<3>(1);
          VAR(Dirty) = true;
          break;
    }
@@ -522,6 +643,9 @@ void On_update_tick(double pTime)
 // remaining time based on the current "pTime". The rest of the GUI is only
 // updated if the WDTCSR register has changed since the last On_update_tick().
 {
+   // Count the ticks elapsed since the last timeout or register access
+   Sync();
+
    // Update "Time Left" If either prescaler divisor or count changed
    if(VAR(Dirty_time)) {
    
@@ -563,12 +687,12 @@ void On_interrupt_start(INTERRUPT_ID pId)
    switch(pId) {
       case WDT:
          // Acknowledge the interrupt by clearing the interrupt flag
-         REG(WDTCSR).set_bit(7, 0);
+         REG(WDTCSR).bit<7>(0);
          
          // If WDE=1 (Interrupt and Reset), then set WDIE=0 (Reset only)
          if(REG(WDTCSR)[3] == 1) {
             SET_INTERRUPT_ENABLE(WDT, false);
-            REG(WDTCSR).set_bit(6, 0);
+            REG(WDTCSR).bit<6>(0);
             VAR(Dirty) = true;
          }
          
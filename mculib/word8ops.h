@@ -0,0 +1,196 @@
+// Bulk operations on contiguous WORD8 arrays, such as the register array
+// behind REG() or the EEPROM contents returned by GET_MICRO_DATA(). These work
+// directly on the known and data bytes instead of building temporary WORD32
+// values for every element. Included by blackbox.h after the WORD8 class;
+// w8bench.cpp includes it on its own to check and time both implementations.
+//
+// Copyright (C) 2010 Wojciech Stryjewski <thvortex@gmail.com>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+//
+
+#ifndef _WORD8OPS_H
+#define _WORD8OPS_H
+
+#include <string.h>
+
+// The implementation is selected at build time. By default, the wide version
+// handles two elements at a time as a single 32-bit word. This relies on the
+// WORDN<UCHAR> layout of a WORD8: the known bit mask byte followed by the data
+// byte with no padding, which is also the layout VMLAB itself uses. Define
+// WORD8_SCALAR to use simple loops over the d() and x() methods instead.
+//
+namespace PRIVATE {
+   typedef char _WORD8_SIZE_CHECK[sizeof(WORD8) == 2 ? 1 : -1];
+
+#if !defined(WORD8_SCALAR)
+   // Bytes holding the known bit masks of the two elements in a 32-bit word
+   const UINT _WORD8_KNOWN = 0x00FF00FF;
+
+   // Elements may be at any address, so memcpy() is used for the unaligned
+   // access. Borland's -Oi flag expands it to a single move instruction.
+   inline UINT _Load_pair(const WORD8 *pSrc)
+      { UINT pair; memcpy(&pair, pSrc, sizeof(pair)); return pair; }
+   inline void _Store_pair(WORD8 *pDst, UINT pPair)
+      { memcpy((void *) pDst, &pPair, sizeof(pPair)); }
+#endif
+}
+
+inline void WORD8_FILL(WORD8 *pDst, WORD8 pValue, int pCount)
+//***********************************************************
+// Set pCount elements of pDst to pValue
+{
+   UCHAR data = pValue.d(), known = pValue.x();
+   int i = 0;
+#if !defined(WORD8_SCALAR)
+   UINT pair = known | (data << 8);
+   pair |= pair << 16;
+   for(; i + 2 <= pCount; i += 2) {
+      PRIVATE::_Store_pair(pDst + i, pair);
+   }
+#endif
+   for(; i < pCount; i++) {
+      pDst[i].d(data);
+      pDst[i].x(known);
+   }
+}
+
+inline void WORD8_COPY(WORD8 *pDst, const WORD8 *pSrc, int pCount)
+//****************************************************************
+// Copy pCount elements from pSrc to pDst. The arrays may overlap.
+{
+#if !defined(WORD8_SCALAR)
+   if(pCount > 0) {
+      memmove(pDst, pSrc, pCount * sizeof(WORD8));
+   }
+#else
+   if(pDst < pSrc) {
+      for(int i = 0; i < pCount; i++) {
+         pDst[i] = pSrc[i];
+      }
+   } else if(pDst > pSrc) {
+      for(int i = pCount - 1; i >= 0; i--) {
+         pDst[i] = pSrc[i];
+      }
+   }
+#endif
+}
+
+inline BOOL WORD8_KNOWN(const WORD8 *pSrc, int pCount, UCHAR pMask = 0xFF)
+//************************************************************************
+// Return true if the bits selected by pMask are known in all pCount elements
+{
+   UCHAR known = 0xFF;
+   int i = 0;
+#if !defined(WORD8_SCALAR)
+   UINT pairs = ~0U;
+   for(; i + 2 <= pCount; i += 2) {
+      pairs &= PRIVATE::_Load_pair(pSrc + i);
+   }
+   known = (UCHAR) (pairs & (pairs >> 16));
+#endif
+   for(; i < pCount; i++) {
+      known &= pSrc[i].x();
+   }
+   return (known & pMask) == pMask;
+}
+
+inline BOOL WORD8_EQUAL(const WORD8 *pA, const WORD8 *pB, int pCount,
+   UCHAR pMask = 0xFF)
+//********************************************************************
+// Compare the bits selected by pMask in pCount elements of both arrays.
+// Like the == operator, the result is false if any compared bit is unknown.
+// There is no early exit, so the time taken does not depend on the data.
+{
+   UCHAR known = 0xFF;
+   UCHAR diff = 0;
+   int i = 0;
+#if !defined(WORD8_SCALAR)
+   UINT pairsKnown = ~0U, pairsDiff = 0;
+   for(; i + 2 <= pCount; i += 2) {
+      UINT a = PRIVATE::_Load_pair(pA + i);
+      UINT b = PRIVATE::_Load_pair(pB + i);
+      pairsKnown &= a & b;
+      pairsDiff |= a ^ b;
+   }
+   known = (UCHAR) (pairsKnown & (pairsKnown >> 16));
+   diff = (UCHAR) ((pairsDiff >> 8) | (pairsDiff >> 24));
+#endif
+   for(; i < pCount; i++) {
+      known &= pA[i].x() & pB[i].x();
+      diff |= pA[i].d() ^ pB[i].d();
+   }
+   return (known & pMask) == pMask && (diff & pMask) == 0;
+}
+
+inline void WORD8_PACK(UCHAR *pData, UCHAR *pKnown, const WORD8 *pSrc,
+   int pCount)
+//********************************************************************
+// Split pCount elements of pSrc into a plain data byte array and a byte array
+// of known bit masks (1=known). pKnown may be NULL if not needed.
+{
+   int i = 0;
+#if !defined(WORD8_SCALAR)
+   if(pKnown) {
+      for(; i + 2 <= pCount; i += 2) {
+         UINT pair = PRIVATE::_Load_pair(pSrc + i);
+         pKnown[i] = (UCHAR) pair;
+         pData[i] = (UCHAR) (pair >> 8);
+         pKnown[i + 1] = (UCHAR) (pair >> 16);
+         pData[i + 1] = (UCHAR) (pair >> 24);
+      }
+   } else {
+      for(; i + 2 <= pCount; i += 2) {
+         UINT pair = PRIVATE::_Load_pair(pSrc + i);
+         pData[i] = (UCHAR) (pair >> 8);
+         pData[i + 1] = (UCHAR) (pair >> 24);
+      }
+   }
+#endif
+   for(; i < pCount; i++) {
+      pData[i] = pSrc[i].d();
+      if(pKnown) {
+         pKnown[i] = pSrc[i].x();
+      }
+   }
+}
+
+inline void WORD8_UNPACK(WORD8 *pDst, const UCHAR *pData,
+   const UCHAR *pKnown, int pCount)
+//********************************************************
+// Rebuild pCount elements of pDst from a data byte array and a byte array of
+// known bit masks. If pKnown is NULL, then all bits are known.
+{
+   int i = 0;
+#if !defined(WORD8_SCALAR)
+   if(pKnown) {
+      for(; i + 2 <= pCount; i += 2) {
+         PRIVATE::_Store_pair(pDst + i, pKnown[i] | (pData[i] << 8) |
+            (pKnown[i + 1] << 16) | ((UINT) pData[i + 1] << 24));
+      }
+   } else {
+      for(; i + 2 <= pCount; i += 2) {
+         PRIVATE::_Store_pair(pDst + i, PRIVATE::_WORD8_KNOWN |
+            (pData[i] << 8) | ((UINT) pData[i + 1] << 24));
+      }
+   }
+#endif
+   for(; i < pCount; i++) {
+      pDst[i].d(pData[i]);
+      pDst[i].x(pKnown ? pKnown[i] : 0xFF);
+   }
+}
+
+#endif // _WORD8OPS_H
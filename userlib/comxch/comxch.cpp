@@ -47,6 +47,23 @@
 // input, but no flow control for the COM port output. The comxchx component uses no
 // flow control in either direction.
 //
+// Instead of a COM port, an instance name of the form TCP<N> (e.g. "TCP4000")
+// connects to TCP port <N> on the local machine when the simulation starts. This
+// allows test scripts to exchange data with the simulation without installing a
+// virtual COM port driver (under Wine, a COM<N> name can also be mapped to a Linux
+// pty in the dosdevices directory). The data stream is sent as-is, except that
+// the byte 0xFF is used as an escape. A 0xFF data byte is sent as 0xFF 0xFF, and
+// 0xFF followed by any other byte is an out-of-band control byte which carries the
+// complete state of the modem control lines:
+//
+// Sent by component     : 0x01=RTS 0x02=DTR 0x04=OUT1 0x08=OUT2 0x10=BREAK
+// Received by component : 0x01=CTS 0x02=DSR 0x04=RI 0x08=DCD 0x10=BREAK
+//                         0x20=FRAMING ERROR 0x40=PARITY ERROR
+//
+// A received BREAK, FRAMING ERROR, or PARITY ERROR applies to the data byte that
+// follows it, exactly like a COM port error. The <Baud> and other format arguments
+// still control the timing of the <TX> and <RX> pins.
+//
 // Version History:
 // v1.0 01/27/09 - Detect COM port receiver overrun; added comxchx component
 // v0.3 01/22/09 - Pass break/parity/framing errors from COM port to TX
@@ -86,9 +103,11 @@
 //
 
 #include <windows.h>
+#include <winsock.h>
 #include <commctrl.h>
 #include <winioctl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <ctype.h>
 #pragma hdrstop
@@ -129,9 +148,66 @@ int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
 // Defines for REMIND_ME() fucntion 'pData' auxiliary parameter.
 #define TX_END      1
 #define RX_END      2
-#define RX_DATA     3
-#define RX_PARITY   4
-#define RX_STOP     5
+
+// Maximum number of RX pin edges recorded during one character. A frame has
+// at most 12 bit periods (start, 8 data, parity, 2 stop bits) and the edges
+// are only recorded after the start bit, so there can never be more than 11.
+#define RX_MAXEDGES 12
+
+// Number of entries in each ring buffer filled by the I/O thread. Must be a
+// power of two so the ring indexes can simply wrap with a bitmask.
+#define RING_SIZE   4096
+
+// Line status events queued into the receive ring in front of the data byte
+// they apply to. Values above 0xFF can never be mistaken for a data byte.
+#define RING_BREAK   0x100
+#define RING_FRAME   0x101
+#define RING_PARITY  0x102
+#define RING_OVERRUN 0x103
+
+// Escape byte and out-of-band control bits used by the TCP<N> transport. See
+// the description at the top of this file.
+#define SOCK_ESCAPE  0xFF
+#define LINE_RTS     0x01  // Sent by component
+#define LINE_DTR     0x02
+#define LINE_OUT1    0x04
+#define LINE_OUT2    0x08
+#define LINE_CTS     0x01  // Received by component
+#define LINE_DSR     0x02
+#define LINE_RI      0x04
+#define LINE_DCD     0x08
+#define LINE_BREAK   0x10  // Sent and received
+#define LINE_FRAME   0x20  // Received only
+#define LINE_PARITY  0x40
+
+// Transports supported by the COM_io structure
+enum { TR_SERIAL, TR_SOCKET };
+
+// Lock-free ring buffer with a single producer (the I/O thread) and a single
+// consumer (the VMLAB simulation thread). Only the producer writes Head and
+// only the consumer writes Tail, so no other synchronization is needed.
+struct Ring {
+   volatile LONG Head;    // Index of next entry written by the producer
+   volatile LONG Tail;    // Index of next entry read by the consumer
+   USHORT Data[RING_SIZE];
+};
+
+// State shared between the simulation thread and the background I/O thread
+// of one component instance. Allocated by Open_COM_port() because VAR() can
+// only be used from within the VMLAB callbacks.
+struct COM_io {
+   int Transport;         // TR_SERIAL for COM ports or TR_SOCKET for TCP<N>
+   HANDLE Port;           // Same overlapped handle as VAR(Handle_port)
+   SOCKET Socket;         // Connected socket if Transport is TR_SOCKET
+   BYTE Line_state;       // LINE_XXX bits last sent through the socket
+   DWORD Modem_state;     // MS_XXX_ON bits last queued by Socket_thread()
+   HANDLE Thread;         // Handle of the I/O thread running for this port
+   HANDLE Stop;           // Manual reset event set to terminate the thread
+   OVERLAPPED Write_ov;   // Used for overlapped writes by simulation thread
+   volatile DWORD Error;  // GetLastError() code if the I/O thread has failed
+   Ring Rx;               // Received bytes and RING_XXX line status events
+   Ring Modem;            // GetCommModemStatus() value after each change
+};
 
 DECLARE_PINS
    DIGITAL_OUT(TX, 1);  
@@ -150,6 +226,7 @@ END_PINS
 
 DECLARE_VAR
    HANDLE Handle_port;    // Win32 handle to COMx port
+   COM_io *Io;            // Rings and thread for background port I/O
 
    int Baud_rate;         // Baud rate as specified by user
    int Data_bits;         // Number of data bits from instance arguments
@@ -170,17 +247,34 @@ DECLARE_VAR
    BYTE RX_byte;          // Where byte received is being stored
    LOGIC RX_parity;       // Where received parity bit is being stored
    int RX_stopbits;       // Where number of stop bits received is counted
+   double RX_start;       // Time of the falling edge of the start bit
+   double RX_edges[RX_MAXEDGES]; // Time of every RX edge during the frame
+   LOGIC RX_levels[RX_MAXEDGES]; // RX pin level after each RX_edges[] edge
+   int RX_edge_count;     // Number of edges recorded in RX_edges[]
    BOOL RX_break;         // Flag indicating if a break condition exists on RX
 END_VAR
 
 // Function prototypes, defined later
 void Open_COM_port();     
+void Open_serial();
+void Open_socket(int pPort);
 void Close_COM_port();
+BOOL Write_COM_port(BYTE pByte);
+BOOL Set_COM_control(BYTE pLine, BOOL pState);
+DWORD WINAPI IO_thread(LPVOID pParam);
+DWORD WINAPI Socket_thread(LPVOID pParam);
+void Socket_control(COM_io *pIo, BYTE pControl);
+
+BOOL Ring_put(Ring *pRing, USHORT pData);
+BOOL Ring_get(Ring *pRing, USHORT &pData);
+LONG Ring_free(Ring *pRing);
            
 BOOL Compute_parity(char pByte);
 BOOL Get_RX();
+void Decode_RX();
 
 void Set_com0com_control(ULONG pControl, ULONG pMask);
+void Set_modem_pins(DWORD pStatus, DWORD pChanged);
 
 void Print_error();              
 void Printf(char *pFormat, ...);
@@ -254,8 +348,20 @@ void On_simulation_begin()
    SET_LOGIC(TX, 1);
 
    Open_COM_port();
+   if(!VAR(Io)) return; // No action if port failed to open
       
 #ifdef COMXCHX
+   // Set the CTS, DSR, RI, and DCD pins to the initial state of the modem
+   // control lines. Later changes are queued by the I/O thread.
+   // With the TCP transport all lines are off until a control byte arrives.
+   DWORD modemStatus = 0;
+   if(VAR(Io)->Transport == TR_SERIAL) {
+      int rc = GetCommModemStatus(VAR(Handle_port), &modemStatus);
+      WIN32_ASSERT(rc, "Error querying COM port control lines");
+   }
+   Set_modem_pins(modemStatus, MS_CTS_ON | MS_DSR_ON | MS_RING_ON | MS_RLSD_ON);
+   VAR(Prev_modem_stat) = modemStatus;
+
    // Read the initial values of the RTS, DTR, OUT1, OUT2 pins and set the modem
    // control lines since On_digital_in_edge() does not get called automatically
    // at the start of the simulation.
@@ -274,14 +380,13 @@ void On_simulation_end()
 
 void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
 //**************************************************************
-// Detect start bit and launch sampling events in the middle of the bit period
-// At the end, depending on the nr. of bits and stop bits, launch a RX_END
-// to indicate myself the end.
+// Detect start bit and launch a single RX_END event in the middle of the last
+// stop bit. Until then, only the time of every RX edge is recorded, and the
+// bits are reconstructed from these edges by Decode_RX() at RX_END time.
 {
-   DWORD commFunc;
    int rc;
 
-   if(!VAR(Handle_port)) return; // No action if port failed to open
+   if(!VAR(Io)) return; // No action if port failed to open
 
    switch(pDigitalIn) {
 
@@ -292,37 +397,29 @@ void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
             IF_COMTRACE( Printf("RX <-- BREAK END") );
             VAR(RX_break) = false;
 
-            rc = ClearCommBreak(VAR(Handle_port));
+            rc = Set_COM_control(LINE_BREAK, false);
             WIN32_ASSERT(rc, "Error clearing break condition on COM port");
          }
 
          // Falling edge on RX is a start bit which initiates data reception
          else if(!VAR(RX_busy) && pEdge == FALL) {            
-            int j;
-            
             VAR(RX_busy) = true;
-            VAR(RX_stopbits) = 0;
-
-            // Schedule samples for every data bit
-            for(j = 0; j < VAR(Data_bits); j++) {
-               REMIND_ME(VAR(Bit_time) * (j + 1) + VAR(Bit_time) / 2, RX_DATA);
-            }
-
-            // If using parity, schedule a parity sampling
-            if(VAR(Parity)) {
-               REMIND_ME(VAR(Bit_time) * (j + 1) + VAR(Bit_time) / 2, RX_PARITY);
-               j++;
-            }
+            VAR(RX_start) = pTime;
+            VAR(RX_edge_count) = 0;
 
-            // If using two stop bits, sample the first one separately
-            if(VAR(Stop_bits) == 2) {
-               REMIND_ME(VAR(Bit_time) * (j + 1) + VAR(Bit_time) / 2, RX_STOP);
-               j++;
-            }
+            // Count the data, parity, and any stop bits before the last one
+            int j = VAR(Data_bits) + (VAR(Parity) ? 1 : 0) + VAR(Stop_bits) - 1;
 
             // Sample last (or only stop bit) and notify about end of reception
             REMIND_ME(VAR(Bit_time) * (j + 1) + VAR(Bit_time) / 2, RX_END);
          }
+
+         // Any other edge during reception is recorded for Decode_RX()
+         else if(VAR(RX_busy) && VAR(RX_edge_count) < RX_MAXEDGES) {
+            VAR(RX_edges)[VAR(RX_edge_count)] = pTime;
+            VAR(RX_levels)[VAR(RX_edge_count)] = pEdge == RISE;
+            VAR(RX_edge_count)++;
+         }
          
          break;
          
@@ -331,8 +428,7 @@ void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
       
          IF_COMTRACE( Printf("RTS <-- %s", pEdge == RISE ? "ON" : "OFF") );
 
-         commFunc = pEdge == RISE ? SETRTS : CLRRTS;                  
-         rc = EscapeCommFunction(VAR(Handle_port), commFunc);
+         rc = Set_COM_control(LINE_RTS, pEdge == RISE);
          WIN32_ASSERT(rc, "Error changing RTS control line on COM port");
          
          break;
@@ -341,8 +437,7 @@ void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
       
          IF_COMTRACE( Printf("DTR <-- %s", pEdge == RISE ? "ON" : "OFF") );
          
-         commFunc = pEdge == RISE ? SETDTR : CLRDTR;
-         rc = EscapeCommFunction(VAR(Handle_port), commFunc);
+         rc = Set_COM_control(LINE_DTR, pEdge == RISE);
          WIN32_ASSERT(rc, "Error changing DTR control line on COM port");
          
          break;
@@ -350,13 +445,15 @@ void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
       case OUT1:
       
          IF_COMTRACE( Printf("OUT1 <-- %s", pEdge == RISE ? "ON" : "OFF") );
-         Set_com0com_control(pEdge == RISE ? -1 : 0, SERIAL_IOC_MCR_OUT1);
+         rc = Set_COM_control(LINE_OUT1, pEdge == RISE);
+         WIN32_ASSERT(rc, "Error changing OUT1 control line on COM port");
          break;
          
       case OUT2:
       
          IF_COMTRACE( Printf("OUT2 <-- %s", pEdge == RISE ? "ON" : "OFF") );         
-         Set_com0com_control(pEdge == RISE ? -1 : 0, SERIAL_IOC_MCR_OUT2);
+         rc = Set_COM_control(LINE_OUT2, pEdge == RISE);
+         WIN32_ASSERT(rc, "Error changing OUT2 control line on COM port");
          break;
 
 #endif
@@ -367,100 +464,80 @@ void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
 
 void On_time_step(double pTime)
 //*****************************
-// Check here if a character is available from the reception queue. 
-// This is invoked frequently from VMLAB, therefore, a timer-based
-// hook function should't be necessary. The port is configured 
-// not to wait on ReadFile.
+// Check here if a character is available from the reception queue. This is
+// invoked very frequently from VMLAB, so all the actual COM port I/O is done
+// by the I/O thread in the background and this function only has to check the
+// ring buffers it fills, which costs no system calls when the port is idle.
 {
-   int rc;
+   if(!VAR(Io)) return; // No action if port failed to open
 
-   if(!VAR(Handle_port)) return; // No action if port failed to open
+   // If the I/O thread failed, report its error code like any other failure
+   if(VAR(Io)->Error) {
+      SetLastError(VAR(Io)->Error);
+      WIN32_ASSERT(false, "Error reading data from the COM port");
+   }
 
 #ifdef COMXCHX
-   // Check the status of the modem control lines.
-   DWORD modemStatus;
-   rc = GetCommModemStatus(VAR(Handle_port), &modemStatus);
-   WIN32_ASSERT(rc, "Error querying COM port control lines");
-
-   // If any control lines changed since the last time step, then change the state
-   // of the corresponding output pin. Also check status at time step 0 to setup
-   // the output pins with their initial values.
-   if(pTime == 0 || (VAR(Prev_modem_stat) ^ modemStatus) & MS_CTS_ON) {
-      IF_COMTRACE( Printf("CTS --> %s", modemStatus & MS_CTS_ON ? "ON" : "OFF") );
-      SET_LOGIC(CTS, modemStatus & MS_CTS_ON ? 1 : 0);      
-   }
-   
-   if(pTime == 0 || (VAR(Prev_modem_stat) ^ modemStatus) & MS_DSR_ON) {
-      IF_COMTRACE( Printf("DSR --> %s", modemStatus & MS_DSR_ON ? "ON" : "OFF") );
-      SET_LOGIC(DSR, modemStatus & MS_DSR_ON ? 1 : 0);      
-   }
-   
-   if(pTime == 0 || (VAR(Prev_modem_stat) ^ modemStatus) & MS_RING_ON) {
-      IF_COMTRACE( Printf("RI --> %s", modemStatus & MS_RING_ON ? "ON" : "OFF") );
-      SET_LOGIC(RI, modemStatus & MS_RING_ON ? 1 : 0);      
+   // If any control lines changed since the last time step, then change the
+   // state of the corresponding output pins. The modem status is queued by
+   // the I/O thread and delivered here even while TX is busy.
+   USHORT modemStatus;
+   while(Ring_get(&VAR(Io)->Modem, modemStatus)) {
+      Set_modem_pins(modemStatus, VAR(Prev_modem_stat) ^ modemStatus);
+      VAR(Prev_modem_stat) = modemStatus;
    }
-   
-   if(pTime == 0 || (VAR(Prev_modem_stat) ^ modemStatus) & MS_RLSD_ON) {
-      IF_COMTRACE( Printf("DCD --> %s", modemStatus & MS_RLSD_ON ? "ON" : "OFF") );
-      SET_LOGIC(DCD, modemStatus & MS_RLSD_ON ? 1 : 0);      
-   }
-   
-   VAR(Prev_modem_stat) = modemStatus;
 #endif
 
    // No further action if already transmitting a character
    if(VAR(TX_busy)) return;
 
-   // Check for break condition, buffer overrun, or parity/framing errors
-   DWORD commErrors;
-   rc = ClearCommError(VAR(Handle_port), &commErrors, NULL);
-   WIN32_ASSERT(rc, "Error querying COM port for receiver errors");
-   
-   if(commErrors & CE_BREAK) {
-      IF_COMTRACE( Printf("TX --> BREAK") );
-      VAR(TX_break) = true;
-   }
-
-   if(commErrors & CE_FRAME) {
-      IF_COMTRACE( Printf("TX --> FRAMING ERROR") );
-      VAR(TX_frame_error) = true;
-   }
-
-   if(commErrors & CE_RXPARITY) {
-      IF_COMTRACE( Printf("TX --> PARITY ERROR") );
-      VAR(TX_parity_error) = true;
-   }
-
-   // If a receive buffer overrun has occurred on the COM port, it will continue
-   // to occur until the other side stops transmitting. To prevent the user from
-   // being flooded with warnings, we only print the warning once and then set a
-   // flag. This flag is only cleared once all characters have been read out
-   // from the COM port receive buffer and port is idle.
-   if((commErrors & CE_OVERRUN) || (commErrors & CE_RXOVER)) {
-      if(!VAR(COM_rx_overrun)) {
-         Printf("COM port receive buffer overrun");
-         VAR(COM_rx_overrun) = true;
+   // Dequeue any break condition, buffer overrun, or parity/framing errors
+   // which the I/O thread placed ahead of the next received byte.
+   USHORT entry;
+   BOOL received = false;
+   while(!received && Ring_get(&VAR(Io)->Rx, entry)) {
+      switch(entry) {
+      
+         case RING_BREAK:
+            IF_COMTRACE( Printf("TX --> BREAK") );
+            VAR(TX_break) = true;
+            break;
+
+         case RING_FRAME:
+            IF_COMTRACE( Printf("TX --> FRAMING ERROR") );
+            VAR(TX_frame_error) = true;
+            break;
+
+         case RING_PARITY:
+            IF_COMTRACE( Printf("TX --> PARITY ERROR") );
+            VAR(TX_parity_error) = true;
+            break;
+
+         // If a receive buffer overrun has occurred on the COM port, it will
+         // continue to occur until the other side stops transmitting. To
+         // prevent the user from being flooded with warnings, we only print the
+         // warning once and then set a flag. This flag is only cleared once all
+         // characters have been read out from the ring buffer.
+         case RING_OVERRUN:
+            if(!VAR(COM_rx_overrun)) {
+               Printf("COM port receive buffer overrun");
+               VAR(COM_rx_overrun) = true;
+            }
+            break;
+            
+         default:
+            received = true;
+            break;
       }
    }
-   
-   // Read the next byte from the port
-   BYTE myByte;
-   DWORD bytesTransferred;
-   rc = ReadFile(              // Win32 API function
-         VAR(Handle_port),    // Port handle got by CreateFile
-         &myByte,             // Pointer to data to read
-         1,                   // Number of bytes to read
-         &bytesTransferred,   // Pointer to number of bytes actually read
-         NULL                 // Must be NULL
-   );
-   WIN32_ASSERT(rc, "Error reading data from the COM port");
+   BYTE myByte = (BYTE) entry;
 
    // Launch the serial logic events to build the character, if received. When a
    // break condition occurs, the port will also read a zero (NULL) byte value as
    // data which we ignore. Unfortunately, there is no way under Win32 to detect
    // when the break condition ends, so the generated break signal will last only
    // for the duration of the start, data, parity, and stop bits.
-   if(bytesTransferred == 1) {
+   if(received) {
    
       int j; // Bit index
 
@@ -514,7 +591,7 @@ void On_time_step(double pTime)
       SET_LOGIC(TX, 1, VAR(Bit_time) * (1 + j + VAR(Stop_bits)));
    }
    
-   // If ReadFile() returned no bytes, then the COM port receive buffer must be
+   // If the ring buffer had no bytes, then the COM port receive buffer must be
    // empty. Reset the flag so that a future receive buffer overrun can be reported
    // again.
    else {   
@@ -529,7 +606,7 @@ void On_remind_me(double pTime, int pData)
 {
    int rc;
 
-   if(!VAR(Handle_port)) return; // No action if port failed to open
+   if(!VAR(Io)) return; // No action if port failed to open
 
    if(pData == TX_END) {          // End of transmission 
 
@@ -540,7 +617,9 @@ void On_remind_me(double pTime, int pData)
 
    } else if(pData == RX_END) {   // End of reception, passes character to real COM
 
-      // Sample the last (or only) stop bit
+      // Rebuild the data, parity, and first stop bit from the recorded edges
+      // and then sample the last (or only) stop bit
+      Decode_RX();
       VAR(RX_stopbits) += Get_RX();
 
       // If data, parity, and stop bits are all zero then it's a break condition
@@ -548,7 +627,7 @@ void On_remind_me(double pTime, int pData)
          IF_COMTRACE( Printf("RX <-- BREAK START") );         
          VAR(RX_break) = true;
 
-         rc = SetCommBreak(VAR(Handle_port));
+         rc = Set_COM_control(LINE_BREAK, true);
          WIN32_ASSERT(rc, "Error setting break condition on COM port");
       }
 
@@ -574,34 +653,12 @@ void On_remind_me(double pTime, int pData)
             }
          }
 
-         DWORD numBytesWritten;
-         WriteFile(           // Win32 function
-            VAR(Handle_port), // Port Win32 handle
-            &VAR(RX_byte),    // Pointer to the data to write 
-            1,                // Number of bytes to write
-            &numBytesWritten, // Pointer to the number of bytes written
-            NULL              // Must be NULL
-         );
-         WIN32_ASSERT(numBytesWritten == 1, "Error writting data to the COM port");
+         rc = Write_COM_port(VAR(RX_byte));
+         WIN32_ASSERT(rc, "Error writting data to the COM port");
       }
       
       VAR(RX_busy) = false;
       VAR(RX_byte) = 0;  
-
-   } else if(pData == RX_DATA) {   // Sampling data bit, bits come first LSB.
-
-      VAR(RX_byte) >>= 1;
-      LOGIC bitSample = Get_RX();
-      VAR(RX_byte) |= (bitSample << 7);
-      
-   } else if(pData == RX_PARITY) { // Sampling parity bit
-
-      VAR(RX_parity) = Get_RX();
-
-   } else if(pData == RX_STOP) {   // Sample first stop bit (if using 2)
-   
-      VAR(RX_stopbits) += Get_RX();
-
    }
 }
 
@@ -614,6 +671,42 @@ void On_gadget_notify(GADGET pGadgetId, int pCode)
 
 void Open_COM_port()
 //*************************
+// Open the transport selected by the instance name and start the background
+// I/O thread for it. If anything fails, the port is closed again and VAR(Io)
+// is left as NULL.
+{
+   VAR(Handle_port) = INVALID_HANDLE_VALUE;
+
+   // Allocate the rings shared with the I/O thread. Using calloc() ensures
+   // that both rings start out empty and all handles start out as NULL.
+   VAR(Io) = (COM_io *) calloc(1, sizeof(COM_io));
+   WIN32_ASSERT(VAR(Io), "Out of memory allocating COM port buffers");
+   VAR(Io)->Socket = INVALID_SOCKET;
+
+   VAR(Io)->Stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+   WIN32_ASSERT(VAR(Io)->Stop, "Unable to create COM port I/O event");
+   VAR(Io)->Write_ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   WIN32_ASSERT(VAR(Io)->Write_ov.hEvent, "Unable to create COM port I/O event");
+
+   // An instance name like "TCP4000" selects the socket transport
+   const char *name = GET_INSTANCE();
+   if(!strnicmp(name, "TCP", 3) && isdigit(name[3])) {
+      Open_socket(atoi(name + 3));
+   } else {
+      Open_serial();
+   }
+   if(!VAR(Io)) return; // Open_serial() or Open_socket() failed
+
+   // Start the background thread which performs all COM port reads
+   DWORD threadId;
+   VAR(Io)->Thread = CreateThread(NULL, 0,
+      VAR(Io)->Transport == TR_SOCKET ? Socket_thread : IO_thread,
+      VAR(Io), 0, &threadId);
+   WIN32_ASSERT(VAR(Io)->Thread, "Unable to start COM port I/O thread");
+}
+
+void Open_serial()
+//*************************
 // Win32 uses the standard CreateFile(..) function to get a handle
 // to a serial port. It manages automatically buffering. Parameters
 // as recommended my MS
@@ -633,7 +726,7 @@ void Open_COM_port()
       0,                            // Share mode
       NULL,                         // Pointer to the security attribute
       OPEN_EXISTING,                // How to open the serial port
-      0,                            // Port attributes
+      FILE_FLAG_OVERLAPPED,         // Port attributes (used by IO_thread)
       NULL                          // Handle to port with attribute to copy
    );
    WIN32_ASSERT(VAR(Handle_port) != INVALID_HANDLE_VALUE,
@@ -703,11 +796,72 @@ void Open_COM_port()
 
    rc = SetCommTimeouts(VAR(Handle_port), &myTOut);
    WIN32_ASSERT(rc, "Unable to configure serial port timeouts");
+
+   VAR(Io)->Port = VAR(Handle_port);
+   VAR(Io)->Transport = TR_SERIAL;
+}
+
+void Open_socket(int pPort)
+//*************************
+// Connect to TCP port pPort on the local machine. The connection is made
+// when the simulation starts, so the test script must already be listening.
+{
+   WSADATA wsaData;
+   sockaddr_in addr;
+   int rc;
+
+   rc = WSAStartup(MAKEWORD(1, 1), &wsaData);
+   if(rc) SetLastError(rc);
+   WIN32_ASSERT(!rc, "Unable to initialize Windows Sockets");
+   VAR(Io)->Transport = TR_SOCKET;
+
+   VAR(Io)->Socket = socket(AF_INET, SOCK_STREAM, 0);
+   WIN32_ASSERT(VAR(Io)->Socket != INVALID_SOCKET, "Unable to create TCP socket");
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons((u_short) pPort);
+   addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+   rc = connect(VAR(Io)->Socket, (sockaddr *) &addr, sizeof(addr));
+   WIN32_ASSERT(rc == 0, "Unable to connect to requested TCP port");
+
+   // Disable the Nagle algorithm so single bytes are sent out immediately
+   BOOL noDelay = TRUE;
+   setsockopt(VAR(Io)->Socket, IPPROTO_TCP, TCP_NODELAY, (char *) &noDelay,
+      sizeof(noDelay));
 }
 
 void Close_COM_port()
 //*******************
 {
+  // Stop the I/O thread before closing the port handle it is waiting on.
+  // Shutting down the socket makes a blocking recv() in Socket_thread() return.
+  if(VAR(Io)) {
+      if(VAR(Io)->Thread) {
+         SetEvent(VAR(Io)->Stop);
+         if(VAR(Io)->Transport == TR_SOCKET) {
+            shutdown(VAR(Io)->Socket, 2);
+         }
+         WaitForSingleObject(VAR(Io)->Thread, INFINITE);
+         CloseHandle(VAR(Io)->Thread);
+      }
+      if(VAR(Io)->Transport == TR_SOCKET) {
+         if(VAR(Io)->Socket != INVALID_SOCKET) {
+            closesocket(VAR(Io)->Socket);
+         }
+         WSACleanup();
+      }
+      if(VAR(Io)->Stop) {
+         CloseHandle(VAR(Io)->Stop);
+      }
+      if(VAR(Io)->Write_ov.hEvent) {
+         CloseHandle(VAR(Io)->Write_ov.hEvent);
+      }
+      free(VAR(Io));
+      VAR(Io) = NULL;
+  }
+
   if(VAR(Handle_port) != INVALID_HANDLE_VALUE) {
       if(!CloseHandle(VAR(Handle_port))) {
          Print_error();
@@ -732,15 +886,343 @@ void Set_com0com_control(ULONG pControl, ULONG pMask)
   ((ULONG *)inBufIoctl)[1] = pMask;
   memcpy(&((ULONG *)inBufIoctl)[2], C0CE_SIGNATURE, C0CE_SIGNATURE_SIZE);
 
-  DeviceIoControl(VAR(Handle_port),               // hDevice (open COM port handle)
+  // The port is opened for overlapped I/O, so wait for the request to finish
+  if(!DeviceIoControl(VAR(Handle_port),           // hDevice (open COM port handle)
                   IOCTL_SERIAL_SET_MODEM_CONTROL, // dwIoControlCode
                   inBufIoctl,                     // lpInBuffer
                   sizeof(inBufIoctl),             // nInBufferSize
                   NULL,                           // lpOutBuffer
                   0,                              // nOutBufferSize
                   &bytesReturned,                 // lpBytesReturned
-                  NULL                            // lpOverlapped
-  );
+                  &VAR(Io)->Write_ov              // lpOverlapped
+  ) && GetLastError() == ERROR_IO_PENDING) {
+    GetOverlappedResult(VAR(Handle_port), &VAR(Io)->Write_ov, &bytesReturned, TRUE);
+  }
+}
+
+#ifdef COMXCHX
+void Set_modem_pins(DWORD pStatus, DWORD pChanged)
+//*************************
+// Change the state of the CTS, DSR, RI, and DCD output pins to match the
+// modem status pStatus (as returned by GetCommModemStatus()). Only the pins
+// whose corresponding MS_XXX_ON bits are set in pChanged are updated.
+{
+   if(pChanged & MS_CTS_ON) {
+      IF_COMTRACE( Printf("CTS --> %s", pStatus & MS_CTS_ON ? "ON" : "OFF") );
+      SET_LOGIC(CTS, pStatus & MS_CTS_ON ? 1 : 0);      
+   }
+   
+   if(pChanged & MS_DSR_ON) {
+      IF_COMTRACE( Printf("DSR --> %s", pStatus & MS_DSR_ON ? "ON" : "OFF") );
+      SET_LOGIC(DSR, pStatus & MS_DSR_ON ? 1 : 0);      
+   }
+   
+   if(pChanged & MS_RING_ON) {
+      IF_COMTRACE( Printf("RI --> %s", pStatus & MS_RING_ON ? "ON" : "OFF") );
+      SET_LOGIC(RI, pStatus & MS_RING_ON ? 1 : 0);      
+   }
+   
+   if(pChanged & MS_RLSD_ON) {
+      IF_COMTRACE( Printf("DCD --> %s", pStatus & MS_RLSD_ON ? "ON" : "OFF") );
+      SET_LOGIC(DCD, pStatus & MS_RLSD_ON ? 1 : 0);      
+   }
+}
+#endif
+
+BOOL Write_COM_port(BYTE pByte)
+//*************************
+// Write a single byte to the COM port and wait for the overlapped write to
+// complete. Returns false if the byte could not be written.
+{
+   DWORD numBytesWritten = 0;
+
+   // A data byte equal to the escape byte must be sent twice over a socket
+   if(VAR(Io)->Transport == TR_SOCKET) {
+      char buffer[2] = { pByte, pByte };
+      int length = pByte == SOCK_ESCAPE ? 2 : 1;
+      return send(VAR(Io)->Socket, buffer, length, 0) == length;
+   }
+
+   if(!WriteFile(VAR(Handle_port), &pByte, 1, &numBytesWritten, &VAR(Io)->Write_ov)) {
+      if(GetLastError() != ERROR_IO_PENDING) {
+         return false;
+      }
+      if(!GetOverlappedResult(VAR(Handle_port), &VAR(Io)->Write_ov,
+         &numBytesWritten, TRUE)) {
+         return false;
+      }
+   }
+   
+   return numBytesWritten == 1;
+}
+
+BOOL Set_COM_control(BYTE pLine, BOOL pState)
+//*************************
+// Turn one of the LINE_XXX outputs (or the break condition) on or off. With the
+// socket transport, the new state of all the lines is sent as a control byte.
+// Returns false if the change could not be made.
+{
+   if(VAR(Io)->Transport == TR_SOCKET) {
+      if(pState) {
+         VAR(Io)->Line_state |= pLine;
+      } else {
+         VAR(Io)->Line_state &= ~pLine;
+      }
+      char buffer[2] = { (char) SOCK_ESCAPE, VAR(Io)->Line_state };
+      return send(VAR(Io)->Socket, buffer, 2, 0) == 2;
+   }
+   
+   switch(pLine) {
+      case LINE_RTS:
+         return EscapeCommFunction(VAR(Handle_port), pState ? SETRTS : CLRRTS);
+      case LINE_DTR:
+         return EscapeCommFunction(VAR(Handle_port), pState ? SETDTR : CLRDTR);
+      case LINE_BREAK:
+         return pState ? SetCommBreak(VAR(Handle_port)) :
+            ClearCommBreak(VAR(Handle_port));
+
+      // Only supported by com0com; failures are ignored for other ports
+      case LINE_OUT1:
+         Set_com0com_control(pState ? -1 : 0, SERIAL_IOC_MCR_OUT1);
+         return true;
+      case LINE_OUT2:
+         Set_com0com_control(pState ? -1 : 0, SERIAL_IOC_MCR_OUT2);
+         return true;
+   }
+   return false;
+}
+
+DWORD WINAPI IO_thread(LPVOID pParam)
+//*************************
+// Background thread started by Open_COM_port(). It sleeps in WaitCommEvent()
+// until the COM port has something to report, and then queues all received
+// bytes, line status errors, and modem control line changes into the rings of
+// the COM_io structure in pParam. The components are compiled with the single
+// threaded runtime (-WM-), so this function must only call Win32 API functions
+// and never any C library or VMLAB interface functions. If a Win32 call fails,
+// the error code is saved in COM_io::Error and reported by On_time_step().
+{
+   COM_io *io = (COM_io *) pParam;
+   BYTE buffer[RING_SIZE];
+   OVERLAPPED ov;
+   HANDLE events[2];
+   DWORD mask, count, errors;
+   COMSTAT comStat;
+   
+   ov.Offset = ov.OffsetHigh = 0;
+   ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+   events[0] = ov.hEvent;
+   events[1] = io->Stop;
+
+   mask = EV_RXCHAR | EV_BREAK | EV_ERR;
+#ifdef COMXCHX
+   mask |= EV_CTS | EV_DSR | EV_RING | EV_RLSD;
+#endif
+   if(!ov.hEvent || !SetCommMask(io->Port, mask)) {
+      io->Error = GetLastError();
+   }
+
+   while(!io->Error && WaitForSingleObject(io->Stop, 0) == WAIT_TIMEOUT) {
+   
+      // If the simulation has fallen behind and the ring is full, wait for it
+      // to catch up. Bytes left in the driver's buffer are subject to the RTS
+      // input flow control, so nothing is lost by waiting here.
+      LONG room = Ring_free(&io->Rx) - 4;
+      if(room <= 0) {
+         WaitForSingleObject(io->Stop, 1);
+         continue;
+      }
+      
+      // Queue line status errors first, since they apply to the next byte
+      if(!ClearCommError(io->Port, &errors, &comStat)) {
+         io->Error = GetLastError();
+         break;
+      }
+      if(errors & CE_BREAK) {
+         Ring_put(&io->Rx, RING_BREAK);
+      }
+      if(errors & CE_FRAME) {
+         Ring_put(&io->Rx, RING_FRAME);
+      }
+      if(errors & CE_RXPARITY) {
+         Ring_put(&io->Rx, RING_PARITY);
+      }
+      if((errors & CE_OVERRUN) || (errors & CE_RXOVER)) {
+         Ring_put(&io->Rx, RING_OVERRUN);
+      }
+
+      // Read as many of the waiting bytes as will fit into the ring. Since
+      // at most cbInQue bytes are requested, the read completes immediately.
+      count = comStat.cbInQue < (DWORD) room ? comStat.cbInQue : room;
+      if(count) {
+         if(!ReadFile(io->Port, buffer, count, &count, &ov) &&
+            (GetLastError() != ERROR_IO_PENDING ||
+            !GetOverlappedResult(io->Port, &ov, &count, TRUE))) {
+            io->Error = GetLastError();
+            break;
+         }
+         for(DWORD i = 0; i < count; i++) {
+            Ring_put(&io->Rx, buffer[i]);
+         }
+         continue;
+      }
+      
+      // Nothing left to read; sleep until the next COM port event. If the
+      // stop event is set instead, clearing the event mask will complete the
+      // pending WaitCommEvent() so the OVERLAPPED structure can be released.
+      if(!WaitCommEvent(io->Port, &mask, &ov)) {
+         if(GetLastError() != ERROR_IO_PENDING) {
+            io->Error = GetLastError();
+            break;
+         }
+         if(WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            SetCommMask(io->Port, 0);
+            GetOverlappedResult(io->Port, &ov, &count, TRUE);
+            break;
+         }
+         if(!GetOverlappedResult(io->Port, &ov, &count, TRUE)) {
+            io->Error = GetLastError();
+            break;
+         }
+      }
+
+#ifdef COMXCHX
+      // Queue the new state of the modem control lines if any have changed
+      if(mask & (EV_CTS | EV_DSR | EV_RING | EV_RLSD)) {
+         DWORD modemStatus;
+         if(!GetCommModemStatus(io->Port, &modemStatus)) {
+            io->Error = GetLastError();
+            break;
+         }
+         Ring_put(&io->Modem, (USHORT) modemStatus);
+      }
+#endif
+   }
+
+   if(ov.hEvent) {
+      CloseHandle(ov.hEvent);
+   }
+   return 0;
+}
+
+DWORD WINAPI Socket_thread(LPVOID pParam)
+//*************************
+// Background thread started by Open_COM_port() for the TCP<N> transport. It
+// blocks in recv() and decodes the escaped data stream into the same ring
+// entries that IO_thread() produces for a COM port. Like IO_thread(), it must
+// only call Win32 and Windows Sockets API functions.
+{
+   COM_io *io = (COM_io *) pParam;
+   BYTE buffer[RING_SIZE];
+   BOOL escape = false;
+
+   while(WaitForSingleObject(io->Stop, 0) == WAIT_TIMEOUT) {
+
+      // Wait for the simulation to catch up if the ring is full. TCP flow
+      // control will then stop the other end from sending more data.
+      LONG room = Ring_free(&io->Rx) - 4;
+      if(room <= 0) {
+         WaitForSingleObject(io->Stop, 1);
+         continue;
+      }
+
+      // A control byte can queue up to three ring entries for two received
+      // bytes, so only ask for half the free room to never overflow the ring.
+      int count = recv(io->Socket, (char *) buffer, room / 2 + 1, 0);
+
+      // Either Close_COM_port() shut down the socket (which is not an error)
+      // or the other end closed the connection.
+      if(count <= 0) {
+         if(WaitForSingleObject(io->Stop, 0) == WAIT_TIMEOUT) {
+            io->Error = count ? WSAGetLastError() : WSAECONNRESET;
+         }
+         break;
+      }
+
+      for(int i = 0; i < count; i++) {
+         if(escape) {
+            escape = false;
+            if(buffer[i] != SOCK_ESCAPE) {
+               Socket_control(io, buffer[i]);
+               continue;
+            }
+         } else if(buffer[i] == SOCK_ESCAPE) {
+            escape = true;
+            continue;
+         }
+         Ring_put(&io->Rx, buffer[i]);
+      }
+   }
+
+   return 0;
+}
+
+void Socket_control(COM_io *pIo, BYTE pControl)
+//*************************
+// Called by Socket_thread() to queue the line status errors and modem control
+// line state from a control byte received over the socket.
+{
+   if(pControl & LINE_BREAK) {
+      Ring_put(&pIo->Rx, RING_BREAK);
+   }
+   if(pControl & LINE_FRAME) {
+      Ring_put(&pIo->Rx, RING_FRAME);
+   }
+   if(pControl & LINE_PARITY) {
+      Ring_put(&pIo->Rx, RING_PARITY);
+   }
+
+#ifdef COMXCHX
+   // Translate into the same MS_XXX_ON bits used by GetCommModemStatus()
+   DWORD modemStatus = 0;
+   if(pControl & LINE_CTS) modemStatus |= MS_CTS_ON;
+   if(pControl & LINE_DSR) modemStatus |= MS_DSR_ON;
+   if(pControl & LINE_RI)  modemStatus |= MS_RING_ON;
+   if(pControl & LINE_DCD) modemStatus |= MS_RLSD_ON;
+
+   if(modemStatus != pIo->Modem_state) {
+      pIo->Modem_state = modemStatus;
+      Ring_put(&pIo->Modem, (USHORT) modemStatus);
+   }
+#endif
+}
+
+BOOL Ring_put(Ring *pRing, USHORT pData)
+//*************************
+// Called only by the producer thread to append pData to the ring. The Head
+// index is published with InterlockedExchange() so the consumer can never see
+// the new Head before the data itself. Returns false if the ring is full.
+{
+   LONG head = pRing->Head;
+   
+   if(head - pRing->Tail >= RING_SIZE) {
+      return false;
+   }
+   pRing->Data[head & (RING_SIZE - 1)] = pData;
+   InterlockedExchange((LONG *) &pRing->Head, head + 1);
+   return true;
+}
+
+BOOL Ring_get(Ring *pRing, USHORT &pData)
+//*************************
+// Called only by the consumer thread to remove the oldest entry from the ring
+// and return it in pData. Returns false if the ring is empty.
+{
+   LONG tail = pRing->Tail;
+   
+   if(tail == pRing->Head) {
+      return false;
+   }
+   pData = pRing->Data[tail & (RING_SIZE - 1)];
+   InterlockedExchange((LONG *) &pRing->Tail, tail + 1);
+   return true;
+}
+
+LONG Ring_free(Ring *pRing)
+//*************************
+// Return the number of entries that can still be added to the ring
+{
+   return RING_SIZE - (pRing->Head - pRing->Tail);
 }
 
 double On_voltage_ask(PIN pAnalogOut, double pTime)
@@ -824,6 +1306,42 @@ BOOL Get_RX()
    return bitSample;
 }
 
+void Decode_RX()
+//*************************
+// Called at RX_END time to reconstruct the received character from the RX
+// edges recorded since the start bit. The RX pin level in the middle of each
+// bit period is the level after the last edge that occurred before that time,
+// which gives the same result as sampling the RX pin with a separate REMIND_ME()
+// for every bit. Fills in VAR(RX_byte), VAR(RX_parity), and VAR(RX_stopbits)
+// exactly like the per-bit sampling did.
+{
+   LOGIC level = 0;  // RX is low during the start bit
+   int edge = 0;
+   int bits = VAR(Data_bits) + (VAR(Parity) ? 1 : 0) + VAR(Stop_bits) - 1;
+
+   VAR(RX_byte) = 0;
+   VAR(RX_parity) = 0;
+   VAR(RX_stopbits) = 0;
+   
+   for(int j = 0; j < bits; j++) {
+      double sample = VAR(RX_start) + VAR(Bit_time) * (j + 1) + VAR(Bit_time) / 2;
+      
+      while(edge < VAR(RX_edge_count) && VAR(RX_edges)[edge] <= sample) {
+         level = VAR(RX_levels)[edge++];
+      }
+
+      // Data bits come first LSB, followed by the parity bit (if used) and
+      // the first of two stop bits (if used)
+      if(j < VAR(Data_bits)) {
+         VAR(RX_byte) = (VAR(RX_byte) >> 1) | (level << 7);
+      } else if(VAR(Parity) && j == VAR(Data_bits)) {
+         VAR(RX_parity) = level;
+      } else {
+         VAR(RX_stopbits) += level;
+      }
+   }
+}
+
 void Printf(char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
@@ -31,7 +31,22 @@
 //
 // If the optional instance <Name> is specified, then the EEPROM will preserve
 // its memory contents across simulation runs by using an Intel HEX format
-// file "<Name>.eep".
+// file "<Name>.eep". Alternatively, if a raw binary file "<Name>.bin" exists
+// (e.g. created with the "Save" button in the hex editor), then that file is
+// mapped directly into memory instead. Every write to the EEPROM then lands
+// immediately in the file; nothing is loaded at startup or saved at exit, and
+// the contents survive even if VMLAB crashes. The hex editor's Load and Save
+// buttons still import and export all file formats in this mode.
+//
+// If the VMLAB_COVERAGE environment variable is set to a directory, then the
+// read/write coverage of every simulation run is merged into the file
+// "<Name>.cov" in that directory. Coverage files from many runs can be
+// combined with covmerge.exe and loaded back into the hex editor as an
+// overlay using "Load merged R/W coverage..." in its pop-up menu.
+//
+// Read and write watchpoints can be set on any range of EEPROM addresses by
+// selecting the range in the hex editor and using its pop-up menu. A write
+// watchpoint can optionally break only when a specific byte value is written.
 //
 // Version History:
 // v1.0 2010-7-17 - Initial public release
@@ -62,10 +77,11 @@
 #include "eeprom24.h"
 
 // Because usercomp.exe supports only one source file, by including hexfile.cpp
-// here, we can still use usercomp.exe for compiling and don't require a
-// separate makefile.
+// and coverage.cpp here, we can still use usercomp.exe for compiling and
+// don't require a separate makefile.
 #include "../mculib/hexfile.h"
 #include "../mculib/hexfile.cpp"
+#include "../mculib/coverage.cpp"
 
 // Size of temporary string buffer for generating filenames and messages
 #define MAXBUF 256
@@ -95,7 +111,9 @@ END_PINS
 // on the SDA line when the EEPROM is transmitting data. This delay is needed
 // so that other devices on the I2C bus do not mistake the changing data line
 // for a START or STOP condition. For 5V operating voltage, both the Atmel
-// and Microchip datasheets specify a max 900ns delay.
+// and Microchip datasheets specify a max 900ns delay. If the next data bit
+// leaves SDA unchanged, then no REMIND_ME() is scheduled for it and the bit is
+// instead shifted on the following rising SCL edge (see On_digital_in_edge_()).
 #define SCL_TO_OUT 900e-9
 
 // Size of temporary string buffer for generating filenames and error messages
@@ -134,8 +152,9 @@ DECLARE_VAR
    int Write_count;    // Number of bytes received during sequential write
    int Pointer;        // Memory pointer within EEPROM for read/write
    int Pointer_temp;   // New or previous pointer used by write operation
-   UCHAR *Memory;      // Pointer to malloc()ed memory holding EEPROM contents
-   UCHAR *Flags;       // Pointer to malloc()ed memory tracking R/W coverage
+   Pagemem Memory;     // Sparse paged or file mapped EEPROM contents
+   Coverage Cover;     // Packed 2-bit per byte R/W coverage bitmap
+   Pagemem Flags;      // Sparse paged watchpoint bitflags for each byte
 
    int State;          // One of the ST_XXX enum constants
    bool Dirty;         // True if the GUI needs to be refreshed
@@ -151,6 +170,10 @@ DECLARE_VAR
    USHORT TX_byte;     // Inverse of transmit data to shift out on SDA pin
    char RX_count;      // Number of bits left to receive in current word
    char TX_count;      // Number of bits left to transmit in current word
+   char TX_pending;    // Number of NTF_TX reminders not yet received
+   bool TX_skip;       // True if TX bit needs no NTF_TX; SDA stays unchanged
+   bool SDA_low;       // True while SDA is actively driven low
+   double SCL_fall;    // Time of the most recent falling edge on SCL
    
    bool Log;           // True if the "Log" checkbox button is checked
    bool Break;         // True if the "Break on error" checkbox button checked
@@ -217,6 +240,28 @@ void Rx()
    VAR(RX_byte) = 0;
 }
 
+void Tx_bit()
+//*************************
+// Shift out the next bit from VAR(TX_byte) onto the SDA pin. Called either
+// SCL_TO_OUT after a falling SCL edge from On_remind_me(), or on the next
+// rising SCL edge from On_digital_in_edge_() if the bit leaves SDA unchanged.
+{
+   // Data is shifted out MSb first. Because SDA is open-collector, a 0
+   // bit is actively driven on SDA and a 1 bit tri-states SDA and lets
+   // the pull-up resistor generate the high logic value. Note that the
+   // data in TX_byte is actually inverted so a 0 bit in the variable is
+   // output as a 1 bit on SDA and vice-versa.
+   VAR(SDA_low) = (VAR(TX_byte) & 0x8000) != 0;
+   if(VAR(SDA_low)) {
+      SET_DRIVE(SDA, true);
+      SET_LOGIC(SDA, 0);
+   } else {
+      SET_DRIVE(SDA, false);            
+   }
+   VAR(TX_byte) <<= 1;
+   VAR(TX_count)--;
+}
+
 void Log(const char *pFormat, ...)
 //*************************
 // Wrapper around the PRINT() function to provide printf() like functionality
@@ -252,6 +297,19 @@ void Error(const char *pMessage)
    }
 }
 
+void Watch(int pAddr, UCHAR pData, int pType)
+//*************************
+// Called on an EEPROM access whose flag byte has the "pType" watchpoint bit
+// set. The flag test is done by the caller so EEPROM accesses without any
+// watchpoint stay fast. Breakpoint the simulation if the complete watchpoint
+// condition (e.g. a value match) is satisfied.
+{
+   const char *message = VAR(Hex).watch(pAddr, pData, pType);
+   if(message) {
+      BREAK(message);
+   }
+}
+
 bool On_Start_or_Stop()
 //**********************
 // Called by either On_Start() or On_Stop() to check for behavior that is
@@ -358,10 +416,14 @@ void On_read_byte(bool pAck)
 // transfer, pAck is set to true so that an ACK bit is sent to acknowledge the
 // slave address that was just received.
 {
-   UCHAR data = VAR(Memory)[VAR(Pointer)];
+   UCHAR data = VAR(Memory).get(VAR(Pointer));
 
    Log("Read EEPROM[$%05X]=$%02X", VAR(Pointer), data);
-   VAR(Flags)[VAR(Pointer)] |= Hexfile::FL_READ;
+   VAR(Cover).read(VAR(Pointer));
+   VAR(Hex).touch(VAR(Pointer));
+   if(VAR(Flags).get(VAR(Pointer)) & Hexfile::FL_BREAK_READ) {
+      Watch(VAR(Pointer), data, Hexfile::FL_BREAK_READ);
+   }
 
    VAR(Pointer) = (VAR(Pointer) + 1) & VAR(Pointer_mask);   
    Tx(data, pAck);
@@ -376,8 +438,12 @@ void On_write_byte(UCHAR pData)
 // wraps and when the entire page has been filled up
 {
    Log("Write EEPROM[$%05X]=$%02X", VAR(Pointer), pData);
-   VAR(Flags)[VAR(Pointer)] |= Hexfile::FL_WRITE;
+   VAR(Cover).write(VAR(Pointer));
    VAR(Memory)[VAR(Pointer)] = pData;
+   VAR(Hex).touch(VAR(Pointer));
+   if(VAR(Flags).get(VAR(Pointer)) & Hexfile::FL_BREAK_WRITE) {
+      Watch(VAR(Pointer), pData, Hexfile::FL_BREAK_WRITE);
+   }
    
    // Check if this write has wrapped around to beginning of page
    if(VAR(Pointer) < VAR(Pointer_temp)) {
@@ -565,18 +631,35 @@ const char *On_create()
    VAR(Slave_mask) &= ~VAR(Slave_ptr_mask);
    VAR(Slave_addr) &= VAR(Slave_mask);
    
-   // Allocate enough memory to store all of the EEPROM contents and to track
-   // read/write coverage per each EEPROM memory byte.
-   VAR(Memory) = (UCHAR *) malloc(VAR(Pointer_mask) + 1);
-   VAR(Flags) =  (UCHAR *) malloc(VAR(Pointer_mask) + 1);
-   if(VAR(Memory) == NULL || VAR(Flags) == NULL) {
+   // If this instance has a user assigned name (i.e. not a "$NN" name auto
+   // generated by VMLAB) and "<Name>.bin" already exists, then map the file
+   // directly as the EEPROM memory contents.
+   char strBuffer[MAX_PATH];
+   sprintf(strBuffer, "%s.bin", GET_INSTANCE());
+   if(strBuffer[0] != '$' && GetFileAttributes(strBuffer) != (unsigned) -1) {
+      if(!VAR(Memory).map(strBuffer, VAR(Pointer_mask) + 1, 0xFF)) {
+         return "Could not map <Name>.bin file into memory";
+      }
+   }
+
+   // Otherwise reserve enough memory to store all of the EEPROM contents.
+   // Storage is only used for pages which are written, so large mostly empty
+   // EEPROMs are cheap. EEPROM contents start in fully erased (0xFF) state.
+   // Also track read/write coverage per each EEPROM memory byte, which starts
+   // as neither read nor written.
+   if(!VAR(Memory).mapped()) {
+      if(!VAR(Memory).create(VAR(Pointer_mask) + 1, 0xFF)) {
+         return "Could not allocate memory";
+      }
+   }
+   if(!VAR(Cover).create(VAR(Pointer_mask) + 1)) {
+      return "Could not allocate memory";
+   }
+
+   // Watchpoint bitflags only use storage for pages covered by a watchpoint
+   if(!VAR(Flags).create(VAR(Pointer_mask) + 1, 0x00)) {
       return "Could not allocate memory";
    }
-   
-   // Initialize EEPROM contents to fully erased (0xFF) state and coverage
-   // state to neither read nor written.
-   memset(VAR(Memory), 0xFF, VAR(Pointer_mask) + 1);
-   memset(VAR(Flags), 0x00, VAR(Pointer_mask) + 1);
 
    return NULL;
 }
@@ -609,10 +692,10 @@ void On_window_init(HWND pHandle)
    SetWindowText(GET_HANDLE(GDT_SLAVE), strBuffer);
 
    // Even if On_create() returns error, VMLAB will still create a window
-   // and call On_window_init() so the "if(VAR(Memory))" statement is
+   // and call On_window_init() so the "if(VAR(Memory).data())" statement is
    // necessary to avoid an exception.
    // TODO: VMLAB should be fixed not to create windows on failed On_create()
-   if(VAR(Memory)) {      
+   if(VAR(Memory).data()) {      
       // Initialize Hexfile support class. For some reason VMLAB adds a space
       // in front of the title string for most child windows, so this peripheral
       // maintains the same convention. Icon resource 13005 in VMLAB.EXE is the
@@ -621,25 +704,33 @@ void On_window_init(HWND pHandle)
       // including the instance name in case of multiple eeprom24 instances.
       sprintf(strBuffer, " EEPROM 24xxx Memory (%s)", GET_INSTANCE());
       VAR(Hex).init(DLL_instance, pHandle, strBuffer, 13005);
-      VAR(Hex).data(VAR(Memory), VAR(Pointer_mask) + 1);
+      VAR(Hex).data(&VAR(Memory));
 
       // If this instance has a user assigned name (i.e. not a "$NN" name auto
       // generated by VMLAB) then automatically load the EEPROM memory contents
-      // from "<Name>.eep", but only if it already exists.
+      // from "<Name>.eep", but only if it already exists and the memory is
+      // not already mapped from "<Name>.bin".
       sprintf(strBuffer, "%s.eep", GET_INSTANCE());
-      if(strBuffer[0] != '$' && GetFileAttributes(strBuffer) != (unsigned) -1) {
+      if(strBuffer[0] != '$' && !VAR(Memory).mapped() &&
+         GetFileAttributes(strBuffer) != (unsigned) -1) {
          VAR(Hex).load(strBuffer, Hexfile::FT_HEX);
       }
    }
 
    // Even if On_create() returns error, VMLAB will still create a window
-   // and call On_window_init() so the "if(VAR(Flags))" statement is
+   // and call On_window_init() so the "if(VAR(Cover).size())" statement is
    // necessary to avoid an exception.
    // TODO: VMLAB should be fixed not to create windows on failed On_create()
-   if(VAR(Flags)) {
-      // Register the bitflags buffer used for color highlighting in the hex
+   if(VAR(Memory).data() && VAR(Cover).size()) {
+      // Register the coverage bitmap used for color highlighting in the hex
       // editor for read/write coverage
-      VAR(Hex).flags(VAR(Flags), VAR(Pointer_mask) + 1);
+      VAR(Hex).coverage(&VAR(Cover));
+   }
+
+   // Register the bitflags buffer used for watchpoints set from the hex
+   // editor's pop-up menu
+   if(VAR(Memory).data() && VAR(Flags).data()) {
+      VAR(Hex).flags(&VAR(Flags));
    }
 }
 
@@ -649,28 +740,31 @@ void On_destroy()
 // etc.
 {
    // On_destroy() is always called even if On_create() returns error.
-   // The "if(VAR(Memory))" statement is necessary to avoid an exception.
-   if(VAR(Memory)) {
+   // The "if(VAR(Memory).data())" statement is necessary to avoid an
+   // exception.
+   if(VAR(Memory).data()) {
       // If this instance has a user assigned name (i.e. not a "$NN" name auto
       // generated by VMLAB) then automatically save the EEPROM memory contents
-      // to "<Name>.eep".
+      // to "<Name>.eep". The save is atomic so that a crash while saving
+      // cannot leave behind a truncated file. A memory mapped "<Name>.bin"
+      // file is always up to date and needs no saving.
       char strBuffer[MAX_PATH];
       sprintf(strBuffer, "%s.eep", GET_INSTANCE());
-      if(strBuffer[0] != '$') {
-         VAR(Hex).save(strBuffer, Hexfile::FT_HEX);
+      if(strBuffer[0] != '$' && !VAR(Memory).mapped()) {
+         VAR(Hex).save(strBuffer, Hexfile::FT_HEX, true);
       }
 
       // Deallocate EEPROM contents memory previously allocated in On_create()
       // and destroy the hex editor window to ensure no accidental memory
       // references to the deallocated buffer.
       VAR(Hex).destroy();
-      free(VAR(Memory));
+      VAR(Memory).destroy();
    }
    
-   // Deallocate bit flag buffer previously allocated in On_create()
-   if(VAR(Flags)) {
-      free(VAR(Flags));
-   }
+   // Deallocate coverage bitmap and bitflags previously allocated in
+   // On_create()
+   VAR(Cover).destroy();
+   VAR(Flags).destroy();
 }
 
 void On_simulation_begin()
@@ -682,6 +776,12 @@ void On_simulation_begin()
    VAR(State) = ST_IDLE;
    VAR(Pointer) = 0x0;
    VAR(Dirty) = true;
+
+   // SDA is not driven until the first TX bit is shifted out
+   VAR(TX_pending) = 0;
+   VAR(TX_skip) = false;
+   VAR(SDA_low) = false;
+   VAR(SCL_fall) = 0;
 }
 
 void On_simulation_end()
@@ -694,8 +794,18 @@ void On_simulation_end()
    SetWindowText(GET_HANDLE(GDT_STATUS), "?");
    VAR(Dirty) = false;
    
+   // If the VMLAB_COVERAGE environment variable is set, merge the coverage
+   // from this run into "<Name>.cov" so it accumulates over many runs.
+   if(!VAR(Cover).collect(GET_INSTANCE())) {
+      char strBuffer[MAXBUF];
+      snprintf(strBuffer, MAXBUF, "%s: Could not update %s.cov in "
+         COVERAGE_ENV " directory", GET_INSTANCE(), GET_INSTANCE());
+      PRINT(strBuffer);
+   }
+
    // Clear R/W coverage in hex editor and force a redraw of the hex editor
-   memset(VAR(Flags), 0x00, VAR(Pointer_mask) + 1);
+   VAR(Cover).clear();
+   VAR(Hex).touch(0, VAR(Pointer_mask) + 1);
    VAR(Hex).refresh();
 }
 
@@ -721,24 +831,54 @@ void On_digital_in_edge_(PIN pDigitalIn, EDGE pEdge, double pTime)
       // RX data is sampled on the rising edge of the clock. TX data is
       // shifted on the falling edge after a short delay.
       case SCL:
-      
-         // Data is shifted in MSb first. Don't try to receive if the last TX
-         // bit has just been shifted out, because this rising edge will be
-         // used by the master to sample the last bit.
-         if(pEdge == RISE && VAR(RX_count) && !VAR(TX_count)) {
-            VAR(RX_byte) <<= 1;
-            VAR(RX_byte) |= (GET_LOGIC(SDA) == 1);
-            VAR(RX_count)--;
-                        
-            // If all expected bits eceived, call On_Rx() to handle the data
-            if(VAR(RX_count) == 0) {
-               On_Rx(VAR(RX_byte));
+         if(pEdge == RISE) {
+         
+            // A TX bit that leaves SDA unchanged is shifted here instead of
+            // in On_remind_me(). If SCL_TO_OUT has not yet passed, then the
+            // clock is too fast and On_remind_me() would have reported it and
+            // shifted the bit only after this edge.
+            bool txLate = false;
+            if(VAR(TX_skip)) {
+               VAR(TX_skip) = false;
+               if(pTime - VAR(SCL_fall) < SCL_TO_OUT) {
+                  Error("Clock on SCL pin changing too fast");
+                  txLate = true;
+               } else {
+                  Tx_bit();
+               }
             }
+         
+            // Data is shifted in MSb first. Don't try to receive if the last
+            // TX bit has just been shifted out, because this rising edge will
+            // be used by the master to sample the last bit.
+            if(VAR(RX_count) && !VAR(TX_count)) {
+               VAR(RX_byte) = VAR(RX_byte) << 1 | (GET_LOGIC(SDA) == 1);
+
+               // If all expected bits received, call On_Rx() to handle data
+               if(--VAR(RX_count) == 0) {
+                  On_Rx(VAR(RX_byte));
+               }
+            }
+
+            if(txLate) {
+               Tx_bit();
+            }
+            break;
          }
-               
-         // Pending TX data is shifted out 300ns after falling SCL edge
-         if(pEdge == FALL && VAR(TX_count)) {     
-            REMIND_ME(SCL_TO_OUT, NTF_TX);
+
+         // Pending TX data is shifted out SCL_TO_OUT after falling SCL edge.
+         // If the next bit leaves SDA unchanged, there is nothing to do at
+         // that time except for checking SCL, so no REMIND_ME() is needed
+         // and the next rising edge does both instead.
+         VAR(SCL_fall) = pTime;
+         if(VAR(TX_count)) {
+            bool low = (VAR(TX_byte) & 0x8000) != 0;
+            if(!VAR(TX_pending) && low == VAR(SDA_low)) {
+               VAR(TX_skip) = true;
+            } else {
+               VAR(TX_pending)++;
+               REMIND_ME(SCL_TO_OUT, NTF_TX);
+            }
          }
          
          break;
@@ -760,6 +900,7 @@ void On_remind_me(double pTime, int pData)
 
       // Shift out the next data bit
       case NTF_TX:
+         VAR(TX_pending)--;
 
          // Verify SCL is still low, otherwise a transition on SDA would
          // be interpreted as a START or STOP condition.
@@ -773,19 +914,7 @@ void On_remind_me(double pTime, int pData)
             return;
          }
 
-         // Data is shifted out MSb first. Because SDA is open-collector, a 0
-         // bit is actively driven on SDA and a 1 bit tri-states SDA and lets
-         // the pull-up resistor generate the high logic value. Note that the
-         // data in TX_byte is actually inverted so a 0 bit in the variable is
-         // output as a 1 bit on SDA and vice-versa.
-         if(VAR(TX_byte) & 0x8000) {
-            SET_DRIVE(SDA, true);
-            SET_LOGIC(SDA, 0);
-         } else {
-            SET_DRIVE(SDA, false);            
-         }
-         VAR(TX_byte) <<= 1;
-         VAR(TX_count)--;                  
+         Tx_bit();
          break;
    }
 }
@@ -796,9 +925,9 @@ void On_gadget_notify(GADGET pGadgetId, int pCode)
 // Handles button/checkbox clicks in the GUI.
 {
    // Even if On_create() returns error, VMLAB will still create a window
-   // and call On_window_init() so the "if(VAR(Memory))" statement is
+   // and call On_window_init() so the "if(VAR(Memory).data())" statement is
    // necessary to avoid an exception.
-   if(VAR(Memory)) {
+   if(VAR(Memory).data()) {
       switch(pGadgetId) {
          case GDT_BREAK:      VAR(Break) ^= 1; break;         
          case GDT_LOG:        VAR(Log) ^= 1; break;
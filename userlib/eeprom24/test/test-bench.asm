@@ -0,0 +1,169 @@
+; ******************************************************
+; Full memory write and sequential read of a 64 KB I2C
+; EEPROM for the eeprom24 benchmark. SDA is PC4 and SCL
+; is PC5. PORTC4 stays 0 so SDA is driven low by setting
+; DDRC4 and released to the pull-up by clearing it.
+; ******************************************************
+
+.include "C:\VMLAB\include\m8def.inc"
+
+.def data = r16     ; Byte to send or byte received
+.def bits = r17     ; Bit counter in i2c_write and i2c_read
+.def temp = r18
+.def count = r20    ; Bytes left in current page
+.def addrl = r24    ; EEPROM address; adiw needs r24:r25
+.def addrh = r25
+
+.equ SDA = 4
+.equ SCL = 5
+.equ SLAVE = 0xA0   ; Default "1010xxx" slave address, write flag
+
+.org 0
+	rjmp begin
+
+.org 19
+
+begin:
+	ldi temp, high(RAMEND)
+	out SPH, temp
+	ldi temp, low(RAMEND)
+	out SPL, temp
+
+	ldi temp, 0x07      ; PB0 = write done, PB1 = read done, PB2 = error
+	out DDRB, temp
+	clr temp
+	out PORTB, temp
+	sbi PORTC, SCL      ; SCL idles high; SDA released
+	sbi DDRC, SCL
+
+; Write a pattern of (address LSB xor address MSB) to every page
+	clr addrl
+	clr addrh
+page:
+	rcall i2c_start
+	ldi data, SLAVE
+	rcall i2c_write
+	mov data, addrh
+	rcall i2c_write
+	mov data, addrl
+	rcall i2c_write
+	ldi count, 128
+page_byte:
+	mov data, addrl
+	eor data, addrh
+	rcall i2c_write
+	adiw addrl, 1
+	dec count
+	brne page_byte
+	rcall i2c_stop
+	mov temp, addrl
+	or temp, addrh
+	brne page
+	sbi PORTB, 0
+
+; Set the address to 0 and read back the whole memory
+	rcall i2c_start
+	ldi data, SLAVE
+	rcall i2c_write
+	clr data
+	rcall i2c_write
+	clr data
+	rcall i2c_write
+	rcall i2c_start
+	ldi data, SLAVE | 1
+	rcall i2c_write
+read_byte:
+	mov temp, addrl     ; NAK the last byte at address 0xFFFF
+	and temp, addrh
+	com temp
+	rcall i2c_read
+	mov temp, addrl
+	eor temp, addrh
+	cpse data, temp
+	sbi PORTB, 2
+	adiw addrl, 1
+	brne read_byte
+	rcall i2c_stop
+	sbi PORTB, 1
+
+done:
+	rjmp done
+
+; START condition; also used as repeated START
+i2c_start:
+	cbi DDRC, SDA
+	rcall wait
+	sbi PORTC, SCL
+	rcall wait
+	sbi DDRC, SDA
+	rcall wait
+	cbi PORTC, SCL
+	ret
+
+; STOP condition
+i2c_stop:
+	sbi DDRC, SDA
+	rcall wait
+	sbi PORTC, SCL
+	rcall wait
+	cbi DDRC, SDA
+	rcall wait
+	ret
+
+; Send data MSb first and clock in the slave's ACK (ignored)
+i2c_write:
+	ldi bits, 8
+write_bit:
+	lsl data
+	brcs write_one
+	sbi DDRC, SDA
+	rjmp write_clock
+write_one:
+	cbi DDRC, SDA
+write_clock:
+	rcall wait
+	sbi PORTC, SCL
+	rcall wait
+	cbi PORTC, SCL
+	dec bits
+	brne write_bit
+	cbi DDRC, SDA
+	rcall wait
+	sbi PORTC, SCL
+	rcall wait
+	cbi PORTC, SCL
+	ret
+
+; Receive data MSb first, then send an ACK if temp is non-zero
+; or a NAK if it is zero. SCL stays low for longer than the
+; 900 ns the EEPROM needs to place each bit on SDA.
+i2c_read:
+	cbi DDRC, SDA
+	ldi bits, 8
+read_bit:
+	rcall wait
+	sbi PORTC, SCL
+	rcall wait
+	clc
+	sbic PINC, SDA
+	sec
+	rol data
+	cbi PORTC, SCL
+	dec bits
+	brne read_bit
+	tst temp
+	breq read_nak
+	sbi DDRC, SDA
+read_nak:
+	rcall wait
+	sbi PORTC, SCL
+	rcall wait
+	cbi PORTC, SCL
+	cbi DDRC, SDA
+	ret
+
+; About 1.2 us at 8 MHz including the rcall
+wait:
+	nop
+	nop
+	ret
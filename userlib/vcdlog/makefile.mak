@@ -0,0 +1,41 @@
+LD	 = ilink32
+INCLUDE	 = ${MAKEDIR}\..\include
+LIBDIR	 = ${MAKEDIR}\..\lib
+LIBS	 = ${LIBDIR}\c0d32.obj,$@, , ${LIBDIR}\import32.lib ${LIBDIR}\cw32.lib, ,
+CPPFLAGS = -I"${INCLUDE}" -H -w-par -R -WM- -vi -WD -o$@ -c $**
+LDFLAGS	 = -L"${LIBDIR}; ${LIBDIR}\psdk" -Tpd -aa -x -Gn
+DELFILES = *.obj *.dll *.tds *.res
+
+
+
+all: vcdlog.dll vcdlog8.dll vcdlog16.dll vcdlog32.dll vcdlogr.dll
+
+clean:
+	del ${DELFILES}
+
+vcdlog.dll: vcdlog.obj vcdlog.res
+	${LD} ${LDFLAGS} vcdlog.obj ${LIBS} vcdlog.res
+
+vcdlog8.dll: vcdlog8.obj vcdlog.res
+	${LD} ${LDFLAGS} vcdlog8.obj ${LIBS} vcdlog.res
+
+vcdlog16.dll: vcdlog16.obj vcdlog.res
+	${LD} ${LDFLAGS} vcdlog16.obj ${LIBS} vcdlog.res
+
+vcdlog32.dll: vcdlog32.obj vcdlog.res
+	${LD} ${LDFLAGS} vcdlog32.obj ${LIBS} vcdlog.res
+
+vcdlogr.dll: vcdlogr.obj vcdlog.res
+	${LD} ${LDFLAGS} vcdlogr.obj ${LIBS} vcdlog.res
+
+vcdlog8.obj: vcdlog.cpp
+	${CC} -DVCDBUS=8 ${CPPFLAGS}
+
+vcdlog16.obj: vcdlog.cpp
+	${CC} -DVCDBUS=16 ${CPPFLAGS}
+
+vcdlog32.obj: vcdlog.cpp
+	${CC} -DVCDBUS=32 ${CPPFLAGS}
+
+vcdlogr.obj: vcdlog.cpp
+	${CC} -DVCDREAL ${CPPFLAGS}
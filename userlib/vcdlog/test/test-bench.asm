@@ -0,0 +1,22 @@
+; ******************************************************
+; Fast 8-bit counter on PORTD for the vcdlog benchmark
+; ******************************************************
+
+.include "C:\VMLAB\include\m8def.inc"
+
+.def data = r16
+
+.org 0
+	rjmp begin
+
+.org 19
+
+begin:
+	ser data
+	out DDRD, data
+	clr data
+
+loop:
+	out PORTD, data
+	inc data
+	rjmp loop
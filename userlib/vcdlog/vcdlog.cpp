@@ -12,14 +12,45 @@
 //
 // X<Name> _vcdlog <Data>
 //
+// X<Name> _vcdlog8 <D0> <D1> ... <D7>
+// X<Name> _vcdlog16 <D0> <D1> ... <D15>
+// X<Name> _vcdlog32 <D0> <D1> ... <D31>
+// X<Name> _vcdlogr(<Delta>) <Data>
+//
 // The component always writes to a file named "vcdlog.vcd", and if multiple
 // component instances are used in the same project file, then the logged data
 // from each instance is interleaved within the file. The instance <Name> is
 // used as the variable name in the VCD file. <Data> is the single input
 // bit being logged. The VCD file always uses a 1ns timescale, which will
-// be adequate for all clock speeds under 1Ghz. The maximum number of vcdlog
-// instances allowed per project is 94 (due to the single character ASCII
-// identifiers used in a VCD file).
+// be adequate for all clock speeds under 1Ghz. There is no limit on the number
+// of vcdlog instances; after the first 94 instances, the VCD file identifiers
+// simply become more than one character long.
+//
+// Value changes on the <Data> input are logged when VMLAB reports an edge on
+// it, so idle signals cost almost nothing during the simulation. Since VMLAB
+// reports no edge when an input becomes UNKNOWN, the input is also sampled
+// once every 10us of simulated time as a fallback. A signal that becomes
+// UNKNOWN partway through the simulation is therefore logged as 'x' up to 10us
+// late, and only if VMLAB reports the UNKNOWN value to the DIGITAL_IN pin (see
+// DECLARE_PINS below). All output is collected in a large memory buffer which
+// is written to the file in big chunks, so the file may not be complete until
+// the simulation ends.
+//
+// The vcdlog8, vcdlog16, and vcdlog32 variants log an entire bus as a single
+// VCD vector variable, with the least significant bit <D0> given first. Any
+// edges on the bus pins during a time step are combined into a single vector
+// value change at the end of that time step. UNKNOWN bits are logged as 'x'
+// with the same 10us sampling fallback as the 1-bit component.
+//
+// The vcdlogr variant logs the voltage at the analog <Data> input as a VCD real
+// variable. A new value is only logged when the voltage differs from the last
+// logged value by more than <Delta> volts, so that noise or a slowly changing
+// voltage does not flood the file. If <Delta> is 0 or omitted, every change is
+// logged. Since analog inputs have no edges, this variant samples its input in
+// every time step.
+//
+// Each variant is a separate DLL, so it writes to its own file named after the
+// variant (e.g. "vcdlog8.vcd") and not to "vcdlog.vcd".
 //
 // Version History:
 // v1.0 11/25/08 - Initial public release
@@ -34,9 +65,11 @@
 #include <windows.h>
 #include <commctrl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <math.h>
 #pragma hdrstop
 #include "C:\VMLAB\bin\blackbox.h"
 int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
@@ -50,8 +83,18 @@ int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
 #define TIME_MULT 1E9
 #define TIME_UNITS "ns"
 
-// Output filename always created by this component
+// Output filename always created by this component. The makefile defines
+// VCDBUS as 8, 16, or 32 for the bus variants, and VCDREAL for the analog
+// variant. Each variant has its own globals and therefore its own file.
+#define STRINGIZE(x) #x
+#define TO_STRING(x) STRINGIZE(x)
+#if defined(VCDBUS)
+#define FILE_NAME "vcdlog" TO_STRING(VCDBUS) ".vcd"
+#elif defined(VCDREAL)
+#define FILE_NAME "vcdlogr.vcd"
+#else
 #define FILE_NAME "vcdlog.vcd"
+#endif
 
 // The lowest and highest ASCII characters that are allowed in a VCD file for
 // identifying the value changes with the appropriate variable name from the
@@ -59,15 +102,69 @@ int WINAPI DllEntryPoint(HINSTANCE, unsigned long, void*) {return 1;} // is DLL
 #define MIN_ID '!'
 #define MAX_ID '~'
 
+// Maximum length of the identifier string, which allows for 94^7 instances
+#define MAX_ID_LEN 8
+
+// Size of the memory buffer used to collect output before writing it to the
+// VCD file in a single fwrite() call.
+#define BUFFER_SIZE (4 * 1024 * 1024)
+
+// Interval (in seconds) at which digital inputs are sampled with GET_LOGIC(),
+// in addition to the edges, to catch inputs becoming UNKNOWN without an edge
+#define SAMPLE_PERIOD 10E-6
+
 //==============================================================================
 // Declare pins here
 // Unfortunately, DIGITAL_IN() does not reliably return UNKNOWN for input pins;
-// it only seems to return it at the very beginning of the simulation. To
-// actually detect UNKNOWN logic values, the input is declared as analog, in
-// which case an UNKNOWN logic value is presented as a voltage level of
-// "POWER() / 2".
+// it is always returned at the very beginning of the simulation, but not
+// always afterwards. This is still good enough to log the initial UNKNOWN
+// state of a signal, and using a digital input allows On_digital_in_edge() to
+// be used instead of polling the voltage of an analog input in every
+// On_time_step(). Only the vcdlogr variant, which logs the actual voltage,
+// still uses an analog input.
 DECLARE_PINS
+#if defined(VCDBUS)
+   DIGITAL_IN(D0, 1);
+   DIGITAL_IN(D1, 2);
+   DIGITAL_IN(D2, 3);
+   DIGITAL_IN(D3, 4);
+   DIGITAL_IN(D4, 5);
+   DIGITAL_IN(D5, 6);
+   DIGITAL_IN(D6, 7);
+   DIGITAL_IN(D7, 8);
+#if VCDBUS > 8
+   DIGITAL_IN(D8, 9);
+   DIGITAL_IN(D9, 10);
+   DIGITAL_IN(D10, 11);
+   DIGITAL_IN(D11, 12);
+   DIGITAL_IN(D12, 13);
+   DIGITAL_IN(D13, 14);
+   DIGITAL_IN(D14, 15);
+   DIGITAL_IN(D15, 16);
+#endif
+#if VCDBUS > 16
+   DIGITAL_IN(D16, 17);
+   DIGITAL_IN(D17, 18);
+   DIGITAL_IN(D18, 19);
+   DIGITAL_IN(D19, 20);
+   DIGITAL_IN(D20, 21);
+   DIGITAL_IN(D21, 22);
+   DIGITAL_IN(D22, 23);
+   DIGITAL_IN(D23, 24);
+   DIGITAL_IN(D24, 25);
+   DIGITAL_IN(D25, 26);
+   DIGITAL_IN(D26, 27);
+   DIGITAL_IN(D27, 28);
+   DIGITAL_IN(D28, 29);
+   DIGITAL_IN(D29, 30);
+   DIGITAL_IN(D30, 31);
+   DIGITAL_IN(D31, 32);
+#endif
+#elif defined(VCDREAL)
    ANALOG_IN(DATA, 1);
+#else
+   DIGITAL_IN(DATA, 1);
+#endif
 END_PINS
 
 // =============================================================================
@@ -78,6 +175,15 @@ END_PINS
 DECLARE_VAR
    LOGIC Log_data;         // Previous pin state already written to the log
    int Instance_number;    // Number of this component instance
+   char Id[MAX_ID_LEN];    // VCD identifier string based on Instance_number
+   int Id_length;          // Number of characters in Id[]
+   bool Logged;            // True once a bus or real value has been logged
+   bool Changed;           // True if any bus pin had an edge this time step
+   DWORD Log_bits;         // Previous bus value already written to the log
+   DWORD Log_unknown;      // Bitmask of bus bits previously logged as 'x'
+   double Log_voltage;     // Previous voltage already written to the log
+   double Delta;           // Minimum voltage change logged by vcdlogr
+   double Next_sample;     // Time at which digital inputs are next sampled
 END_VAR
 
 // You can delare also globals variable outside DECLARE_VAR / END_VAR, but if
@@ -92,9 +198,15 @@ END_VAR
 // messages.
 FILE *File = NULL;
 
+// Output buffer shared by all vcdlog instances. It is allocated together with
+// opening the log file, and it is written out whenever it fills up and when
+// the log file is closed.
+char *Buffer = NULL;
+int Buffer_used = 0;
+
 // Total number of vcdlog component instances. Since the VCD file requires a
-// different ASCII character identifier for each signal, this count is used
-// to initialize VAR(Instance_number).
+// different ASCII identifier for each signal, this count is used to initialize
+// VAR(Instance_number).
 int Instance_count = 0;
 
 // Time step at which any vcdlog instance last wrote to the log file.
@@ -114,6 +226,30 @@ USE_WINDOW(0);   // If window USE_WINDOW(WINDOW_USER_1) (for example)
 // =============================================================================
 // Helper Functions
 
+bool Flush_file(void)
+//********************
+// Write out all the data collected in the output buffer with a single call to
+// fwrite(). The buffer is always emptied, but false is returned (after breaking
+// with an error message) if an I/O error occured.
+{
+   char strBuffer[MAXBUF];
+   int length = Buffer_used;
+
+   Buffer_used = 0;
+   if(!File || !length) {
+      return true;
+   }
+
+   if(fwrite(Buffer, 1, length, File) != (size_t) length || ferror(File)) {
+      snprintf(strBuffer, MAXBUF, "Could not write \"%s\" file: %s",
+         FILE_NAME, strerror(errno));
+      BREAK(strBuffer);
+      return false;
+   }
+   
+   return true;
+}
+
 void Close_file(void)
 //********************
 // Close the global log file, and check for any I/O errors that can occur
@@ -126,6 +262,11 @@ void Close_file(void)
       return;
    }
 
+   // Write out anything left in the output buffer and release the buffer
+   Flush_file();
+   free(Buffer);
+   Buffer = NULL;
+
    // Close the log file so it can be moved or deleted
    if(fclose(File)) {
       snprintf(strBuffer, MAXBUF, "Error closing/flushing \"%s\" file: %s",
@@ -136,38 +277,160 @@ void Close_file(void)
    File = NULL;
 }
 
+void Log_write(const char *pData, int pLength)
+//********************
+// Append pLength bytes from pData to the output buffer. If the buffer is full,
+// it is first written to the file with Flush_file(). Checking for I/O errors
+// right after each fwrite() guarantees that errno will still be valid and that
+// strerror() wlll produce a useful message to the user.
+{
+   // Do nothing if the log file could not be opened or was already closed
+   // due to a previous error.
+   if(!File) {
+      return;
+   }
+
+   // If any I/O error occurred, close the log file to disable further logging
+   if(Buffer_used + pLength > BUFFER_SIZE && !Flush_file()) {
+      Close_file();
+      return;
+   }
+
+   memcpy(Buffer + Buffer_used, pData, pLength);
+   Buffer_used += pLength;
+}
+
 void Log_printf(char *fmt, ...)
 //********************
-// Wrapper around vfprintf that checks for any file I/O errors. Since the
-// printf() style functions will occasionally flush the stdio buffers, they
-// can return a system level error (such as disk full). Using a wrapper
-// function that checks for errors immediately after each printf() guarantees
-// that errno will still be valid and that strerror() wlll produce a useful
-// message to the user.
+// Wrapper around vsnprintf() that appends the formatted string to the output
+// buffer with Log_write().
 {
    char strBuffer[MAXBUF];
    va_list args;
 
-   // Do nothing if the log file could not be opened or was already closed
-   // due to a previous error.
+   va_start(args, fmt);
+   int length = vsnprintf(strBuffer, MAXBUF, fmt, args);
+   va_end(args);
+   
+   if(length > 0) {
+      Log_write(strBuffer, length < MAXBUF ? length : MAXBUF - 1);
+   }
+}
+
+void Log_change(double pTime)
+//********************
+// Called before writing any value change to the log file. The first value
+// change logged by any instance also finishes the VCD header section, which is
+// only possible after all instances had their On_simulation_begin() called.
+{
+   if(Log_time == -1) {
+      Log_printf("$upscope $end\n");
+      Log_printf("$enddefinitions $end\n");
+      Log_time = 0;
+   }
+
+   // If this component instance is the first to log something at the
+   // current "pTime" then also write the current elapsed time to the file
+   if(pTime > Log_time) {
+      // The elapsed time (in seconds) is logged as an integer number of
+      // nanoseconds. To avoid any floating point round off errors, the
+      // printf() is used to round up the result to the closest integer
+      // instead of using an integer cast.
+      Log_printf("#%.0lf\n", pTime * TIME_MULT);
+      Log_time = pTime;
+   }
+}
+
+void Log_value(LOGIC pData, double pTime)
+//********************
+// Write a value change to the log file if pData is different from the value
+// previously logged by this instance.
+{
+   // Do nothing if the value is unchanged or if there is no log file
+   if(pData == VAR(Log_data) || !File) {
+      return;
+   }
+   Log_change(pTime);
+
+   // Write the new changed pin state and the identifier to the log file
+   char line[MAX_ID_LEN + 2];
+   line[0] = pData == 0 ? '0' : pData == 1 ? '1' : 'x';
+   memcpy(line + 1, VAR(Id), VAR(Id_length));
+   line[VAR(Id_length) + 1] = '\n';
+   Log_write(line, VAR(Id_length) + 2);
+
+   VAR(Log_data) = pData;
+}
+
+#ifdef VCDBUS
+void Log_vector(double pTime)
+//********************
+// Read all of the bus pins and write them as a single "b" vector value change
+// if the bus value is different from the one previously logged.
+{
+   DWORD bits = 0, unknown = 0;
+
+   for(int i = 0; i < VCDBUS; i++) {
+      LOGIC data = GET_LOGIC((PIN) (D0 + i));
+      if(data == UNKNOWN) {
+         unknown |= 1UL << i;
+      } else if(data) {
+         bits |= 1UL << i;
+      }
+   }
+
+   // Do nothing if the value is unchanged or if there is no log file
+   if(VAR(Logged) && bits == VAR(Log_bits) && unknown == VAR(Log_unknown)) {
+      return;
+   }
    if(!File) {
       return;
    }
+   Log_change(pTime);
+   
+   // The vector is written with the most significant bit first
+   char line[VCDBUS + MAX_ID_LEN + 3];
+   char *ptr = line;
+   *ptr++ = 'b';
+   for(int i = VCDBUS - 1; i >= 0; i--) {
+      *ptr++ = (unknown >> i) & 1 ? 'x' : (bits >> i) & 1 ? '1' : '0';
+   }
+   *ptr++ = ' ';
+   memcpy(ptr, VAR(Id), VAR(Id_length));
+   ptr += VAR(Id_length);
+   *ptr++ = '\n';
+   Log_write(line, ptr - line);
+   
+   VAR(Log_bits) = bits;
+   VAR(Log_unknown) = unknown;
+   VAR(Logged) = true;
+}
+#endif
 
-   // Call the real fvprintf function to do the actual printing
-   va_start(args, fmt);
-   vfprintf(File, fmt, args);
+#ifdef VCDREAL
+void Log_real(double pTime)
+//********************
+// Read the voltage of the analog input and write it as an "r" real value
+// change if it differs from the previously logged voltage by more than
+// VAR(Delta).
+{
+   double voltage = GET_VOLTAGE(DATA);
 
-   // If any I/O error occurred, break with error message and close log file
-   if(ferror(File)) {
-      snprintf(strBuffer, MAXBUF, "Could not write \"%s\" file: %s",
-         FILE_NAME, strerror(errno));
-      BREAK(strBuffer);
-      Close_file();
+   // Do nothing if the change is too small or if there is no log file
+   if(VAR(Logged) && fabs(voltage - VAR(Log_voltage)) <= VAR(Delta)) {
+      return;
+   }
+   if(!File) {
+      return;
    }
+   Log_change(pTime);
 
-   va_end(args);
+   Log_printf("r%.6g %.*s\n", voltage, VAR(Id_length), VAR(Id));
+
+   VAR(Log_voltage) = voltage;
+   VAR(Logged) = true;
 }
+#endif
 
 // =============================================================================
 // Callback functions. These functions are called by VMLAB at the proper time
@@ -179,6 +442,14 @@ const char *On_create()
 // Messages window. Typical tasks: check passed parameters, open files,
 // allocate memory,...
 {
+#ifdef VCDREAL
+   // <Delta> is optional; the default of 0 logs every voltage change
+   VAR(Delta) = GET_PARAM(1);
+   if(VAR(Delta) < 0) {
+      return "Optional <Delta> argument must not be negative";
+   }
+#endif
+
    return NULL;
 }
 
@@ -214,20 +485,24 @@ void On_simulation_begin()
 
    // Force the initial value of data input to be logged at time step 0
    VAR(Log_data) = -1;
+   VAR(Logged) = false;
+   VAR(Changed) = false;
+   VAR(Next_sample) = 0;
 
    // Keep track of how many instances have already been created
    VAR(Instance_number) = Instance_count;
    Instance_count++;
    
-   // Because the VCD file format uses a single ASCII character to identify each
-   // signal, it limits the number of vcdlog instances that can be used in a
-   // project
-   if(VAR(Instance_number) + MIN_ID > MAX_ID) {
-      snprintf(strBuffer, MAXBUF, "Too many instances (max %d)",
-         MAX_ID - MIN_ID + 1);
-      BREAK(strBuffer);
-      Close_file();
-   }
+   // The VCD file format identifies each signal with a string of printable
+   // ASCII characters. The instance number is converted into such a string
+   // using base 94 digits (least significant first), so the first 94 instances
+   // still use a single character just like before.
+   int number = VAR(Instance_number);
+   VAR(Id_length) = 0;
+   do {
+      VAR(Id)[VAR(Id_length)++] = MIN_ID + number % (MAX_ID - MIN_ID + 1);
+      number /= MAX_ID - MIN_ID + 1;
+   } while(number);
 
    // The first instance to have its On_simulation_begin() called is responsible
    // for opening the log file and initializing global variables.
@@ -238,8 +513,9 @@ void On_simulation_begin()
       // On_time_step(), to finish writing the VCD header section.
       Log_time = -1;
 
-      // Create or overwrite log file in current directory
-      File = fopen(FILE_NAME, "w");
+      // Create or overwrite log file in current directory. The file is
+      // opened in binary mode since all output is written with fwrite().
+      File = fopen(FILE_NAME, "wb");
 
       // We can still run if the file won't open; we just can't log anything.
       if(!File) {
@@ -247,6 +523,15 @@ void On_simulation_begin()
             FILE_NAME, strerror(errno));
          BREAK(strBuffer);
       }
+
+      // Allocate the output buffer; logging is disabled if out of memory
+      Buffer = (char *) malloc(BUFFER_SIZE);
+      Buffer_used = 0;
+      if(File && !Buffer) {
+         BREAK("Out of memory allocating output buffer");
+         fclose(File);
+         File = NULL;
+      }
       
       // Write out the global VCD file header
       Log_printf("$version VMLAB vcdlog component $end\n");
@@ -256,8 +541,16 @@ void On_simulation_begin()
 
    // Write out per instance part of the VCD header that contains the variable
    // name and the ASCII identifier.
-   Log_printf("$var wire 1 %c %s $end\n",
-      VAR(Instance_number) + MIN_ID, GET_INSTANCE());
+#if defined(VCDBUS)
+   Log_printf("$var wire %d %.*s %s [%d:0] $end\n",
+      VCDBUS, VAR(Id_length), VAR(Id), GET_INSTANCE(), VCDBUS - 1);
+#elif defined(VCDREAL)
+   Log_printf("$var real 64 %.*s %s $end\n",
+      VAR(Id_length), VAR(Id), GET_INSTANCE());
+#else
+   Log_printf("$var wire 1 %.*s %s $end\n",
+      VAR(Id_length), VAR(Id), GET_INSTANCE());
+#endif
 }
 
 void On_simulation_end()
@@ -284,7 +577,20 @@ void On_digital_in_edge(PIN pDigitalIn, EDGE pEdge, double pTime)
 // Response to a digital input pin edge. The EDGE type parameter (pEdge) can
 // be RISE or FALL. Use pin identifers as declared in DECLARE_PINS
 {
-   // No Action
+#if defined(VCDBUS)
+   // Several bus pins may change in the same time step. Only remember that
+   // something changed, and let On_time_step() log the whole vector once.
+   VAR(Changed) = true;
+#elif !defined(VCDREAL)
+   // Log the new value implied by the edge, unless VMLAB happens to report
+   // the input as UNKNOWN at this time.
+   LOGIC newData = GET_LOGIC(DATA);
+   if(newData != UNKNOWN) {
+      newData = pEdge == RISE ? 1 : 0;
+   }
+   
+   Log_value(newData, pTime);
+#endif
 }
 
 double On_voltage_ask(PIN pAnalogOut, double pTime)
@@ -301,67 +607,44 @@ void On_time_step(double pTime)
 //*****************************
 // The analysis at the given time has finished. DO NOT place further actions
 // on pins (unless they are delayed). Pins values are stable at this point.
+// For the 1-bit component, value changes are logged by On_digital_in_edge(),
+// so this function only has to log the initial state of the input at time
+// step 0 and sample it for UNKNOWN values every SAMPLE_PERIOD. The bus and
+// real variants log their value changes from here.
 {
-   LOGIC newData;
-
-   // Do nothing if the log file could not be opened by the first instance
-   if(!File) {
-      return;
-   }
-
    // Record the total elapsed simulation time for use in On_simulation_end()
    Total_time = pTime;
    
-   // Since we're expecting a digital input, the input voltage should be either
-   // 0, POWER(), or POWER()/2 to designate logic 0, 1, and UNKNOWN. To allow
-   // for round off-errors or perhaps input passed though an analog RC filter,
-   // the 0 to POWER() voltage range is divided into 3 equal sections. Input
-   // voltages in the lower third are considered to be logic 0, the upper third
-   // to be logic 1, and the middle third to be UNKNOWN.
-   double voltage = GET_VOLTAGE(DATA);
-   if(voltage < (1.0/3.0) * POWER()) {
-      newData = 0;
-   } else if(voltage > (2.0/3.0) * POWER()) {
-      newData = 1;
-   } else {
-      newData = UNKNOWN;
+#if defined(VCDBUS)
+   // Log the bus once per time step in which any of its pins had an edge,
+   // and also log the initial state at the start of the simulation. The bus
+   // is also read every SAMPLE_PERIOD to catch bits becoming UNKNOWN.
+   bool sample = pTime >= VAR(Next_sample);
+   if(sample) {
+      VAR(Next_sample) = pTime + SAMPLE_PERIOD;
    }
-
-   // The first component to enter On_time_step(0) at the beginning of the
-   // simulation is responsible for finishing the VCD header section.
-   if(Log_time == -1 && pTime == 0) {
-      Log_printf("$upscope $end\n");
-      Log_printf("$enddefinitions $end\n");
-      Log_time = 0;
+   if(VAR(Changed) || sample) {
+      VAR(Changed) = false;
+      Log_vector(pTime);
    }
-   
-   // If the current state of the input pin is different from the previous
-   // state in the last time step, then the new state needs to be logged
-   if(newData != VAR(Log_data)) {
-      char id = VAR(Instance_number) + MIN_ID;
-
-      // If this component instance is the first to log something at the
-      // current "pTime" then also write the current elapsed time to the file
-      if(pTime > Log_time) {
-         // The elapsed time (in seconds) is logged as an integer number of
-         // nanoseconds. To avoid any floating point round off errors, the
-         // fprintf() is used to round up the result to the closest integer
-         // instead of using an integer cast.
-         Log_printf("#%.0lf\n", pTime * TIME_MULT);
-         Log_time = pTime;
+#elif defined(VCDREAL)
+   // Analog inputs have no edges so the voltage is checked in every step
+   Log_real(pTime);
+#else
+   // Since no edge is reported for the initial state of the input, it must
+   // be read at the very start of the simulation. After that, the input is
+   // sampled every SAMPLE_PERIOD since no edge is reported when it becomes
+   // UNKNOWN either. While the last logged value is 'x', the samples also
+   // catch the input becoming known again. Known values are otherwise left
+   // to On_digital_in_edge() which logs them with the exact edge time.
+   if(pTime >= VAR(Next_sample)) {
+      VAR(Next_sample) = pTime + SAMPLE_PERIOD;
+      LOGIC data = GET_LOGIC(DATA);
+      if(VAR(Log_data) == -1 || VAR(Log_data) == UNKNOWN || data == UNKNOWN) {
+         Log_value(data, pTime);
       }
-
-      // Write the new changed pin state to the log file
-      if(newData == 0) {
-         Log_printf("0%c\n", id);
-      } else if(newData == 1) {
-         Log_printf("1%c\n", id);
-      } else {
-         Log_printf("x%c\n", id);
-      }
-      
-      VAR(Log_data) = newData;
-   } 
+   }
+#endif
 }
 
 void On_remind_me(double pTime, int pData)